@@ -19,6 +19,11 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <errno.h>
+
+#ifndef ESTALE
+#define ESTALE ENOENT
+#endif
 
 #if defined _MSC_VER && _MSC_VER < 1900
 #define snprintf c99_snprintf
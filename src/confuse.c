@@ -24,8 +24,11 @@
 # include <strings.h>
 #endif
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
 #ifndef _WIN32
 # include <pwd.h>
 #endif
@@ -33,6 +36,10 @@
 # include <unistd.h>
 #endif
 #include <ctype.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+# include <sched.h>
+#endif
 
 #ifdef HAVE_SYS_STAT_H
 # include <sys/stat.h>
@@ -40,6 +47,9 @@
 #  define S_ISREG(mode) ((mode) & S_IFREG)
 # endif
 #endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 
 #include "compat.h"
 #include "confuse.h"
@@ -59,27 +69,33 @@ const char confuse_version[] = PACKAGE_VERSION;
 const char confuse_copyright[] = PACKAGE_STRING " by Martin Hedenfalk <martin@bzero.se>";
 const char confuse_author[] = "Martin Hedenfalk <martin@bzero.se>";
 
-char *cfg_yylval = NULL;
-
-extern int  cfg_yylex(cfg_t *cfg);
-extern void cfg_yylex_destroy(void);
-extern int  cfg_lexer_include(cfg_t *cfg, const char *fname);
-extern void cfg_scan_fp_begin(FILE *fp);
-extern void cfg_scan_fp_end(void);
+extern void *cfg_scanner_new(void);
+extern void  cfg_scanner_free(void *scanner);
+extern int   cfg_yylex(cfg_t *cfg, char **lval);
+extern int   cfg_lexer_include(cfg_t *cfg, const char *fname);
+extern void  cfg_scan_fp_begin(void *scanner, FILE *fp);
+extern int   cfg_scan_mem_begin(void *scanner, char *base, size_t size);
+extern int   cfg_scan_bytes_begin(void *scanner, const char *bytes, size_t len);
+extern void  cfg_scan_end(void *scanner);
+extern void  cfg_scan_reset(void *scanner, cfg_t *cfg);
 
 static int cfg_parse_internal(cfg_t *cfg, int level, int force_state, cfg_opt_t *force_opt);
 static void cfg_free_opt_array(cfg_opt_t *opts);
-static int cfg_print_pff_indent(cfg_t *cfg, FILE *fp,
-				cfg_print_filter_func_t fb_pff, int indent);
+static void cfg_clear_values(cfg_opt_t *opt);
+static cfg_value_t *cfg_opt_getval(cfg_opt_t *opt, unsigned int index);
+static void cfg_opt_trim(cfg_opt_t *opt);
+static int cfg_free_value_internal(cfg_opt_t *opt);
+static void cfg_opt_notify(cfg_opt_t *opt, cfg_diff_t what, unsigned int index);
+static int cfg_opt_setnval(cfg_opt_t *opt, cfg_type_t type, cfg_value_t value,
+			   unsigned int index, int notify);
+struct cfg_printer;
+static void cfg_print_sec(struct cfg_printer *p, cfg_t *cfg,
+			  cfg_print_filter_func_t fb_pff, int indent);
 
 #define STATE_CONTINUE 0
 #define STATE_EOF -1
 #define STATE_ERROR 1
 
-#ifndef HAVE_FMEMOPEN
-extern FILE *fmemopen(void *buf, size_t size, const char *type);
-#endif
-
 #ifndef HAVE_REALLOCARRAY
 extern void *reallocarray(void *optr, size_t nmemb, size_t size);
 #endif
@@ -171,1713 +187,4836 @@ int strcasecmp(const char *s1, const char *s2)
 }
 #endif
 
-static cfg_opt_t *cfg_getopt_leaf(cfg_t *cfg, const char *name)
-{
-	unsigned int i;
+/* arena allocator */
 
-	for (i = 0; cfg->opts && cfg->opts[i].name; i++) {
-		if (is_set(CFGF_NOCASE, cfg->flags)) {
-			if (strcasecmp(cfg->opts[i].name, name) == 0)
-				return &cfg->opts[i];
-		} else {
-			if (strcmp(cfg->opts[i].name, name) == 0)
-				return &cfg->opts[i];
-		}
-	}
+/*
+ * With CFGF_ARENA all memory of a cfg_init() tree is carved out of large
+ * chunks, individual frees are no-ops and everything is released at
+ * once when the root is freed.  Each allocation is prefixed with its
+ * capacity to support realloc, which grows geometrically when it cannot
+ * extend in place.  Chunks are calloc()ed, so all allocations start out
+ * zeroed.
+ */
+#define CFG_ARENA_CHUNK  (64 * 1024)
+#define CFG_ARENA_ALIGN  16
+#define CFG_ARENA_ROUND(n) (((n) + CFG_ARENA_ALIGN - 1) & ~(size_t)(CFG_ARENA_ALIGN - 1))
 
-	return NULL;
-}
+typedef struct cfg_chunk_t cfg_chunk_t;
+typedef struct cfg_arena_t cfg_arena_t;
 
-static char *parse_title(const char *name, size_t *len)
-{
-	const char *escapes = "'\\";
-	char *title;
-	char *end;
-	char *ch;
+struct cfg_chunk_t {
+	cfg_chunk_t *next;
+	size_t size;		/**< usable bytes after the header */
+	size_t used;
+};
 
-	if (*name != '\'') {
-		*len = strcspn(name, "|");
-		if (!*len)
-			return NULL;
-		return strndup(name, *len);
-	}
-
-	title = strdup(name + 1);
-	if (!title)
-		return NULL;
-
-	*len = 1;
-	ch = title;
-	end = title + strlen(title);
-	while (ch < end) {
-		size_t l = strcspn(ch, escapes);
-		*len += l + 1;
-		ch += l;
-		switch (*ch) {
-		case '\'':
-			*ch = 0;
-			return title;
-		case '\\':
-			if (!ch[1] || strcspn(ch + 1, escapes)) {
-				free(title);
-				return NULL;
-			}
-			memmove(ch, ch + 1, strlen(ch));
-			ch++;
-			(*len)++;
-			break;
-		default:
-			free(title);
-			return NULL;
-		}
-	}
+#define CFG_CHUNK_HDR CFG_ARENA_ROUND(sizeof(cfg_chunk_t))
 
-	free(title);
-	return NULL;
-}
+struct cfg_arena_t {
+	cfg_chunk_t *chunks;	/**< current chunk first */
+};
 
-static long int cfg_opt_gettsecidx(cfg_opt_t *opt, const char *title)
-{
-	unsigned int i, n;
+/* A file read by the parser, a cache of the tree is keyed on it */
+typedef struct cfg_source_t {
+	char *name;
+	long long size;
+	long long mtime;
+} cfg_source_t;
+
+/* Cache image that string values point into, see cfg_cache_load() */
+typedef struct cfg_image_t cfg_image_t;
+
+struct cfg_image_t {
+	cfg_image_t *next;
+	void *addr;
+	size_t size;
+	int mapped;
+};
 
-	n = cfg_opt_size(opt);
-	for (i = 0; i < n; i++) {
-		cfg_t *sec = cfg_opt_getnsec(opt, i);
+struct cfg_schema_t {
+	unsigned int refcount;
+	cfg_opt_t *opts;
+	cfg_arena_t *arena;	/**< only with CFGF_ARENA */
+	cfg_t *root;		/**< owner of the arena */
+	int freecb;		/**< any option has a free callback */
+	cfg_source_t *sources;	/**< files parsed into the tree */
+	unsigned int nsources;
+	cfg_image_t *images;	/**< only with CFGF_ARENA */
+};
 
-		if (!sec || !sec->title)
-			return -1;
+static void cfg_arena_free(cfg_arena_t *arena)
+{
+	cfg_chunk_t *chunk, *next;
 
-		if (is_set(CFGF_NOCASE, opt->flags)) {
-			if (strcasecmp(title, sec->title) == 0)
-				return i;
-		} else {
-			if (strcmp(title, sec->title) == 0)
-				return i;
-		}
-	}
+	if (!arena)
+		return;
 
-	return -1;
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	free(arena);
 }
 
-static cfg_opt_t *cfg_getopt_secidx(cfg_t *cfg, const char *name,
-				    long int *index)
+static void *cfg_arena_alloc(cfg_arena_t *arena, size_t size)
 {
-	cfg_opt_t *opt = NULL;
-	cfg_t *sec = cfg;
+	cfg_chunk_t *chunk = arena->chunks;
+	size_t need;
+	char *ptr;
 
-	if (!cfg || !cfg->name || !name || !*name) {
-		errno = EINVAL;
+	if (size > SIZE_MAX / 2) {
+		errno = ENOMEM;
 		return NULL;
 	}
 
-	while (name && *name) {
-		char *title = NULL;
-		long int i = -1;
-		char *secname;
-		size_t len;
-
-		len = strcspn(name, "|=");
-		if (!index && name[len] == 0 /*len == strlen(name) */ )
-			/* no more subsections */
-			break;
-
-		if (!len)
-			break;
+	size = CFG_ARENA_ROUND(size);
+	need = size + CFG_ARENA_ALIGN;
+	if (!chunk || chunk->size - chunk->used < need) {
+		size_t csize = need > CFG_ARENA_CHUNK ? need : CFG_ARENA_CHUNK;
 
-		secname = strndup(name, len);
-		if (!secname)
+		chunk = calloc(1, CFG_CHUNK_HDR + csize);
+		if (!chunk)
 			return NULL;
+		chunk->size = csize;
 
-		do {
-			char *endptr;
-
-			opt = cfg_getopt_leaf(sec, secname);
-			if (!opt || opt->type != CFGT_SEC) {
-				opt = NULL;
-				break;
-			}
-			if (name[len] != '=') {
-				/* non-multi, and backwards compat */
-				i = 0;
-				break;
-			}
-			if (!is_set(CFGF_MULTI, opt->flags))
-				break;
-			name += len + 1;
-			title = parse_title(name, &len);
-			if (!title)
-				break;
-			if (is_set(CFGF_TITLE, opt->flags)) {
-				i = cfg_opt_gettsecidx(opt, title);
-				break;
-			}
-
-			i = strtol(title, &endptr, 0);
-			if (*endptr != '\0')
-				i = -1;
-		} while(0);
-
-		if (index)
-			*index = i;
-
-		sec = i >= 0 ? cfg_opt_getnsec(opt, i) : NULL;
-		if (!sec && !is_set(CFGF_IGNORE_UNKNOWN, cfg->flags)) {
-			if (opt && !is_set(CFGF_MULTI, opt->flags))
-				cfg_error(cfg, _("no such option '%s'"), secname);
-			else if (title)
-				cfg_error(cfg, _("no sub-section '%s' in '%s'"), title, secname);
-			else
-				cfg_error(cfg, _("no sub-section title/index for '%s'"), secname);
+		/* Keep filling the current chunk after large allocations */
+		if (arena->chunks && need > CFG_ARENA_CHUNK / 4) {
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
 		}
-
-		free(secname);
-		if (title)
-			free(title);
-		if (!sec)
-			return NULL;
-
-		name += len;
-		name += strspn(name, "|");
 	}
 
-	if (!index) {
-		opt = cfg_getopt_leaf(sec, name);
-
-		if (!opt && !is_set(CFGF_IGNORE_UNKNOWN, cfg->flags) && !is_set(CFGF_KEYSTRVAL, sec->flags))
-			cfg_error(cfg, _("no such option '%s'"), name);
-	}
+	ptr = (char *)chunk + CFG_CHUNK_HDR + chunk->used;
+	*(size_t *)ptr = size;
+	chunk->used += need;
 
-	return opt;
+	return ptr + CFG_ARENA_ALIGN;
 }
 
-DLLIMPORT cfg_opt_t *cfg_getnopt(cfg_t *cfg, unsigned int index)
+static void *cfg_arena_realloc(cfg_arena_t *arena, void *ptr, size_t size)
 {
-	unsigned int i;
-
-	if (!cfg)
-		return NULL;
+	cfg_chunk_t *chunk = arena->chunks;
+	size_t *cap;
+	void *newptr;
 
-	for (i = 0; cfg->opts && cfg->opts[i].name; i++) {
-		if (i == index)
-			return &cfg->opts[i];
+	if (!ptr)
+		return cfg_arena_alloc(arena, size);
+
+	cap = (size_t *)((char *)ptr - CFG_ARENA_ALIGN);
+	if (size <= *cap)
+		return ptr;
+
+	/* Last allocation in the current chunk, extend in place */
+	if (chunk && (char *)ptr + *cap == (char *)chunk + CFG_CHUNK_HDR + chunk->used &&
+	    CFG_ARENA_ROUND(size) - *cap <= chunk->size - chunk->used) {
+		chunk->used += CFG_ARENA_ROUND(size) - *cap;
+		*cap = CFG_ARENA_ROUND(size);
+		return ptr;
 	}
 
-	return NULL;
-}
-
-DLLIMPORT cfg_opt_t *cfg_getopt(cfg_t *cfg, const char *name)
-{
-	return cfg_getopt_secidx(cfg, name, NULL);
-}
+	newptr = cfg_arena_alloc(arena, size > *cap * 2 ? size : *cap * 2);
+	if (!newptr)
+		return NULL;
+	memcpy(newptr, ptr, *cap);
 
-DLLIMPORT const char *cfg_title(cfg_t *cfg)
-{
-	if (cfg)
-		return cfg->title;
-	return NULL;
+	return newptr;
 }
 
-DLLIMPORT const char *cfg_name(cfg_t *cfg)
+/*
+ * Allocators for everything owned by a tree, backed by the arena of
+ * the tree in CFGF_ARENA mode, otherwise by the regular heap.
+ */
+static cfg_arena_t *cfg_arena(cfg_t *cfg)
 {
-	if (cfg)
-		return cfg->name;
-	return NULL;
+	return cfg && cfg->schema ? cfg->schema->arena : NULL;
 }
 
-DLLIMPORT const char *cfg_opt_name(cfg_opt_t *opt)
+static cfg_arena_t *cfg_opt_arena(cfg_opt_t *opt)
 {
-	if (opt)
-		return opt->name;
-	return NULL;
+	return cfg_arena(opt->owner);
 }
 
-DLLIMPORT const char *cfg_opt_getstr(cfg_opt_t *opt)
+/* Published sections are read by other threads, see cfg_live_new() */
+static int cfg_frozen(cfg_t *cfg)
 {
-	return cfg_opt_getnstr(opt, 0);
-}
+	if (cfg && is_set(CFGF_FROZEN, cfg->flags)) {
+		errno = EPERM;
+		return 1;
+	}
 
-DLLIMPORT unsigned int cfg_opt_size(cfg_opt_t *opt)
-{
-	if (opt)
-		return opt->nvalues;
 	return 0;
 }
 
-DLLIMPORT unsigned int cfg_size(cfg_t *cfg, const char *name)
+/* Arena for the members of cfg itself, the root is always on the heap */
+static cfg_arena_t *cfg_self_arena(cfg_t *cfg)
 {
-	return cfg_opt_size(cfg_getopt(cfg, name));
+	cfg_arena_t *arena = cfg_arena(cfg);
+
+	return arena && cfg != cfg->schema->root ? arena : NULL;
 }
 
-DLLIMPORT char *cfg_opt_getcomment(cfg_opt_t *opt)
+static void *cfg_calloc(cfg_arena_t *arena, size_t nmemb, size_t size)
 {
-	if (opt)
-		return opt->comment;
+	if (!arena)
+		return calloc(nmemb, size);
 
-	return NULL;
+	if (size && nmemb > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return cfg_arena_alloc(arena, nmemb * size);
 }
 
-DLLIMPORT char *cfg_getcomment(cfg_t *cfg, const char *name)
+static void *cfg_realloc(cfg_arena_t *arena, void *ptr, size_t size)
 {
-	return cfg_opt_getcomment(cfg_getopt(cfg, name));
+	if (!arena)
+		return realloc(ptr, size);
+
+	return cfg_arena_realloc(arena, ptr, size);
 }
 
-DLLIMPORT signed long cfg_opt_getnint(cfg_opt_t *opt, unsigned int index)
+static char *cfg_strdup(cfg_arena_t *arena, const char *str)
 {
-	if (!opt || opt->type != CFGT_INT) {
-		errno = EINVAL;
-		return 0;
-	}
+	size_t len;
+	char *dup;
 
-	if (opt->values && index < opt->nvalues)
-		return opt->values[index]->number;
-	if (opt->simple_value.number)
-		return *opt->simple_value.number;
+	if (!arena)
+		return strdup(str);
 
-	return 0;
-}
+	len = strlen(str) + 1;
+	dup = cfg_arena_alloc(arena, len);
+	if (dup)
+		memcpy(dup, str, len);
 
-DLLIMPORT signed long cfg_getnint(cfg_t *cfg, const char *name, unsigned int index)
-{
-	return cfg_opt_getnint(cfg_getopt(cfg, name), index);
+	return dup;
 }
 
-DLLIMPORT signed long cfg_getint(cfg_t *cfg, const char *name)
+static void cfg_dealloc(cfg_arena_t *arena, void *ptr)
 {
-	return cfg_getnint(cfg, name, 0);
+	if (!arena)
+		free(ptr);
 }
 
-DLLIMPORT double cfg_opt_getnfloat(cfg_opt_t *opt, unsigned int index)
-{
-	if (!opt || opt->type != CFGT_FLOAT) {
-		errno = EINVAL;
-		return 0;
-	}
+/* hash index */
 
-	if (opt->values && index < opt->nvalues)
-		return opt->values[index]->fpnumber;
-	if (opt->simple_value.fpnumber)
-		return *opt->simple_value.fpnumber;
+/*
+ * Open addressing hash table mapping a name to an element index in
+ * some array, e.g. cfg->opts.  The table does not store any keys, the
+ * owner provides a callback to look up the key of an element.  Keys
+ * are always hashed case-folded, so the same index can serve both
+ * case sensitive and CFGF_NOCASE lookups.
+ */
+typedef const char *(*cfg_index_key_t)(void *ctx, unsigned int elem);
 
-	return 0;
-}
+struct cfg_index_t {
+	unsigned int size;	/**< number of slots, always a power of two */
+	unsigned int count;	/**< number of used slots */
+	unsigned int *slots;	/**< element index + 1, zero if unused */
+	cfg_arena_t *arena;
+};
 
-DLLIMPORT double cfg_getnfloat(cfg_t *cfg, const char *name, unsigned int index)
-{
-	return cfg_opt_getnfloat(cfg_getopt(cfg, name), index);
-}
+#define CFG_INDEX_MINSIZE 8
 
-DLLIMPORT double cfg_getfloat(cfg_t *cfg, const char *name)
+static unsigned int cfg_hash(const char *key, size_t len)
 {
-	return cfg_getnfloat(cfg, name, 0);
+	unsigned int h = 2166136261u;	/* FNV-1a */
+
+	while (len--)
+		h = (h ^ tolower(*(const unsigned char *)key++)) * 16777619u;
+
+	return h;
 }
 
-DLLIMPORT cfg_bool_t cfg_opt_getnbool(cfg_opt_t *opt, unsigned int index)
+/* compare NUL terminated key with a len long, not terminated, name */
+static int cfg_keyncmp(const char *key, const char *name, size_t len, int nocase)
 {
-	if (!opt || opt->type != CFGT_BOOL) {
-		errno = EINVAL;
-		return cfg_false;
-	}
+	while (len--) {
+		int c1 = *(const unsigned char *)key++;
+		int c2 = *(const unsigned char *)name++;
 
-	if (opt->values && index < opt->nvalues)
-		return opt->values[index]->boolean;
-	if (opt->simple_value.boolean)
-		return *opt->simple_value.boolean;
+		if (nocase) {
+			c1 = tolower(c1);
+			c2 = tolower(c2);
+		}
+		if (c1 != c2)
+			return c1 - c2;
+	}
 
-	return cfg_false;
+	return *key;
 }
 
-DLLIMPORT cfg_bool_t cfg_getnbool(cfg_t *cfg, const char *name, unsigned int index)
+static void cfg_index_free(cfg_index_t *idx)
 {
-	return cfg_opt_getnbool(cfg_getopt(cfg, name), index);
-}
+	if (!idx)
+		return;
 
-DLLIMPORT cfg_bool_t cfg_getbool(cfg_t *cfg, const char *name)
-{
-	return cfg_getnbool(cfg, name, 0);
+	cfg_dealloc(idx->arena, idx->slots);
+	cfg_dealloc(idx->arena, idx);
 }
 
-DLLIMPORT char *cfg_opt_getnstr(cfg_opt_t *opt, unsigned int index)
+static cfg_index_t *cfg_index_new(cfg_arena_t *arena, unsigned int nelem)
 {
-	if (!opt || opt->type != CFGT_STR) {
-		errno = EINVAL;
+	cfg_index_t *idx;
+	unsigned int size = CFG_INDEX_MINSIZE;
+
+	while (size < nelem * 2)
+		size <<= 1;
+
+	idx = cfg_calloc(arena, 1, sizeof(cfg_index_t));
+	if (!idx)
 		return NULL;
-	}
 
-	if (opt->values && index < opt->nvalues)
-		return opt->values[index]->string;
-	if (opt->simple_value.string)
-		return *opt->simple_value.string;
+	idx->slots = cfg_calloc(arena, size, sizeof(unsigned int));
+	if (!idx->slots) {
+		cfg_dealloc(arena, idx);
+		return NULL;
+	}
+	idx->size = size;
+	idx->arena = arena;
 
-	return NULL;
+	return idx;
 }
 
-DLLIMPORT char *cfg_getnstr(cfg_t *cfg, const char *name, unsigned int index)
+/*
+ * Like a linear search would, always resolve to the first element with
+ * a matching key, regardless of where it ended up in the probe chain.
+ */
+static long int cfg_index_find(cfg_index_t *idx, const char *key, size_t len, int nocase,
+			       cfg_index_key_t keyfn, void *ctx)
 {
-	return cfg_opt_getnstr(cfg_getopt(cfg, name), index);
+	unsigned int i, mask = idx->size - 1;
+	long int found = -1;
+
+	for (i = cfg_hash(key, len) & mask; idx->slots[i]; i = (i + 1) & mask) {
+		unsigned int elem = idx->slots[i] - 1;
+
+		if (found >= 0 && elem > (unsigned long)found)
+			continue;
+		if (cfg_keyncmp(keyfn(ctx, elem), key, len, nocase) == 0)
+			found = elem;
+	}
+
+	return found;
 }
 
-DLLIMPORT char *cfg_getstr(cfg_t *cfg, const char *name)
+/* insert without growing the table */
+static void cfg_index_put(cfg_index_t *idx, const char *key, unsigned int elem)
 {
-	return cfg_getnstr(cfg, name, 0);
+	unsigned int i, mask = idx->size - 1;
+
+	for (i = cfg_hash(key, strlen(key)) & mask; idx->slots[i]; i = (i + 1) & mask)
+		;
+
+	idx->slots[i] = elem + 1;
+	idx->count++;
 }
 
-DLLIMPORT void *cfg_opt_getnptr(cfg_opt_t *opt, unsigned int index)
+static int cfg_index_add(cfg_index_t *idx, const char *key, unsigned int elem,
+			 cfg_index_key_t keyfn, void *ctx)
 {
-	if (!opt || opt->type != CFGT_PTR) {
-		errno = EINVAL;
-		return NULL;
+	if ((idx->count + 1) * 2 > idx->size) {
+		unsigned int *slots = idx->slots;
+		unsigned int i, size = idx->size;
+
+		idx->slots = cfg_calloc(idx->arena, size * 2, sizeof(unsigned int));
+		if (!idx->slots) {
+			idx->slots = slots;
+			return CFG_FAIL;
+		}
+		idx->size = size * 2;
+		idx->count = 0;
+
+		for (i = 0; i < size; i++) {
+			if (slots[i])
+				cfg_index_put(idx, keyfn(ctx, slots[i] - 1), slots[i] - 1);
+		}
+		cfg_dealloc(idx->arena, slots);
 	}
 
-	if (opt->values && index < opt->nvalues)
-		return opt->values[index]->ptr;
-	if (opt->simple_value.ptr)
-		return *opt->simple_value.ptr;
+	cfg_index_put(idx, key, elem);
 
-	return NULL;
+	return CFG_SUCCESS;
 }
 
-DLLIMPORT void *cfg_getnptr(cfg_t *cfg, const char *name, unsigned int index)
+/*
+ * Remove element from the index, must be called before the element is
+ * removed from the array since keys of neighbouring elements may have
+ * to be looked up.  All elements after it are renumbered, to match
+ * the array after the tail has been moved down.
+ */
+static void cfg_index_del(cfg_index_t *idx, const char *key, unsigned int elem,
+			  cfg_index_key_t keyfn, void *ctx)
 {
-	return cfg_opt_getnptr(cfg_getopt(cfg, name), index);
-}
+	unsigned int i, j, mask = idx->size - 1;
 
-DLLIMPORT void *cfg_getptr(cfg_t *cfg, const char *name)
-{
-	return cfg_getnptr(cfg, name, 0);
+	for (i = cfg_hash(key, strlen(key)) & mask; idx->slots[i]; i = (i + 1) & mask) {
+		if (idx->slots[i] == elem + 1)
+			break;
+	}
+
+	if (idx->slots[i]) {
+		/* backward shift deletion, keeps probe chains unbroken */
+		for (j = (i + 1) & mask; idx->slots[j]; j = (j + 1) & mask) {
+			const char *k2 = keyfn(ctx, idx->slots[j] - 1);
+			unsigned int k = cfg_hash(k2, strlen(k2)) & mask;
+
+			if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+				idx->slots[i] = idx->slots[j];
+				i = j;
+			}
+		}
+		idx->slots[i] = 0;
+		idx->count--;
+	}
+
+	for (i = 0; i < idx->size; i++) {
+		if (idx->slots[i] > elem + 1)
+			idx->slots[i]--;
+	}
 }
 
-DLLIMPORT cfg_t *cfg_opt_getnsec(cfg_opt_t *opt, unsigned int index)
+/* Find the slot holding element elem, to renumber it in place */
+static unsigned int *cfg_index_slot(cfg_index_t *idx, const char *key, unsigned int elem)
 {
-	if (!opt || opt->type != CFGT_SEC) {
-		errno = EINVAL;
-		return NULL;
-	}
+	unsigned int i, mask = idx->size - 1;
 
-	if (opt->values && index < opt->nvalues)
-		return opt->values[index]->section;
+	for (i = cfg_hash(key, strlen(key)) & mask; idx->slots[i]; i = (i + 1) & mask) {
+		if (idx->slots[i] == elem + 1)
+			return &idx->slots[i];
+	}
 
-	errno = ENOENT;
 	return NULL;
 }
 
-DLLIMPORT cfg_t *cfg_getnsec(cfg_t *cfg, const char *name, unsigned int index)
+static const char *cfg_opt_key(void *ctx, unsigned int elem)
 {
-	return cfg_opt_getnsec(cfg_getopt(cfg, name), index);
+	return ((cfg_t *)ctx)->opts[elem].name;
 }
 
-DLLIMPORT cfg_t *cfg_opt_gettsec(cfg_opt_t *opt, const char *title)
+/*
+ * Check all options of the schema for duplicate names, once at
+ * cfg_init() rather than for every section instance.
+ */
+static void cfg_check_dupopts(cfg_t *cfg, cfg_opt_t *opts)
 {
-	long int i;
+	unsigned int i, j, n = cfg_numopts(opts);
+	cfg_index_t *idx;
 
-	if (!opt || !title) {
-		errno = EINVAL;
-		return NULL;
-	}
+	idx = cfg_index_new(NULL, n);
+	for (i = 0; i < n; i++) {
+		if (opts[i].subopts)
+			cfg_check_dupopts(cfg, opts[i].subopts);
+		if (!idx)
+			continue;
 
-	if (!is_set(CFGF_TITLE, opt->flags)) {
-		errno = EINVAL;
-		return NULL;
-	}
+		/* keys are hashed case-folded, so NOCASE duplicates collide too */
+		for (j = cfg_hash(opts[i].name, strlen(opts[i].name)) & (idx->size - 1);
+		     idx->slots[j]; j = (j + 1) & (idx->size - 1)) {
+			cfg_opt_t *opt = &opts[idx->slots[j] - 1];
+			int nocase = is_set(CFGF_NOCASE, opts[i].flags | opt->flags);
 
-	i = cfg_opt_gettsecidx(opt, title);
-	if (i >= 0)
-		return cfg_opt_getnsec(opt, i);
+			if (cfg_keyncmp(opt->name, opts[i].name, strlen(opts[i].name), nocase))
+				continue;
 
-	errno = ENOENT;
-	return NULL;
+			/*
+			 * There are two definitions of the same option name.
+			 * What to do? It's a programming error and not an end
+			 * user input error. Lets print a message and abort...
+			 */
+			cfg_error(cfg, _("duplicate option '%s' not allowed"), opts[i].name);
+			break;
+		}
+		cfg_index_put(idx, opts[i].name, i);
+	}
+	cfg_index_free(idx);
 }
 
-DLLIMPORT cfg_t *cfg_gettsec(cfg_t *cfg, const char *name, const char *title)
+/*
+ * (Re)build the option name index of a section.  On failure the index
+ * is simply dropped, cfg_getopt_leaf() then falls back to a linear
+ * search.
+ */
+static void cfg_index_opts(cfg_t *cfg)
 {
-	return cfg_opt_gettsec(cfg_getopt(cfg, name), title);
+	unsigned int i, n;
+
+	cfg_index_free(cfg->index);
+	cfg->index = NULL;
+	n = cfg_num(cfg);
+	cfg->index = cfg_index_new(cfg_arena(cfg), n);
+	if (!cfg->index)
+		return;
+
+	for (i = 0; i < n; i++) {
+		if (cfg_index_add(cfg->index, cfg->opts[i].name, i, cfg_opt_key, cfg)) {
+			cfg_index_free(cfg->index);
+			cfg->index = NULL;
+			return;
+		}
+	}
 }
 
-DLLIMPORT cfg_t *cfg_getsec(cfg_t *cfg, const char *name)
+static cfg_opt_t *cfg_getopt_leaf(cfg_t *cfg, const char *name, size_t len)
 {
-	cfg_opt_t *opt;
-	long int index;
+	int nocase = is_set(CFGF_NOCASE, cfg->flags);
+	unsigned int i;
 
-	opt = cfg_getopt_secidx(cfg, name, &index);
-	return cfg_opt_getnsec(opt, index);
+	if (cfg->index) {
+		long int elem;
+
+		elem = cfg_index_find(cfg->index, name, len, nocase, cfg_opt_key, cfg);
+		if (elem < 0)
+			return NULL;
+
+		return &cfg->opts[elem];
+	}
+
+	for (i = 0; cfg->opts && cfg->opts[i].name; i++) {
+		if (cfg_keyncmp(cfg->opts[i].name, name, len, nocase) == 0)
+			return &cfg->opts[i];
+	}
+
+	return NULL;
 }
 
-static cfg_value_t *cfg_addval(cfg_opt_t *opt)
+/*
+ * Unescape a quoted title, \' and \\ are the only valid escapes.
+ * Returns the length of the unescaped title, or -1 on error.  If dst
+ * is given the title is copied there.
+ */
+static long int unescape_title(const char *src, char *dst, const char **end)
 {
-	void *ptr;
-
-	ptr = realloc(opt->values, (opt->nvalues + 1) * sizeof(cfg_value_t *));
-	if (!ptr)
-		return NULL;
+	long int n = 0;
 
-	opt->values = ptr;
-	opt->values[opt->nvalues] = calloc(1, sizeof(cfg_value_t));
-	if (!opt->values[opt->nvalues])
-		return NULL;
+	for (; *src && *src != '\''; src++, n++) {
+		if (*src == '\\') {
+			if (src[1] != '\'' && src[1] != '\\')
+				return -1;
+			src++;
+		}
+		if (dst)
+			dst[n] = *src;
+	}
 
-	opt->flags |= CFGF_MODIFIED;
+	if (*src != '\'')
+		return -1;
+	if (end)
+		*end = src;
 
-	return opt->values[opt->nvalues++];
+	return n;
 }
 
-static cfg_opt_t *cfg_addopt(cfg_t *cfg, char *key)
+/*
+ * Parse a section title in an option name, either everything up to
+ * the next '|', or a quoted title.  The returned title is not NUL
+ * terminated, its length is stored in *tlen and the number of
+ * characters consumed from name in *len.  It points either into name,
+ * or, for quoted titles with escapes, into buf.  Only if buf is too
+ * small is the title unescaped into *heap, which the caller must free.
+ */
+static const char *parse_title(const char *name, size_t *len, size_t *tlen,
+			       char *buf, size_t bufsz, char **heap)
 {
-	int num = cfg_num(cfg);
-	cfg_opt_t *opts;
+	const char *end;
+	long int n;
 
-	opts = reallocarray(cfg->opts, num + 2, sizeof(cfg_opt_t));
-	if (!opts)
+	if (*name != '\'') {
+		*len = *tlen = strcspn(name, "|");
+		if (!*len)
+			return NULL;
+		return name;
+	}
+
+	n = unescape_title(name + 1, NULL, &end);
+	if (n < 0)
 		return NULL;
 
-	/* Write new opt to previous CFG_END() marker */
-	cfg->opts = opts;
-	cfg->opts[num].name = strdup(key);
-	cfg->opts[num].type = CFGT_STR;
+	*len = end + 1 - name;
+	*tlen = n;
+	if ((size_t)n == *len - 2)
+		return name + 1; /* no escapes */
 
-	if (!cfg->opts[num].name) {
-		free(opts);
-		return NULL;
+	if ((size_t)n >= bufsz) {
+		*heap = malloc(n + 1);
+		if (!*heap)
+			return NULL;
+		buf = *heap;
 	}
+	unescape_title(name + 1, buf, NULL);
+	buf[n] = 0;
 
-	/* Set new CFG_END() */
-	memset(&cfg->opts[num + 1], 0, sizeof(cfg_opt_t));
-
-	return &cfg->opts[num];
+	return buf;
 }
 
-DLLIMPORT int cfg_numopts(cfg_opt_t *opts)
+/*
+ * Values are stored contiguously, the first value inline in the option
+ * itself.  Only when a second value is added are they moved to an array.
+ */
+static cfg_value_t *cfg_opt_vals(cfg_opt_t *opt)
 {
-	int n;
-
-	for (n = 0; opts && opts[n].name; n++)
-		/* do nothing */ ;
-	return n;
+	return opt->values ? opt->values : &opt->value;
 }
 
-DLLIMPORT unsigned int cfg_num(cfg_t *cfg)
+/* Number of used value slots, including those kept by cfg_reparse() */
+static unsigned int cfg_opt_nslots(cfg_opt_t *opt)
 {
-	if (!cfg)
-		return 0;
-
-	return (unsigned int)cfg_numopts(cfg->opts);
+	return opt->nold > opt->nvalues ? opt->nold : opt->nvalues;
 }
 
-static cfg_opt_t *cfg_dupopt_array(cfg_opt_t *opts)
+static const char *cfg_title_key(void *ctx, unsigned int elem)
 {
-	int i;
-	cfg_opt_t *dupopts;
-	int n = cfg_numopts(opts);
+	return cfg_opt_vals(ctx)[elem].section->title;
+}
 
-	dupopts = calloc(n + 1, sizeof(cfg_opt_t));
-	if (!dupopts)
-		return NULL;
+/*
+ * Build the title index of a CFGF_TITLE section option.  Options with
+ * untitled sections, e.g. a single non-multi section created by the
+ * defaults, are left without an index.  Previous sections kept by
+ * cfg_reparse() are indexed too, to be found for recycling.
+ */
+static void cfg_index_titles(cfg_opt_t *opt)
+{
+	unsigned int i, n = cfg_opt_nslots(opt);
 
-	memcpy(dupopts, opts, n * sizeof(cfg_opt_t));
+	cfg_index_free(opt->index);
+	opt->index = NULL;
 
 	for (i = 0; i < n; i++) {
-		/* Clear dynamic ptrs, protecting the original on failure */
-		dupopts[i].name = NULL;
-		dupopts[i].subopts = NULL;
-		dupopts[i].def.parsed = NULL;
-		dupopts[i].def.string = NULL;
-		dupopts[i].comment = NULL;
+		if (!cfg_opt_vals(opt)[i].section || !cfg_opt_vals(opt)[i].section->title)
+			return;
 	}
 
-	for (i = 0; i < n; i++) {
-		dupopts[i].name = strdup(opts[i].name);
-		if (!dupopts[i].name)
-			goto err;
+	opt->index = cfg_index_new(cfg_opt_arena(opt), n);
+	if (!opt->index)
+		return;
 
-		if (opts[i].subopts) {
-			dupopts[i].subopts = cfg_dupopt_array(opts[i].subopts);
-			if (!dupopts[i].subopts)
-				goto err;
+	for (i = 0; i < n; i++) {
+		if (cfg_index_add(opt->index, cfg_title_key(opt, i), i, cfg_title_key, opt)) {
+			cfg_index_free(opt->index);
+			opt->index = NULL;
+			return;
 		}
+	}
+}
 
-		if (opts[i].def.parsed) {
-			dupopts[i].def.parsed = strdup(opts[i].def.parsed);
-			if (!dupopts[i].def.parsed)
-				goto err;
-		}
+/*
+ * Find a section by title, in cfg_reparse() possibly one of the
+ * previous sections past opt->nvalues.
+ */
+static long int cfg_opt_findtslot(cfg_opt_t *opt, const char *title, size_t len, int nocase)
+{
+	unsigned int i, n = cfg_opt_nslots(opt);
 
-		if (opts[i].def.string) {
-			dupopts[i].def.string = strdup(opts[i].def.string);
-			if (!dupopts[i].def.string)
-				goto err;
-		}
+	if (!opt->index && n > 0 && !(opt->owner && is_set(CFGF_FROZEN, opt->owner->flags)))
+		cfg_index_titles(opt);
+	if (opt->index)
+		return cfg_index_find(opt->index, title, len, nocase, cfg_title_key, opt);
 
-		if (opts[i].comment) {
-			dupopts[i].comment = strdup(opts[i].comment);
-			if (!dupopts[i].comment)
-				goto err;
-		}
-	}
+	n = cfg_opt_size(opt);
+	if (n < opt->nold)
+		n = opt->nold;
+	for (i = 0; i < n; i++) {
+		cfg_t *sec = cfg_opt_vals(opt)[i].section;
 
-	return dupopts;
-err:
-	cfg_free_opt_array(dupopts);
-	return NULL;
-}
+		if (!sec || !sec->title)
+			return -1;
 
-DLLIMPORT int cfg_parse_boolean(const char *s)
-{
-	if (!s) {
-		errno = EINVAL;
-		return CFG_FAIL;
+		if (cfg_keyncmp(sec->title, title, len, nocase) == 0)
+			return i;
 	}
 
-	if (strcasecmp(s, "true") == 0 || strcasecmp(s, "on") == 0 || strcasecmp(s, "yes") == 0)
-		return 1;
-	if (strcasecmp(s, "false") == 0 || strcasecmp(s, "off") == 0 || strcasecmp(s, "no") == 0)
-		return 0;
-
-	return CFG_FAIL;
+	return -1;
 }
 
-static void cfg_init_defaults(cfg_t *cfg)
+static long int cfg_opt_findtsec(cfg_opt_t *opt, const char *title, size_t len, int nocase)
 {
-	int i;
-
-	for (i = 0; cfg->opts && cfg->opts[i].name; i++) {
-		int j;
+	long int i;
 
-		for (j = 0; j < i; ++j) {
-			if (is_set(CFGF_NOCASE, cfg->opts[i].flags | cfg->opts[j].flags)) {
-				if (strcasecmp(cfg->opts[i].name, cfg->opts[j].name))
-					continue;
-			} else {
-				if (strcmp(cfg->opts[i].name, cfg->opts[j].name))
-					continue;
-			}
-			/*
-			 * There are two definitions of the same option name.
-			 * What to do? It's a programming error and not an end
-			 * user input error. Lets print a message and abort...
-			 */
-			cfg_error(cfg, _("duplicate option '%s' not allowed"),
-				cfg->opts[i].name);
-			break;
-		}
+	i = cfg_opt_findtslot(opt, title, len, nocase);
+	if (i >= 0 && (unsigned long)i >= opt->nvalues)
+		return -1;
 
-		/* libConfuse doesn't handle default values for "simple" options */
-		if (cfg->opts[i].simple_value.ptr || is_set(CFGF_NODEFAULT, cfg->opts[i].flags))
-			continue;
+	return i;
+}
 
-		if (cfg->opts[i].type != CFGT_SEC) {
-			cfg->opts[i].flags |= CFGF_DEFINIT;
+static long int cfg_opt_gettsecidx(cfg_opt_t *opt, const char *title)
+{
+	return cfg_opt_findtsec(opt, title, strlen(title), is_set(CFGF_NOCASE, opt->flags));
+}
 
-			if (is_set(CFGF_LIST, cfg->opts[i].flags) || cfg->opts[i].def.parsed) {
-				int xstate, ret = 0;
-				char *buf;
-				FILE *fp;
+/* titles longer than this, with escapes, are unescaped on the heap */
+#define CFG_TITLE_BUFSIZ 256
 
-				/* If it's a list, but no default value was given,
-				 * keep the option uninitialized.
-				 */
-				buf = cfg->opts[i].def.parsed;
-				if (!buf || !buf[0])
-					continue;
+/* compiled option path */
 
-				/* setup scanning from the string specified for the
-				 * "default" value, force the correct state and option
-				 */
+struct cfg_path_step_t {
+	unsigned int opt;	/**< index of the section option */
+	unsigned int index;	/**< index of the section value */
+	unsigned int gen;	/**< generation of the section option */
+};
 
-				if (is_set(CFGF_LIST, cfg->opts[i].flags))
-					/* lists must be surrounded by {braces} */
-					xstate = 3;
-				else if (cfg->opts[i].type == CFGT_FUNC)
-					xstate = 0;
-				else
-					xstate = 2;
-
-				fp = fmemopen(buf, strlen(buf), "r");
-				if (!fp) {
-					/*
-					 * fmemopen() on older GLIBC versions do not accept zero
-					 * length buffers for some reason.  This is a workaround.
-					 */
-					if (strlen(buf) > 0)
-						ret = STATE_ERROR;
-				} else {
-					cfg_scan_fp_begin(fp);
+struct cfg_path_t {
+	cfg_t *cfg;		/**< context the path was compiled for */
+	unsigned int leaf;	/**< index of the option in the last section */
+	unsigned int nsteps;	/**< number of sub-sections to descend */
+	struct cfg_path_step_t steps[];
+};
 
-					do {
-						ret = cfg_parse_internal(cfg, 1, xstate, &cfg->opts[i]);
-						xstate = -1;
-					} while (ret == STATE_CONTINUE);
+/*
+ * If path is given, the option index and section index of each
+ * sub-section along the way, as well as that of the leaf, is recorded
+ * for later replay with cfg_path_getopt().
+ */
+static cfg_opt_t *cfg_getopt_secidx(cfg_t *cfg, const char *name,
+				    long int *index, cfg_path_t *path)
+{
+	cfg_opt_t *opt = NULL;
+	cfg_t *sec = cfg;
 
-					cfg_scan_fp_end();
-					fclose(fp);
-				}
+	if (!cfg || !cfg->name || !name || !*name) {
+		errno = EINVAL;
+		return NULL;
+	}
 
-				if (ret == STATE_ERROR) {
-					/*
-					 * If there was an error parsing the default string,
-					 * the initialization of the default value could be
-					 * inconsistent or empty. What to do? It's a
-					 * programming error and not an end user input
-					 * error. Lets print a message and abort...
-					 */
-					fprintf(stderr, "Parse error in default value '%s'"
-						" for option '%s'\n", cfg->opts[i].def.parsed, cfg->opts[i].name);
-					fprintf(stderr, "Check your initialization macros and the" " libConfuse documentation\n");
-					abort();
-				}
-			} else {
-				switch (cfg->opts[i].type) {
-				case CFGT_INT:
-					cfg_opt_setnint(&cfg->opts[i], cfg->opts[i].def.number, 0);
-					break;
+	while (name && *name) {
+		char buf[CFG_TITLE_BUFSIZ];
+		const char *title = NULL;
+		const char *secname;
+		char *heap = NULL;
+		size_t seclen, len, tlen = 0;
+		long int i = -1;
 
-				case CFGT_FLOAT:
-					cfg_opt_setnfloat(&cfg->opts[i], cfg->opts[i].def.fpnumber, 0);
-					break;
+		len = strcspn(name, "|=");
+		if (!index && name[len] == 0 /*len == strlen(name) */ )
+			/* no more subsections */
+			break;
 
-				case CFGT_BOOL:
-					cfg_opt_setnbool(&cfg->opts[i], cfg->opts[i].def.boolean, 0);
-					break;
+		if (!len)
+			break;
 
-				case CFGT_STR:
-					cfg_opt_setnstr(&cfg->opts[i], cfg->opts[i].def.string, 0);
-					break;
+		secname = name;
+		seclen = len;
 
-				case CFGT_FUNC:
-				case CFGT_PTR:
-					break;
+		do {
+			char *endptr;
 
-				default:
-					cfg_error(cfg, "internal error in cfg_init_defaults(%s)", cfg->opts[i].name);
-					break;
-				}
+			opt = cfg_getopt_leaf(sec, secname, seclen);
+			if (!opt || opt->type != CFGT_SEC) {
+				opt = NULL;
+				break;
+			}
+			if (name[len] != '=') {
+				/* non-multi, and backwards compat */
+				i = 0;
+				break;
+			}
+			if (!is_set(CFGF_MULTI, opt->flags))
+				break;
+			name += len + 1;
+			title = parse_title(name, &len, &tlen, buf, sizeof(buf), &heap);
+			if (!title)
+				break;
+			if (is_set(CFGF_TITLE, opt->flags)) {
+				i = cfg_opt_findtsec(opt, title, tlen, is_set(CFGF_NOCASE, opt->flags));
+				break;
 			}
 
-			/* The default value should only be returned if no value
-			 * is given in the configuration file, so we set the RESET
-			 * flag here. When/If cfg_setopt() is called, the value(s)
-			 * will be freed and the flag unset.
-			 */
-			cfg->opts[i].flags |= CFGF_RESET;
-			cfg->opts[i].flags &= ~CFGF_MODIFIED;
-		} else if (!is_set(CFGF_MULTI, cfg->opts[i].flags)) {
-			cfg_setopt(cfg, &cfg->opts[i], NULL);
-			cfg->opts[i].flags |= CFGF_DEFINIT;
-		}
-	}
-}
-
-DLLIMPORT cfg_value_t *cfg_setopt(cfg_t *cfg, cfg_opt_t *opt, const char *value)
-{
-	cfg_value_t *val = NULL;
-	const char *s;
-	char *endptr;
-	long int i;
-	double f;
-	void *p;
-	int b;
+			i = strtol(title, &endptr, 0);
+			if (endptr != title + tlen)
+				i = -1;
+		} while(0);
 
-	if (!cfg || !opt) {
-		errno = EINVAL;
-		return NULL;
-	}
+		if (index)
+			*index = i;
 
-	if (opt->simple_value.ptr) {
-		if (opt->type == CFGT_SEC) {
-			errno = EINVAL;
-			return NULL;
-		}
-		val = (cfg_value_t *)opt->simple_value.ptr;
-	} else {
-		if (is_set(CFGF_RESET, opt->flags)) {
-			cfg_free_value(opt);
-			opt->flags &= ~CFGF_RESET;
+		if (path && opt && i >= 0) {
+			path->steps[path->nsteps].opt = opt - sec->opts;
+			path->steps[path->nsteps].index = i;
+			path->steps[path->nsteps].gen = opt->gen;
+			path->nsteps++;
 		}
 
-		if (opt->nvalues == 0 || is_set(CFGF_MULTI, opt->flags) || is_set(CFGF_LIST, opt->flags)) {
-			val = NULL;
+		sec = i >= 0 ? cfg_opt_getnsec(opt, i) : NULL;
+		if (!sec && !is_set(CFGF_IGNORE_UNKNOWN, cfg->flags)) {
+			/* Names are not terminated in the path, copy them */
+			char *s = strndup(secname, seclen);
+			char *t = title ? strndup(title, tlen) : NULL;
+
+			if (!s || (title && !t))
+				errno = ENOMEM;
+			else if (opt && !is_set(CFGF_MULTI, opt->flags))
+				cfg_error(cfg, _("no such option '%s'"), s);
+			else if (title)
+				cfg_error(cfg, _("no sub-section '%s' in '%s'"), t, s);
+			else
+				cfg_error(cfg, _("no sub-section title/index for '%s'"), s);
+			free(t);
+			free(s);
+		}
 
-			if (opt->type == CFGT_SEC && is_set(CFGF_TITLE, opt->flags)) {
-				unsigned int i;
+		free(heap);
+		if (!sec)
+			return NULL;
 
-				/* XXX: Check if there already is a section with the same title. */
+		name += len;
+		name += strspn(name, "|");
+	}
 
-				/*
-				 * Check there are either no sections at
-				 * all, or a non-NULL section title.
-				 */
-				if (opt->nvalues != 0 && !value) {
-					errno = EINVAL;
-					return NULL;
-				}
+	if (!index) {
+		opt = cfg_getopt_leaf(sec, name, strlen(name));
 
-				for (i = 0; i < opt->nvalues && val == NULL; i++) {
-					cfg_t *sec = opt->values[i]->section;
+		if (!opt && !is_set(CFGF_IGNORE_UNKNOWN, cfg->flags) && !is_set(CFGF_KEYSTRVAL, sec->flags))
+			cfg_error(cfg, _("no such option '%s'"), name);
+		if (opt && path)
+			path->leaf = opt - sec->opts;
+	}
 
-					if (is_set(CFGF_NOCASE, cfg->flags)) {
-						if (strcasecmp(value, sec->title) == 0)
-							val = opt->values[i];
-					} else {
-						if (strcmp(value, sec->title) == 0)
-							val = opt->values[i];
-					}
-				}
+	return opt;
+}
 
-				if (val && is_set(CFGF_NO_TITLE_DUPES, opt->flags)) {
-					cfg_error(cfg, _("found duplicate title '%s'"), value);
-					return NULL;
-				}
-			}
+DLLIMPORT cfg_path_t *cfg_path_compile(cfg_t *cfg, const char *name)
+{
+	cfg_path_t *path;
+	unsigned int n = 1;
+	const char *ptr;
 
-			if (!val) {
-				val = cfg_addval(opt);
-				if (!val)
-					return NULL;
-			}
-		} else {
-			val = opt->values[0];
-		}
+	if (!cfg || !name) {
+		errno = EINVAL;
+		return NULL;
 	}
 
-	switch (opt->type) {
-	case CFGT_INT:
-		if (opt->parsecb) {
-			if ((*opt->parsecb) (cfg, opt, value, &i) != 0)
-				return NULL;
-		} else {
-			const char *str;
-			int radix = 0;
+	/*
+	 * Each sub-section step consumes either the '=' before its title or
+	 * the '|' after its name, a quoted title need not be followed by a
+	 * '|'.  Characters inside quoted titles only make this larger.
+	 */
+	for (ptr = name; *ptr; ptr++) {
+		if (*ptr == '|' || *ptr == '=')
+			n++;
+	}
 
-			if (!value) {
-				errno = EINVAL;
-				return NULL;
-			}
+	path = calloc(1, sizeof(cfg_path_t) + n * sizeof(struct cfg_path_step_t));
+	if (!path)
+		return NULL;
 
-			str = value;
-			if (value[0] == '0') {
-				switch (value[1]) {
-				case 'b':
-					radix = 2;
-					str = &value[2];
-					break;
-				case 'x':
-					radix = 16;
-					str = &value[2];
-					break;
-				default:
-					radix = 8;
-					str = &value[1];
-				}
-			}
+	if (!cfg_getopt_secidx(cfg, name, NULL, path)) {
+		free(path);
+		errno = ENOENT;
+		return NULL;
+	}
+	path->cfg = cfg;
 
-			i = strtol(str, &endptr, radix);
-			if (*endptr != '\0') {
-				cfg_error(cfg, _("invalid integer value for option '%s'"), opt->name);
-				return NULL;
-			}
+	return path;
+}
 
-			if (errno == ERANGE) {
-				cfg_error(cfg, _("integer value for option '%s' is out of range"), opt->name);
-				return NULL;
-			}
-		}
-		val->number = i;
-		break;
+DLLIMPORT cfg_opt_t *cfg_path_getopt(cfg_t *cfg, cfg_path_t *path)
+{
+	unsigned int i;
+	cfg_t *sec = cfg;
 
-	case CFGT_FLOAT:
-		if (opt->parsecb) {
-			if ((*opt->parsecb) (cfg, opt, value, &f) != 0)
-				return NULL;
-		} else {
-			if (!value) {
-				errno = EINVAL;
-				return NULL;
-			}
-			f = strtod(value, &endptr);
-			if (*endptr != '\0') {
-				cfg_error(cfg, _("invalid floating point value for option '%s'"), opt->name);
-				return NULL;
-			}
-			if (errno == ERANGE) {
-				cfg_error(cfg, _("floating point value for option '%s' is out of range"), opt->name);
-				return NULL;
-			}
-		}
-		val->fpnumber = f;
-		break;
+	if (!cfg || !path || cfg != path->cfg) {
+		errno = EINVAL;
+		return NULL;
+	}
 
-	case CFGT_STR:
-		if (opt->parsecb) {
-			s = NULL;
-			if ((*opt->parsecb) (cfg, opt, value, &s) != 0)
-				return NULL;
-		} else {
-			s = value;
-		}
+	for (i = 0; i < path->nsteps; i++) {
+		cfg_opt_t *opt = &sec->opts[path->steps[i].opt];
 
-		if (!s) {
-			errno = EINVAL;
+		if (opt->gen != path->steps[i].gen || path->steps[i].index >= opt->nvalues) {
+			errno = ESTALE;
 			return NULL;
 		}
+		sec = cfg_opt_vals(opt)[path->steps[i].index].section;
+	}
 
-		free(val->string);
-		val->string = strdup(s);
-		if (!val->string)
-			return NULL;
-		break;
-
-	case CFGT_SEC:
-		if (is_set(CFGF_MULTI, opt->flags) || val->section == NULL) {
-			if (val->section) {
-				val->section->path = NULL; /* Global search path */
-				cfg_free(val->section);
-			}
-			val->section = calloc(1, sizeof(cfg_t));
-			if (!val->section)
-				return NULL;
-
-			val->section->name = strdup(opt->name);
-			if (!val->section->name) {
-				free(val->section);
-				return NULL;
-			}
-
-			val->section->flags = cfg->flags;
-			if (is_set(CFGF_KEYSTRVAL, opt->flags))
-				val->section->flags |= CFGF_KEYSTRVAL;
+	return &sec->opts[path->leaf];
+}
 
-			val->section->filename = cfg->filename ? strdup(cfg->filename) : NULL;
-			if (cfg->filename && !val->section->filename) {
-				free(val->section->name);
-				free(val->section);
-				return NULL;
-			}
+DLLIMPORT void cfg_path_free(cfg_path_t *path)
+{
+	free(path);
+}
 
-			val->section->line = cfg->line;
-			val->section->errfunc = cfg->errfunc;
-			val->section->title = value ? strdup(value) : NULL;
-			if (value && !val->section->title) {
-				free(val->section->filename);
-				free(val->section->name);
-				free(val->section);
-				return NULL;
-			}
+DLLIMPORT cfg_opt_t *cfg_getnopt(cfg_t *cfg, unsigned int index)
+{
+	if (!cfg)
+		return NULL;
 
-			val->section->opts = cfg_dupopt_array(opt->subopts);
-			if (!val->section->opts) {
-				if (val->section->title)
-					free(val->section->title);
-				if (val->section->filename)
-					free(val->section->filename);
-				free(val->section->name);
-				free(val->section);
-				return NULL;
-			}
-		}
-		if (!is_set(CFGF_DEFINIT, opt->flags))
-			cfg_init_defaults(val->section);
-		break;
+	if (index < cfg_num(cfg))
+		return &cfg->opts[index];
 
-	case CFGT_BOOL:
-		if (opt->parsecb) {
-			if ((*opt->parsecb) (cfg, opt, value, &b) != 0)
-				return NULL;
-		} else {
-			b = cfg_parse_boolean(value);
-			if (b == -1) {
-				cfg_error(cfg, _("invalid boolean value for option '%s'"), opt->name);
-				return NULL;
-			}
-		}
-		val->boolean = (cfg_bool_t)b;
-		break;
+	return NULL;
+}
 
-	case CFGT_PTR:
-		if (!opt->parsecb) {
-			errno = EINVAL;
-			return NULL;
-		}
+/*
+ * Create a single section left out by cfg_init_defaults() in CFGF_LAZY
+ * mode.  Sections created from it, e.g. in the parser, are marked the
+ * same way by cfg_setopt().
+ */
+static void cfg_opt_lazyinit(cfg_opt_t *opt)
+{
+	if (!opt || opt->type != CFGT_SEC || !opt->owner || !is_set(CFGF_LAZY, opt->owner->flags))
+		return;
+	if (opt->flags & (CFGF_MULTI | CFGF_NODEFAULT | CFGF_DEFINIT))
+		return;
 
-		if ((*opt->parsecb) (cfg, opt, value, &p) != 0)
-			return NULL;
-		if (val->ptr && opt->freecb)
-			opt->freecb(val->ptr);
-		val->ptr = p;
-		break;
+	cfg_setopt(opt->owner, opt, NULL);
+}
 
-	default:
-		cfg_error(cfg, "internal error in cfg_setopt(%s, %s)", opt->name, (value) ? (value) : "NULL");
-		return NULL;
-	}
+DLLIMPORT cfg_opt_t *cfg_getopt(cfg_t *cfg, const char *name)
+{
+	cfg_opt_t *opt;
 
-	opt->flags |= CFGF_MODIFIED;
+	opt = cfg_getopt_secidx(cfg, name, NULL, NULL);
+	cfg_opt_lazyinit(opt);
 
-	return val;
+	return opt;
 }
 
-DLLIMPORT int cfg_opt_setmulti(cfg_t *cfg, cfg_opt_t *opt, unsigned int nvalues, char **values)
+DLLIMPORT const char *cfg_title(cfg_t *cfg)
 {
-	cfg_opt_t old;
-	unsigned int i;
+	if (cfg)
+		return cfg->title;
+	return NULL;
+}
 
-	if (!opt || !nvalues) {
-		errno = EINVAL;
-		return CFG_FAIL;
-	}
+DLLIMPORT const char *cfg_name(cfg_t *cfg)
+{
+	if (cfg)
+		return cfg->name;
+	return NULL;
+}
 
-	old = *opt;
-	opt->nvalues = 0;
-	opt->values = NULL;
+DLLIMPORT const char *cfg_opt_name(cfg_opt_t *opt)
+{
+	if (opt)
+		return opt->name;
+	return NULL;
+}
 
-	for (i = 0; i < nvalues; i++) {
-		if (cfg_setopt(cfg, opt, values[i]))
-			continue;
+DLLIMPORT const char *cfg_opt_getstr(cfg_opt_t *opt)
+{
+	return cfg_opt_getnstr(opt, 0);
+}
 
-		/* ouch, revert */
-		cfg_free_value(opt);
-		opt->nvalues = old.nvalues;
-		opt->values = old.values;
-		opt->flags &= ~(CFGF_RESET | CFGF_MODIFIED);
-		opt->flags |= old.flags & (CFGF_RESET | CFGF_MODIFIED);
+DLLIMPORT unsigned int cfg_opt_size(cfg_opt_t *opt)
+{
+	cfg_opt_lazyinit(opt);
+	if (opt)
+		return opt->nvalues;
+	return 0;
+}
 
-		return CFG_FAIL;
-	}
+DLLIMPORT unsigned int cfg_size(cfg_t *cfg, const char *name)
+{
+	return cfg_opt_size(cfg_getopt(cfg, name));
+}
 
-	cfg_free_value(&old);
-	opt->flags |= CFGF_MODIFIED;
+DLLIMPORT char *cfg_opt_getcomment(cfg_opt_t *opt)
+{
+	if (opt)
+		return opt->comment;
 
-	return CFG_SUCCESS;
+	return NULL;
 }
 
-DLLIMPORT int cfg_setmulti(cfg_t *cfg, const char *name, unsigned int nvalues, char **values)
+DLLIMPORT char *cfg_getcomment(cfg_t *cfg, const char *name)
 {
-	cfg_opt_t *opt;
+	return cfg_opt_getcomment(cfg_getopt(cfg, name));
+}
 
-	if (!cfg || !name || !values) {
+DLLIMPORT signed long cfg_opt_getnint(cfg_opt_t *opt, unsigned int index)
+{
+	if (!opt || opt->type != CFGT_INT) {
 		errno = EINVAL;
-		return CFG_FAIL;
+		return 0;
 	}
 
-	opt = cfg_getopt(cfg, name);
-	if (!opt) {
-		errno = ENOENT;
-		return CFG_FAIL;
-	}
+	if (index < opt->nvalues)
+		return cfg_opt_vals(opt)[index].number;
+	if (opt->simple_value.number)
+		return *opt->simple_value.number;
 
-	return cfg_opt_setmulti(cfg, opt, nvalues, values);
+	return 0;
 }
 
-/* searchpath */
-
-struct cfg_searchpath_t {
-	char *dir;	        /**< directory to search */
-	cfg_searchpath_t *next; /**< next in list */
-};
-
-/* prepend a new cfg_searchpath_t to the linked list */
+DLLIMPORT signed long cfg_getnint(cfg_t *cfg, const char *name, unsigned int index)
+{
+	return cfg_opt_getnint(cfg_getopt(cfg, name), index);
+}
 
-DLLIMPORT int cfg_add_searchpath(cfg_t *cfg, const char *dir)
+DLLIMPORT signed long cfg_getint(cfg_t *cfg, const char *name)
 {
-	cfg_searchpath_t *p;
-	char *d;
+	return cfg_getnint(cfg, name, 0);
+}
 
-	if (!cfg || !dir) {
+DLLIMPORT double cfg_opt_getnfloat(cfg_opt_t *opt, unsigned int index)
+{
+	if (!opt || opt->type != CFGT_FLOAT) {
 		errno = EINVAL;
-		return CFG_FAIL;
+		return 0;
 	}
 
-	d = cfg_tilde_expand(dir);
-	if (!d)
-		return CFG_FAIL;
-
-	p = malloc(sizeof(cfg_searchpath_t));
-	if (!p) {
-		free(d);
-		return CFG_FAIL;
-	}
+	if (index < opt->nvalues)
+		return cfg_opt_vals(opt)[index].fpnumber;
+	if (opt->simple_value.fpnumber)
+		return *opt->simple_value.fpnumber;
 
-	p->next   = cfg->path;
-	p->dir    = d;
-	cfg->path = p;
+	return 0;
+}
 
-	return CFG_SUCCESS;
+DLLIMPORT double cfg_getnfloat(cfg_t *cfg, const char *name, unsigned int index)
+{
+	return cfg_opt_getnfloat(cfg_getopt(cfg, name), index);
 }
 
-DLLIMPORT cfg_errfunc_t cfg_set_error_function(cfg_t *cfg, cfg_errfunc_t errfunc)
+DLLIMPORT double cfg_getfloat(cfg_t *cfg, const char *name)
 {
-	cfg_errfunc_t old;
+	return cfg_getnfloat(cfg, name, 0);
+}
 
-	if (!cfg) {
+DLLIMPORT cfg_bool_t cfg_opt_getnbool(cfg_opt_t *opt, unsigned int index)
+{
+	if (!opt || opt->type != CFGT_BOOL) {
 		errno = EINVAL;
-		return NULL;
+		return cfg_false;
 	}
 
-	old = cfg->errfunc;
-	cfg->errfunc = errfunc;
+	if (index < opt->nvalues)
+		return cfg_opt_vals(opt)[index].boolean;
+	if (opt->simple_value.boolean)
+		return *opt->simple_value.boolean;
 
-	return old;
+	return cfg_false;
 }
 
-DLLIMPORT cfg_print_filter_func_t cfg_set_print_filter_func(cfg_t *cfg, cfg_print_filter_func_t pff)
+DLLIMPORT cfg_bool_t cfg_getnbool(cfg_t *cfg, const char *name, unsigned int index)
 {
-	cfg_print_filter_func_t old;
+	return cfg_opt_getnbool(cfg_getopt(cfg, name), index);
+}
 
-	if (!cfg) {
+DLLIMPORT cfg_bool_t cfg_getbool(cfg_t *cfg, const char *name)
+{
+	return cfg_getnbool(cfg, name, 0);
+}
+
+DLLIMPORT char *cfg_opt_getnstr(cfg_opt_t *opt, unsigned int index)
+{
+	if (!opt || opt->type != CFGT_STR) {
 		errno = EINVAL;
 		return NULL;
 	}
 
-	old = cfg->pff;
-	cfg->pff = pff;
+	if (index < opt->nvalues)
+		return cfg_opt_vals(opt)[index].string;
+	if (opt->simple_value.string)
+		return *opt->simple_value.string;
 
-	return old;
+	return NULL;
 }
 
-DLLIMPORT void cfg_error(cfg_t *cfg, const char *fmt, ...)
+DLLIMPORT char *cfg_getnstr(cfg_t *cfg, const char *name, unsigned int index)
 {
-	va_list ap;
+	return cfg_opt_getnstr(cfg_getopt(cfg, name), index);
+}
 
-	va_start(ap, fmt);
+DLLIMPORT char *cfg_getstr(cfg_t *cfg, const char *name)
+{
+	return cfg_getnstr(cfg, name, 0);
+}
 
-	if (cfg && cfg->errfunc)
-		(*cfg->errfunc) (cfg, fmt, ap);
-	else {
-		if (cfg && cfg->filename && cfg->line)
-			fprintf(stderr, "%s:%d: ", cfg->filename, cfg->line);
-		else if (cfg && cfg->filename)
-			fprintf(stderr, "%s: ", cfg->filename);
-		vfprintf(stderr, fmt, ap);
-		fprintf(stderr, "\n");
+/*
+ * Number of values to copy for the bulk getters, or -1 if opt is not
+ * of the given type.
+ */
+static int cfg_opt_getvals_check(cfg_opt_t *opt, cfg_type_t type, unsigned int *nvalues)
+{
+	if (!opt || opt->type != type) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	va_end(ap);
+	if (*nvalues > opt->nvalues)
+		*nvalues = opt->nvalues;
+
+	return 0;
 }
 
-static int call_function(cfg_t *cfg, cfg_opt_t *opt, cfg_opt_t *funcopt)
+DLLIMPORT unsigned int cfg_opt_getints(cfg_opt_t *opt, long int *values, unsigned int nvalues)
 {
-	int ret;
-	const char **argv;
+	cfg_value_t *vals;
 	unsigned int i;
 
-	if (!cfg || !opt ||!funcopt) {
-		errno = EINVAL;
-		return CFG_FAIL;
-	}
+	if (cfg_opt_getvals_check(opt, CFGT_INT, &nvalues))
+		return 0;
 
-	/*
-	 * create am argv string vector and call the registered function
-	 */
-	argv = calloc(funcopt->nvalues, sizeof(char *));
-	if (!argv)
-		return CFG_FAIL;
+	vals = cfg_opt_vals(opt);
+	for (i = 0; i < nvalues; i++)
+		values[i] = vals[i].number;
 
-	for (i = 0; i < funcopt->nvalues; i++)
-		argv[i] = funcopt->values[i]->string;
+	return opt->nvalues;
+}
 
-	ret = (*opt->func) (cfg, opt, funcopt->nvalues, argv);
-	cfg_free_value(funcopt);
-	free(argv);
+DLLIMPORT unsigned int cfg_getints(cfg_t *cfg, const char *name, long int *values, unsigned int nvalues)
+{
+	return cfg_opt_getints(cfg_getopt(cfg, name), values, nvalues);
+}
 
-	return ret;
+DLLIMPORT unsigned int cfg_opt_getfloats(cfg_opt_t *opt, double *values, unsigned int nvalues)
+{
+	cfg_value_t *vals;
+	unsigned int i;
+
+	if (cfg_opt_getvals_check(opt, CFGT_FLOAT, &nvalues))
+		return 0;
+
+	vals = cfg_opt_vals(opt);
+	for (i = 0; i < nvalues; i++)
+		values[i] = vals[i].fpnumber;
+
+	return opt->nvalues;
 }
 
-static void cfg_handle_deprecated(cfg_t *cfg, cfg_opt_t *opt)
+DLLIMPORT unsigned int cfg_getfloats(cfg_t *cfg, const char *name, double *values, unsigned int nvalues)
 {
-	if (is_set(CFGF_DROP, opt->flags)) {
-		cfg_error(cfg, _("dropping deprecated configuration option '%s'"), opt->name);
-		cfg_free_value(opt);
-	} else {
-		cfg_error(cfg, _("found deprecated option '%s', please update configuration file."), opt->name);
-	}
+	return cfg_opt_getfloats(cfg_getopt(cfg, name), values, nvalues);
 }
 
-static int cfg_parse_internal(cfg_t *cfg, int level, int force_state, cfg_opt_t *force_opt)
+DLLIMPORT unsigned int cfg_opt_getbools(cfg_opt_t *opt, cfg_bool_t *values, unsigned int nvalues)
 {
-	int state = 0;
-	char *comment = NULL;
-	char *opttitle = NULL;
-	cfg_opt_t *opt = NULL;
-	cfg_value_t *val = NULL;
-	cfg_opt_t funcopt = CFG_STR(NULL, NULL, 0);
+	cfg_value_t *vals;
+	unsigned int i;
 
-	int ignore = 0;		/* ignore until this token, traverse parser w/o error */
-	int num_values = 0;	/* number of values found for a list option */
-	int rc;
+	if (cfg_opt_getvals_check(opt, CFGT_BOOL, &nvalues))
+		return 0;
 
-	if (force_state != -1)
-		state = force_state;
-	if (force_opt)
-		opt = force_opt;
+	vals = cfg_opt_vals(opt);
+	for (i = 0; i < nvalues; i++)
+		values[i] = vals[i].boolean;
 
-	while (1) {
-		int tok = cfg_yylex(cfg);
+	return opt->nvalues;
+}
 
-		if (tok == 0) {
-			/* lexer.l should have called cfg_error() */
-			goto error;
-		}
+DLLIMPORT unsigned int cfg_getbools(cfg_t *cfg, const char *name, cfg_bool_t *values, unsigned int nvalues)
+{
+	return cfg_opt_getbools(cfg_getopt(cfg, name), values, nvalues);
+}
 
-		if (tok == EOF) {
-			if (state != 0) {
-				cfg_error(cfg, _("premature end of file"));
-				goto error;
-			}
+DLLIMPORT unsigned int cfg_opt_getstrs(cfg_opt_t *opt, char **values, unsigned int nvalues)
+{
+	cfg_value_t *vals;
+	unsigned int i;
 
-			if (opt && is_set(CFGF_DEPRECATED, opt->flags))
-				cfg_handle_deprecated(cfg, opt);
+	if (cfg_opt_getvals_check(opt, CFGT_STR, &nvalues))
+		return 0;
 
-			if (comment)
-				free(comment);
+	vals = cfg_opt_vals(opt);
+	for (i = 0; i < nvalues; i++)
+		values[i] = vals[i].string;
 
-			return STATE_EOF;
-		}
+	return opt->nvalues;
+}
+
+DLLIMPORT unsigned int cfg_getstrs(cfg_t *cfg, const char *name, char **values, unsigned int nvalues)
+{
+	return cfg_opt_getstrs(cfg_getopt(cfg, name), values, nvalues);
+}
+
+DLLIMPORT void *cfg_opt_getnptr(cfg_opt_t *opt, unsigned int index)
+{
+	if (!opt || opt->type != CFGT_PTR) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (index < opt->nvalues)
+		return cfg_opt_vals(opt)[index].ptr;
+	if (opt->simple_value.ptr)
+		return *opt->simple_value.ptr;
+
+	return NULL;
+}
+
+DLLIMPORT void *cfg_getnptr(cfg_t *cfg, const char *name, unsigned int index)
+{
+	return cfg_opt_getnptr(cfg_getopt(cfg, name), index);
+}
+
+DLLIMPORT void *cfg_getptr(cfg_t *cfg, const char *name)
+{
+	return cfg_getnptr(cfg, name, 0);
+}
+
+DLLIMPORT cfg_t *cfg_opt_getnsec(cfg_opt_t *opt, unsigned int index)
+{
+	if (!opt || opt->type != CFGT_SEC) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	cfg_opt_lazyinit(opt);
+	if (index < opt->nvalues)
+		return cfg_opt_vals(opt)[index].section;
+
+	errno = ENOENT;
+	return NULL;
+}
+
+DLLIMPORT cfg_t *cfg_getnsec(cfg_t *cfg, const char *name, unsigned int index)
+{
+	return cfg_opt_getnsec(cfg_getopt(cfg, name), index);
+}
+
+/* iterators */
+
+DLLIMPORT cfg_opt_t *cfg_firstopt(cfg_t *cfg)
+{
+	if (!cfg || !cfg->opts || !cfg->opts[0].name)
+		return NULL;
+
+	return cfg->opts;
+}
+
+DLLIMPORT cfg_opt_t *cfg_nextopt(cfg_opt_t *opt)
+{
+	/* Options are kept in an array ending with CFG_END() */
+	if (!opt || !opt[1].name)
+		return NULL;
+
+	return &opt[1];
+}
+
+DLLIMPORT cfg_t *cfg_opt_nextsec(cfg_opt_t *opt, unsigned int *index)
+{
+	if (!opt || opt->type != CFGT_SEC || !index) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	cfg_opt_lazyinit(opt);
+	if (*index >= opt->nvalues)
+		return NULL;
+
+	return cfg_opt_vals(opt)[(*index)++].section;
+}
+
+static int cfg_walk_sec(cfg_t *cfg, cfg_walk_func_t func, unsigned int depth, void *arg)
+{
+	cfg_opt_t *opt;
+	int ret;
+
+	for (opt = cfg_firstopt(cfg); opt; opt = cfg_nextopt(opt)) {
+		unsigned int i = 0;
+		cfg_t *sec;
+
+		ret = (*func)(cfg, opt, depth, arg);
+		if (ret)
+			return ret;
+		if (opt->type != CFGT_SEC)
+			continue;
+
+		while ((sec = cfg_opt_nextsec(opt, &i)) != NULL) {
+			ret = cfg_walk_sec(sec, func, depth + 1, arg);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+DLLIMPORT int cfg_walk(cfg_t *cfg, cfg_walk_func_t func, void *arg)
+{
+	if (!cfg || !func) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	return cfg_walk_sec(cfg, func, 0, arg);
+}
+
+DLLIMPORT cfg_t *cfg_opt_gettsec(cfg_opt_t *opt, const char *title)
+{
+	long int i;
+
+	if (!opt || !title) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (!is_set(CFGF_TITLE, opt->flags)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	i = cfg_opt_gettsecidx(opt, title);
+	if (i >= 0)
+		return cfg_opt_getnsec(opt, i);
+
+	errno = ENOENT;
+	return NULL;
+}
+
+DLLIMPORT cfg_t *cfg_gettsec(cfg_t *cfg, const char *name, const char *title)
+{
+	return cfg_opt_gettsec(cfg_getopt(cfg, name), title);
+}
+
+DLLIMPORT cfg_t *cfg_getsec(cfg_t *cfg, const char *name)
+{
+	cfg_opt_t *opt;
+	long int index;
+
+	opt = cfg_getopt_secidx(cfg, name, &index, NULL);
+	return cfg_opt_getnsec(opt, index);
+}
+
+/* Resize the value array, moving an inline value into it */
+static int cfg_opt_resize(cfg_opt_t *opt, unsigned int nalloc)
+{
+	cfg_value_t *ptr;
+
+	if (nalloc > UINT_MAX / sizeof(cfg_value_t)) {
+		errno = ENOMEM;
+		return CFG_FAIL;
+	}
+
+	ptr = cfg_realloc(cfg_opt_arena(opt), opt->values, nalloc * sizeof(cfg_value_t));
+	if (!ptr)
+		return CFG_FAIL;
+
+	if (!opt->values && cfg_opt_nslots(opt))
+		ptr[0] = opt->value;
+	opt->values = ptr;
+	opt->nalloc = nalloc;
+
+	return CFG_SUCCESS;
+}
+
+static cfg_value_t *cfg_addval(cfg_opt_t *opt)
+{
+	/* Previous value kept by cfg_reparse(), recycled as is */
+	if (opt->nvalues < opt->nold) {
+		opt->flags |= CFGF_MODIFIED;
+		return &cfg_opt_vals(opt)[opt->nvalues++];
+	}
+
+	if (!opt->values && opt->nvalues == 0) {
+		memset(&opt->value, 0, sizeof(opt->value));
+		opt->flags |= CFGF_MODIFIED;
+		opt->nvalues = 1;
+
+		return &opt->value;
+	}
+
+	if (opt->nvalues >= opt->nalloc) {
+		unsigned int nalloc = opt->nalloc ? opt->nalloc * 2 : 4;
+
+		if (nalloc <= opt->nalloc || cfg_opt_resize(opt, nalloc))
+			return NULL;
+	}
+	memset(&opt->values[opt->nvalues], 0, sizeof(cfg_value_t));
+
+	opt->flags |= CFGF_MODIFIED;
+
+	return &opt->values[opt->nvalues++];
+}
+
+/*
+ * Recycle a previous section kept by cfg_reparse(), in slot elem, as
+ * the next section of the option.  It is swapped with whatever is in
+ * that slot, updating the title index.
+ */
+static cfg_value_t *cfg_opt_recycle(cfg_t *cfg, cfg_opt_t *opt, unsigned int elem, const char *title)
+{
+	cfg_value_t *vals = cfg_opt_vals(opt);
+	unsigned int n = opt->nvalues;
+	cfg_arena_t *arena;
+	cfg_value_t tmp;
+	cfg_t *sec;
+
+	if (elem != n) {
+		if (opt->index) {
+			unsigned int *a = cfg_index_slot(opt->index, cfg_title_key(opt, n), n);
+			unsigned int *b = cfg_index_slot(opt->index, cfg_title_key(opt, elem), elem);
+
+			if (a)
+				*a = elem + 1;
+			if (b)
+				*b = n + 1;
+		}
+		tmp = vals[n];
+		vals[n] = vals[elem];
+		vals[elem] = tmp;
+	}
+	opt->nvalues++;
+	opt->flags |= CFGF_MODIFIED;
+
+	/* Title may differ in case, file name if moved to an include */
+	sec = vals[n].section;
+	arena = cfg_arena(cfg);
+	if (title && strcmp(sec->title, title)) {
+		char *dup = cfg_strdup(arena, title);
+
+		if (!dup)
+			return NULL;
+		cfg_dealloc(arena, sec->title);
+		sec->title = dup;
+	}
+	if (cfg->filename && (!sec->filename || strcmp(sec->filename, cfg->filename))) {
+		char *dup = cfg_strdup(arena, cfg->filename);
+
+		if (!dup)
+			return NULL;
+		cfg_dealloc(arena, sec->filename);
+		sec->filename = dup;
+	}
+
+	return &vals[n];
+}
+
+/*
+ * Move the previous section in the next slot out of the way, to the
+ * end of the ones kept by cfg_reparse(), making room for a new one.
+ */
+static int cfg_opt_evict(cfg_opt_t *opt)
+{
+	unsigned int n = opt->nvalues;
+	cfg_value_t *vals;
+
+	if (opt->nold >= (opt->values ? opt->nalloc : 1)) {
+		unsigned int nalloc = opt->nalloc ? opt->nalloc * 2 : 4;
+
+		if (nalloc <= opt->nalloc || cfg_opt_resize(opt, nalloc))
+			return CFG_FAIL;
+	}
+
+	vals = cfg_opt_vals(opt);
+	if (opt->index) {
+		unsigned int *a = cfg_index_slot(opt->index, cfg_title_key(opt, n), n);
+
+		if (a)
+			*a = opt->nold + 1;
+	}
+	vals[opt->nold++] = vals[n];
+	memset(&vals[n], 0, sizeof(cfg_value_t));
+
+	return CFG_SUCCESS;
+}
+
+static cfg_opt_t *cfg_addopt(cfg_t *cfg, char *key)
+{
+	int num = cfg_num(cfg);
+	cfg_opt_t *opts;
+
+	opts = cfg_realloc(cfg_arena(cfg), cfg->opts, (num + 2) * sizeof(cfg_opt_t));
+	if (!opts)
+		return NULL;
+
+	/* Write new opt to previous CFG_END() marker */
+	cfg->opts = opts;
+	cfg->opts[num].name = cfg_strdup(cfg_arena(cfg), key);
+	cfg->opts[num].type = CFGT_STR;
+	cfg->opts[num].flags = CFGF_DYNAMIC;
+	cfg->opts[num].owner = cfg;
+
+	if (!cfg->opts[num].name) {
+		/* Keep the grown array, restore the CFG_END() marker */
+		memset(&cfg->opts[num], 0, sizeof(cfg_opt_t));
+		return NULL;
+	}
+
+	/* Set new CFG_END() */
+	memset(&cfg->opts[num + 1], 0, sizeof(cfg_opt_t));
+
+	if (cfg->index && cfg_index_add(cfg->index, cfg->opts[num].name, num, cfg_opt_key, cfg)) {
+		cfg_index_free(cfg->index);
+		cfg->index = NULL;
+	}
+
+	return &cfg->opts[num];
+}
+
+DLLIMPORT int cfg_numopts(cfg_opt_t *opts)
+{
+	int n;
+
+	for (n = 0; opts && opts[n].name; n++)
+		/* do nothing */ ;
+	return n;
+}
+
+DLLIMPORT unsigned int cfg_num(cfg_t *cfg)
+{
+	if (!cfg)
+		return 0;
+
+	/* The name index holds every option of the section */
+	if (cfg->index)
+		return cfg->index->count;
+
+	return (unsigned int)cfg_numopts(cfg->opts);
+}
+
+static cfg_opt_t *cfg_dupopt_array(cfg_opt_t *opts)
+{
+	int i;
+	cfg_opt_t *dupopts;
+	int n = cfg_numopts(opts);
+
+	dupopts = calloc(n + 1, sizeof(cfg_opt_t));
+	if (!dupopts)
+		return NULL;
+
+	memcpy(dupopts, opts, n * sizeof(cfg_opt_t));
+
+	for (i = 0; i < n; i++) {
+		/* Clear dynamic ptrs, protecting the original on failure */
+		dupopts[i].name = NULL;
+		dupopts[i].subopts = NULL;
+		dupopts[i].def.parsed = NULL;
+		dupopts[i].def.string = NULL;
+		dupopts[i].comment = NULL;
+		dupopts[i].index = NULL;
+		dupopts[i].owner = NULL;
+		dupopts[i].values = NULL;
+		dupopts[i].nvalues = 0;
+		dupopts[i].nalloc = 0;
+		dupopts[i].nold = 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		dupopts[i].name = strdup(opts[i].name);
+		if (!dupopts[i].name)
+			goto err;
+
+		if (opts[i].subopts) {
+			dupopts[i].subopts = cfg_dupopt_array(opts[i].subopts);
+			if (!dupopts[i].subopts)
+				goto err;
+		}
+
+		if (opts[i].def.parsed) {
+			dupopts[i].def.parsed = strdup(opts[i].def.parsed);
+			if (!dupopts[i].def.parsed)
+				goto err;
+		}
+
+		if (opts[i].def.string) {
+			dupopts[i].def.string = strdup(opts[i].def.string);
+			if (!dupopts[i].def.string)
+				goto err;
+		}
+
+		if (opts[i].comment) {
+			dupopts[i].comment = strdup(opts[i].comment);
+			if (!dupopts[i].comment)
+				goto err;
+		}
+	}
+
+	return dupopts;
+err:
+	cfg_free_opt_array(dupopts);
+	return NULL;
+}
+
+static int cfg_has_freecb(cfg_opt_t *opts)
+{
+	int i;
+
+	for (i = 0; opts && opts[i].name; i++) {
+		if (opts[i].freecb || cfg_has_freecb(opts[i].subopts))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * The schema is a private deep copy of the options given to cfg_init(),
+ * shared by the root and all its sections.  Each cfg_t holds a ref,
+ * except sections in CFGF_ARENA mode, which live in the arena.
+ */
+static cfg_schema_t *cfg_schema_new(cfg_opt_t *opts, cfg_flag_t flags)
+{
+	cfg_schema_t *schema;
+
+	schema = calloc(1, sizeof(cfg_schema_t));
+	if (!schema)
+		return NULL;
+
+	schema->opts = cfg_dupopt_array(opts);
+	if (!schema->opts) {
+		free(schema);
+		return NULL;
+	}
+
+	if (is_set(CFGF_ARENA, flags)) {
+		schema->arena = calloc(1, sizeof(cfg_arena_t));
+		if (!schema->arena) {
+			cfg_free_opt_array(schema->opts);
+			free(schema);
+			return NULL;
+		}
+	}
+	schema->freecb = cfg_has_freecb(schema->opts);
+	schema->refcount = 1;
+
+	return schema;
+}
+
+static cfg_schema_t *cfg_schema_get(cfg_schema_t *schema)
+{
+	if (schema)
+		schema->refcount++;
+
+	return schema;
+}
+
+static void cfg_image_free(cfg_image_t *image)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (image->mapped) {
+		munmap(image->addr, image->size);
+		return;
+	}
+#endif
+	free(image->addr);
+}
+
+static void cfg_schema_put(cfg_schema_t *schema)
+{
+	unsigned int i;
+
+	if (!schema || --schema->refcount)
+		return;
+
+	while (schema->images) {
+		cfg_image_t *next = schema->images->next;
+
+		cfg_image_free(schema->images);
+		free(schema->images);
+		schema->images = next;
+	}
+	for (i = 0; i < schema->nsources; i++)
+		free(schema->sources[i].name);
+	free(schema->sources);
+	cfg_arena_free(schema->arena);
+	cfg_free_opt_array(schema->opts);
+	free(schema);
+}
+
+/*
+ * Create the options of a section instance from the schema options.
+ * Name, defaults, and sub-options are shared with the schema, only the
+ * comment is per instance.  Values are added later.
+ */
+static cfg_opt_t *cfg_instopt_array(cfg_t *cfg, cfg_opt_t *opts)
+{
+	cfg_arena_t *arena = cfg_arena(cfg);
+	int i;
+	cfg_opt_t *instopts;
+	int n = cfg_numopts(opts);
+
+	instopts = cfg_calloc(arena, n + 1, sizeof(cfg_opt_t));
+	if (!instopts)
+		return NULL;
+
+	if (n)
+		memcpy(instopts, opts, n * sizeof(cfg_opt_t));
+
+	for (i = 0; i < n; i++) {
+		instopts[i].owner = cfg;
+		instopts[i].comment = NULL;
+		/* Cached defaults, see cfg_init_defaults() */
+		instopts[i].nvalues = 0;
+		instopts[i].nalloc = 0;
+		instopts[i].nold = 0;
+		instopts[i].values = NULL;
+		if (opts[i].comment) {
+			instopts[i].comment = cfg_strdup(arena, opts[i].comment);
+			if (!instopts[i].comment)
+				goto err;
+		}
+	}
+
+	return instopts;
+err:
+	while (i--)
+		cfg_dealloc(arena, instopts[i].comment);
+	cfg_dealloc(arena, instopts);
+	return NULL;
+}
+
+static void cfg_free_instopt_array(cfg_arena_t *arena, cfg_opt_t *opts)
+{
+	int i;
+
+	for (i = 0; opts[i].name; ++i) {
+		if (is_set(CFGF_DYNAMIC, opts[i].flags))
+			cfg_dealloc(arena, (void *)opts[i].name);
+		cfg_dealloc(arena, opts[i].comment);
+	}
+	cfg_dealloc(arena, opts);
+}
+
+DLLIMPORT int cfg_parse_boolean(const char *s)
+{
+	if (!s) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	if (strcasecmp(s, "true") == 0 || strcasecmp(s, "on") == 0 || strcasecmp(s, "yes") == 0)
+		return 1;
+	if (strcasecmp(s, "false") == 0 || strcasecmp(s, "off") == 0 || strcasecmp(s, "no") == 0)
+		return 0;
+
+	return CFG_FAIL;
+}
+
+/*
+ * Parse the default value string of an option.  This uses a separate
+ * scanner, the buffer replaces the current one, which may be in use by
+ * an ongoing parse.
+ */
+static int cfg_parse_default(cfg_t *cfg, cfg_opt_t *opt, void **scanner)
+{
+	void *prev = cfg->scanner;
+	char *buf = opt->def.parsed;
+	int xstate, ret;
+
+	/* force the correct state and option */
+	if (is_set(CFGF_LIST, opt->flags))
+		/* lists must be surrounded by {braces} */
+		xstate = 3;
+	else if (opt->type == CFGT_FUNC)
+		xstate = 0;
+	else
+		xstate = 2;
+
+	if (!*scanner)
+		*scanner = cfg_scanner_new();
+	if (!*scanner || cfg_scan_bytes_begin(*scanner, buf, strlen(buf)))
+		return STATE_ERROR;
+
+	cfg->scanner = *scanner;
+	do {
+		ret = cfg_parse_internal(cfg, 1, xstate, opt);
+		xstate = -1;
+	} while (ret == STATE_CONTINUE);
+
+	cfg_scan_end(*scanner);
+	cfg->scanner = prev;
+
+	return ret;
+}
+
+/*
+ * Default lists of plain values are the same for every instance of a
+ * section, so they are parsed once into the schema option and copied
+ * from there.  Callbacks may have side effects, or give a different
+ * result depending on the section, so options with them are parsed
+ * for each instance.
+ */
+static int cfg_defaults_cacheable(cfg_opt_t *opt)
+{
+	if (!is_set(CFGF_LIST, opt->flags) || opt->parsecb || opt->validcb)
+		return 0;
+
+	switch (opt->type) {
+	case CFGT_INT:
+	case CFGT_FLOAT:
+	case CFGT_BOOL:
+	case CFGT_STR:
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+static int cfg_copy_defaults(cfg_opt_t *opt, cfg_opt_t *def)
+{
+	cfg_arena_t *arena = cfg_opt_arena(opt);
+	cfg_value_t *vals = cfg_opt_vals(def);
+	unsigned int i;
+
+	if (cfg_opt_reserve(opt, def->nvalues))
+		return CFG_FAIL;
+
+	for (i = 0; i < def->nvalues; i++) {
+		cfg_value_t *val = cfg_addval(opt);
+
+		if (!val)
+			return CFG_FAIL;
+
+		if (opt->type == CFGT_STR) {
+			if (vals[i].string) {
+				val->string = cfg_strdup(arena, vals[i].string);
+				if (!val->string)
+					return CFG_FAIL;
+			}
+		} else {
+			*val = vals[i];
+		}
+	}
+
+	return CFG_SUCCESS;
+}
+
+/*
+ * Set the default value of one option of a section.  The schema option
+ * it was created from, if given, caches parsed default lists for all
+ * instances.
+ */
+static void cfg_init_default(cfg_t *cfg, cfg_opt_t *opt, cfg_opt_t *def, void **scanner)
+{
+	/* libConfuse doesn't handle default values for "simple" options */
+	if (opt->simple_value.ptr || is_set(CFGF_NODEFAULT, opt->flags))
+		return;
+
+	if (opt->type != CFGT_SEC) {
+		opt->flags |= CFGF_DEFINIT;
+
+		if (is_set(CFGF_LIST, opt->flags) || opt->def.parsed) {
+			int ret;
+			char *buf;
+
+			/* If it's a list, but no default value was given,
+			 * keep the option uninitialized.
+			 */
+			buf = opt->def.parsed;
+			if (!buf || !buf[0])
+				return;
+
+			if (def && def->name == opt->name && cfg_defaults_cacheable(opt)) {
+				if (!is_set(CFGF_DEFINIT, def->flags)) {
+					cfg_flag_t flags = def->flags;
+
+					ret = cfg_parse_default(cfg, def, scanner);
+					def->flags = flags | CFGF_DEFINIT;
+				} else {
+					ret = STATE_EOF;
+				}
+				if (ret != STATE_ERROR && cfg_copy_defaults(opt, def))
+					ret = STATE_ERROR;
+			} else {
+				ret = cfg_parse_default(cfg, opt, scanner);
+			}
+
+			if (ret == STATE_ERROR) {
+				/*
+				 * If there was an error parsing the default string,
+				 * the initialization of the default value could be
+				 * inconsistent or empty. What to do? It's a
+				 * programming error and not an end user input
+				 * error. Lets print a message and abort...
+				 */
+				fprintf(stderr, "Parse error in default value '%s'"
+					" for option '%s'\n", opt->def.parsed, opt->name);
+				fprintf(stderr, "Check your initialization macros and the" " libConfuse documentation\n");
+				abort();
+			}
+		} else {
+			cfg_value_t val;
+
+			switch (opt->type) {
+			case CFGT_INT:
+				val.number = opt->def.number;
+				cfg_opt_setnval(opt, CFGT_INT, val, 0, 0);
+				break;
+
+			case CFGT_FLOAT:
+				val.fpnumber = opt->def.fpnumber;
+				cfg_opt_setnval(opt, CFGT_FLOAT, val, 0, 0);
+				break;
+
+			case CFGT_BOOL:
+				val.boolean = opt->def.boolean;
+				cfg_opt_setnval(opt, CFGT_BOOL, val, 0, 0);
+				break;
+
+			case CFGT_STR:
+				val.string = (char *)opt->def.string;
+				cfg_opt_setnval(opt, CFGT_STR, val, 0, 0);
+				break;
+
+			case CFGT_FUNC:
+			case CFGT_PTR:
+				break;
+
+			default:
+				cfg_error(cfg, "internal error in cfg_init_defaults(%s)", opt->name);
+				break;
+			}
+		}
+
+		/* The default value should only be returned if no value
+		 * is given in the configuration file, so we set the RESET
+		 * flag here. When/If cfg_setopt() is called, the value(s)
+		 * will be freed and the flag unset.
+		 */
+		opt->flags |= CFGF_RESET;
+		opt->flags &= ~CFGF_MODIFIED;
+	} else if (!is_set(CFGF_MULTI, opt->flags)) {
+		/* Created on first use instead, see cfg_opt_lazyinit() */
+		if (is_set(CFGF_LAZY, cfg->flags))
+			return;
+
+		cfg_setopt(cfg, opt, NULL);
+		opt->flags |= CFGF_DEFINIT;
+	}
+}
+
+/* Set the default values of a new section, see cfg_init_default() */
+static void cfg_init_defaults(cfg_t *cfg, cfg_opt_t *defs)
+{
+	void *scanner = NULL;
+	int i;
+
+	for (i = 0; cfg->opts && cfg->opts[i].name; i++)
+		cfg_init_default(cfg, &cfg->opts[i], defs ? &defs[i] : NULL, &scanner);
+
+	cfg_scanner_free(scanner);
+}
+
+DLLIMPORT cfg_value_t *cfg_setopt(cfg_t *cfg, cfg_opt_t *opt, const char *value)
+{
+	cfg_value_t *val = NULL;
+	cfg_arena_t *arena;
+	int added = 0, recycled = 0;
+	const char *s;
+	char *endptr;
+	long int i;
+	double f;
+	void *p;
+	int b;
+
+	if (!cfg || !opt) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (cfg_frozen(cfg))
+		return NULL;
+
+	if (opt->simple_value.ptr) {
+		if (opt->type == CFGT_SEC) {
+			errno = EINVAL;
+			return NULL;
+		}
+		val = (cfg_value_t *)opt->simple_value.ptr;
+	} else {
+		if (is_set(CFGF_RESET, opt->flags)) {
+			cfg_clear_values(opt);
+			opt->flags &= ~CFGF_RESET;
+		}
+
+		if (opt->nvalues == 0 || is_set(CFGF_MULTI, opt->flags) || is_set(CFGF_LIST, opt->flags)) {
+			val = NULL;
+
+			if (opt->type == CFGT_SEC && is_set(CFGF_TITLE, opt->flags)) {
+				/*
+				 * Check there are either no sections at
+				 * all, or a non-NULL section title.
+				 */
+				if (opt->nvalues != 0 && !value) {
+					errno = EINVAL;
+					return NULL;
+				}
+
+				/* Check if there already is a section with the same title. */
+				if (value) {
+					i = cfg_opt_findtslot(opt, value, strlen(value), is_set(CFGF_NOCASE, cfg->flags));
+					if (i >= 0 && (unsigned long)i >= opt->nvalues) {
+						val = cfg_opt_recycle(cfg, opt, i, value);
+						if (!val)
+							return NULL;
+						recycled = 1;
+					} else if (i >= 0) {
+						val = &cfg_opt_vals(opt)[i];
+					}
+				}
+
+				if (val && !recycled && is_set(CFGF_NO_TITLE_DUPES, opt->flags)) {
+					cfg_error(cfg, _("found duplicate title '%s'"), value);
+					return NULL;
+				}
+			} else if (opt->type == CFGT_SEC && opt->nvalues < opt->nold) {
+				/* Untitled sections are recycled in order */
+				val = cfg_opt_recycle(cfg, opt, opt->nvalues, NULL);
+				if (!val)
+					return NULL;
+				recycled = 1;
+			}
+
+			if (!val) {
+				if (opt->type == CFGT_SEC && opt->nvalues < opt->nold && cfg_opt_evict(opt))
+					return NULL;
+
+				val = cfg_addval(opt);
+				if (!val)
+					return NULL;
+				added = 1;
+			}
+		} else {
+			val = cfg_opt_vals(opt);
+		}
+	}
+
+	switch (opt->type) {
+	case CFGT_INT:
+		if (opt->parsecb) {
+			if ((*opt->parsecb) (cfg, opt, value, &i) != 0)
+				return NULL;
+		} else {
+			const char *str;
+			int radix = 0;
+
+			if (!value) {
+				errno = EINVAL;
+				return NULL;
+			}
+
+			str = value;
+			if (value[0] == '0') {
+				switch (value[1]) {
+				case 'b':
+					radix = 2;
+					str = &value[2];
+					break;
+				case 'x':
+					radix = 16;
+					str = &value[2];
+					break;
+				default:
+					radix = 8;
+					str = &value[1];
+				}
+			}
+
+			i = strtol(str, &endptr, radix);
+			if (*endptr != '\0') {
+				cfg_error(cfg, _("invalid integer value for option '%s'"), opt->name);
+				return NULL;
+			}
+
+			if (errno == ERANGE) {
+				cfg_error(cfg, _("integer value for option '%s' is out of range"), opt->name);
+				return NULL;
+			}
+		}
+		val->number = i;
+		break;
+
+	case CFGT_FLOAT:
+		if (opt->parsecb) {
+			if ((*opt->parsecb) (cfg, opt, value, &f) != 0)
+				return NULL;
+		} else {
+			if (!value) {
+				errno = EINVAL;
+				return NULL;
+			}
+			f = strtod(value, &endptr);
+			if (*endptr != '\0') {
+				cfg_error(cfg, _("invalid floating point value for option '%s'"), opt->name);
+				return NULL;
+			}
+			if (errno == ERANGE) {
+				cfg_error(cfg, _("floating point value for option '%s' is out of range"), opt->name);
+				return NULL;
+			}
+		}
+		val->fpnumber = f;
+		break;
+
+	case CFGT_STR:
+		if (opt->parsecb) {
+			s = NULL;
+			if ((*opt->parsecb) (cfg, opt, value, &s) != 0)
+				return NULL;
+		} else {
+			s = value;
+		}
+
+		if (!s) {
+			errno = EINVAL;
+			return NULL;
+		}
+
+		/* Keep an equal string, e.g. a value recycled by cfg_reparse() */
+		if (val->string && strcmp(val->string, s) == 0)
+			break;
+
+		/* Simple values belong to the user, not the arena */
+		arena = opt->simple_value.ptr ? NULL : cfg_opt_arena(opt);
+		cfg_dealloc(arena, val->string);
+		val->string = cfg_strdup(arena, s);
+		if (!val->string)
+			return NULL;
+		break;
+
+	case CFGT_SEC:
+		if (!recycled && (is_set(CFGF_MULTI, opt->flags) || val->section == NULL)) {
+			if (val->section) {
+				val->section->path = NULL; /* Global search path */
+				cfg_free(val->section);
+			}
+			arena = cfg_arena(cfg);
+			val->section = cfg_calloc(arena, 1, sizeof(cfg_t));
+			if (!val->section)
+				return NULL;
+
+			val->section->name = cfg_strdup(arena, opt->name);
+			if (!val->section->name) {
+				cfg_dealloc(arena, val->section);
+				return NULL;
+			}
+
+			val->section->flags = cfg->flags & ~CFGF_STALE;
+			if (is_set(CFGF_KEYSTRVAL, opt->flags))
+				val->section->flags |= CFGF_KEYSTRVAL;
+
+			val->section->filename = cfg->filename ? cfg_strdup(arena, cfg->filename) : NULL;
+			if (cfg->filename && !val->section->filename) {
+				cfg_dealloc(arena, val->section->name);
+				cfg_dealloc(arena, val->section);
+				return NULL;
+			}
+
+			val->section->line = cfg->line;
+			val->section->errfunc = cfg->errfunc;
+			val->section->parent = cfg;
+			val->section->title = value ? cfg_strdup(arena, value) : NULL;
+			if (value && !val->section->title) {
+				cfg_dealloc(arena, val->section->filename);
+				cfg_dealloc(arena, val->section->name);
+				cfg_dealloc(arena, val->section);
+				return NULL;
+			}
+
+			val->section->schema = arena ? cfg->schema : cfg_schema_get(cfg->schema);
+			val->section->opts = cfg_instopt_array(val->section, opt->subopts);
+			if (!val->section->opts) {
+				if (!arena)
+					cfg_schema_put(val->section->schema);
+				cfg_dealloc(arena, val->section->title);
+				cfg_dealloc(arena, val->section->filename);
+				cfg_dealloc(arena, val->section->name);
+				cfg_dealloc(arena, val->section);
+				return NULL;
+			}
+			cfg_index_opts(val->section);
+
+			/* Keep title index in sync, or drop it to rebuild on next lookup */
+			if (added && opt->index) {
+				if (!value || cfg_index_add(opt->index, value, opt->nvalues - 1, cfg_title_key, opt)) {
+					cfg_index_free(opt->index);
+					opt->index = NULL;
+				}
+			}
+		}
+		/* Recycled sections keep their values, see cfg_reparse_end() */
+		if (!recycled && !is_set(CFGF_DEFINIT, opt->flags)) {
+			cfg_init_defaults(val->section, opt->subopts);
+			/* single sections get their defaults once */
+			if (!is_set(CFGF_MULTI, opt->flags))
+				opt->flags |= CFGF_DEFINIT;
+		}
+		break;
+
+	case CFGT_BOOL:
+		if (opt->parsecb) {
+			if ((*opt->parsecb) (cfg, opt, value, &b) != 0)
+				return NULL;
+		} else {
+			b = cfg_parse_boolean(value);
+			if (b == -1) {
+				cfg_error(cfg, _("invalid boolean value for option '%s'"), opt->name);
+				return NULL;
+			}
+		}
+		val->boolean = (cfg_bool_t)b;
+		break;
+
+	case CFGT_PTR:
+		if (!opt->parsecb) {
+			errno = EINVAL;
+			return NULL;
+		}
+
+		if ((*opt->parsecb) (cfg, opt, value, &p) != 0)
+			return NULL;
+		if (val->ptr && opt->freecb)
+			opt->freecb(val->ptr);
+		val->ptr = p;
+		break;
+
+	default:
+		cfg_error(cfg, "internal error in cfg_setopt(%s, %s)", opt->name, (value) ? (value) : "NULL");
+		return NULL;
+	}
+
+	opt->flags |= CFGF_MODIFIED;
+
+	return val;
+}
+
+DLLIMPORT int cfg_opt_setmulti(cfg_t *cfg, cfg_opt_t *opt, unsigned int nvalues, char **values)
+{
+	cfg_opt_t old;
+	unsigned int i;
+
+	if (!opt || !nvalues) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	if (cfg_frozen(cfg))
+		return CFG_FAIL;
+
+	old = *opt;
+	opt->nvalues = 0;
+	opt->nalloc = 0;
+	opt->values = NULL;
+	opt->index = NULL;
+
+	for (i = 0; i < nvalues; i++) {
+		if (cfg_setopt(cfg, opt, values[i]))
+			continue;
+
+		/* ouch, revert */
+		cfg_free_value_internal(opt);
+		opt->nvalues = old.nvalues;
+		opt->values = old.values;
+		opt->nalloc = old.nalloc;
+		opt->value = old.value;
+		opt->index = old.index;
+		opt->flags &= ~(CFGF_RESET | CFGF_MODIFIED);
+		opt->flags |= old.flags & (CFGF_RESET | CFGF_MODIFIED);
+
+		return CFG_FAIL;
+	}
+
+	cfg_free_value_internal(&old);
+	opt->flags |= CFGF_MODIFIED;
+	opt->gen++;
+	cfg_opt_notify(opt, CFG_DIFF_CHANGED, 0);
+
+	return CFG_SUCCESS;
+}
+
+DLLIMPORT int cfg_setmulti(cfg_t *cfg, const char *name, unsigned int nvalues, char **values)
+{
+	cfg_opt_t *opt;
+
+	if (!cfg || !name || !values) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	opt = cfg_getopt(cfg, name);
+	if (!opt) {
+		errno = ENOENT;
+		return CFG_FAIL;
+	}
+
+	return cfg_opt_setmulti(cfg, opt, nvalues, values);
+}
+
+/* searchpath */
+
+struct cfg_searchpath_t {
+	char *dir;	        /**< directory to search */
+	cfg_searchpath_t *next; /**< next in list */
+};
+
+/* prepend a new cfg_searchpath_t to the linked list */
+
+DLLIMPORT int cfg_add_searchpath(cfg_t *cfg, const char *dir)
+{
+	cfg_searchpath_t *p;
+	char *d;
+
+	if (!cfg || !dir) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	if (cfg_frozen(cfg))
+		return CFG_FAIL;
+
+	d = cfg_tilde_expand(dir);
+	if (!d)
+		return CFG_FAIL;
+
+	p = malloc(sizeof(cfg_searchpath_t));
+	if (!p) {
+		free(d);
+		return CFG_FAIL;
+	}
+
+	p->next   = cfg->path;
+	p->dir    = d;
+	cfg->path = p;
+
+	return CFG_SUCCESS;
+}
+
+DLLIMPORT cfg_errfunc_t cfg_set_error_function(cfg_t *cfg, cfg_errfunc_t errfunc)
+{
+	cfg_errfunc_t old;
+
+	if (!cfg) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (cfg_frozen(cfg))
+		return NULL;
+
+	old = cfg->errfunc;
+	cfg->errfunc = errfunc;
+
+	return old;
+}
+
+DLLIMPORT cfg_print_filter_func_t cfg_set_print_filter_func(cfg_t *cfg, cfg_print_filter_func_t pff)
+{
+	cfg_print_filter_func_t old;
+
+	if (!cfg) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (cfg_frozen(cfg))
+		return NULL;
+
+	old = cfg->pff;
+	cfg->pff = pff;
+
+	return old;
+}
+
+DLLIMPORT void cfg_error(cfg_t *cfg, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+
+	if (cfg && cfg->errfunc)
+		(*cfg->errfunc) (cfg, fmt, ap);
+	else {
+		if (cfg && cfg->filename && cfg->line)
+			fprintf(stderr, "%s:%d: ", cfg->filename, cfg->line);
+		else if (cfg && cfg->filename)
+			fprintf(stderr, "%s: ", cfg->filename);
+		vfprintf(stderr, fmt, ap);
+		fprintf(stderr, "\n");
+	}
+
+	va_end(ap);
+}
+
+static int call_function(cfg_t *cfg, cfg_opt_t *opt, cfg_opt_t *funcopt)
+{
+	int ret;
+	const char **argv;
+	unsigned int i;
+
+	if (!cfg || !opt ||!funcopt) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	/*
+	 * create am argv string vector and call the registered function
+	 */
+	argv = calloc(funcopt->nvalues, sizeof(char *));
+	if (!argv)
+		return CFG_FAIL;
+
+	for (i = 0; i < funcopt->nvalues; i++)
+		argv[i] = cfg_opt_vals(funcopt)[i].string;
+
+	ret = (*opt->func) (cfg, opt, funcopt->nvalues, argv);
+	cfg_free_value_internal(funcopt);
+	free(argv);
+
+	return ret;
+}
+
+static void cfg_handle_deprecated(cfg_t *cfg, cfg_opt_t *opt)
+{
+	if (is_set(CFGF_DROP, opt->flags)) {
+		cfg_error(cfg, _("dropping deprecated configuration option '%s'"), opt->name);
+		cfg_free_value_internal(opt);
+	} else {
+		cfg_error(cfg, _("found deprecated option '%s', please update configuration file."), opt->name);
+	}
+}
+
+/*
+ * Mark all options and sections of a tree before cfg_reparse().  The
+ * mark is cleared when the parser first assigns an option, and on the
+ * remaining ones by cfg_reparse_end().
+ */
+static void cfg_reparse_begin(cfg_t *cfg)
+{
+	cfg_opt_t *opt;
+	unsigned int j;
+
+	cfg->flags |= CFGF_STALE;
+	for (opt = cfg_firstopt(cfg); opt; opt = cfg_nextopt(opt)) {
+		/* Nothing to recycle, nor defaults to restore */
+		if (opt->simple_value.ptr || opt->type == CFGT_FUNC)
+			continue;
+
+		opt->flags |= CFGF_STALE;
+		if (opt->type != CFGT_SEC)
+			continue;
+
+		for (j = 0; j < opt->nvalues; j++)
+			cfg_reparse_begin(cfg_opt_vals(opt)[j].section);
+	}
+}
+
+/*
+ * First assignment of an option in cfg_reparse().  Its values are kept
+ * aside, past opt->nvalues, to be recycled for the new values by
+ * cfg_addval().  Appending starts from the defaults, like it would in a
+ * new cfg_t.
+ */
+static void cfg_opt_touch(cfg_t *cfg, cfg_opt_t *opt)
+{
+	opt->flags &= ~CFGF_STALE;
+	if (opt->comment && is_set(CFGF_COMMENTS, cfg->flags)) {
+		cfg_dealloc(cfg_opt_arena(opt), opt->comment);
+		opt->comment = NULL;
+	}
+
+	if (opt->type == CFGT_SEC) {
+		/* A single section is always reused as is */
+		if (is_set(CFGF_MULTI, opt->flags) && opt->nvalues) {
+			opt->nold = opt->nvalues;
+			opt->nvalues = 0;
+			opt->gen++;
+		}
+		return;
+	}
+
+	if (is_set(CFGF_RESET, opt->flags)) {
+		opt->nold = opt->nvalues;
+		opt->nvalues = 0;
+	} else {
+		void *scanner = NULL;
+
+		cfg_clear_values(opt);
+		cfg_init_default(cfg, opt, NULL, &scanner);
+		cfg_scanner_free(scanner);
+	}
+	opt->flags &= ~CFGF_RESET;
+}
+
+/*
+ * Finish cfg_reparse() of a section: options the new input did not
+ * assign get their default values back, and previous values that were
+ * not recycled are released.  Called by the parser at the end of each
+ * section, before validation, and on the whole tree when done.
+ */
+static void cfg_reparse_end(cfg_t *cfg, cfg_opt_t *defs)
+{
+	cfg_arena_t *arena = cfg_arena(cfg);
+	void *scanner = NULL;
+	unsigned int i, j, n;
+
+	cfg->flags &= ~CFGF_STALE;
+	for (i = n = 0; cfg->opts && cfg->opts[i].name; i++) {
+		cfg_opt_t *opt = &cfg->opts[i];
+
+		if (!is_set(CFGF_STALE, opt->flags)) {
+			cfg_opt_trim(opt);
+		} else {
+			opt->flags &= ~CFGF_STALE;
+			if (opt->comment && is_set(CFGF_COMMENTS, cfg->flags)) {
+				cfg_dealloc(arena, opt->comment);
+				opt->comment = NULL;
+			}
+
+			if (is_set(CFGF_DYNAMIC, opt->flags)) {
+				/* Not in the new input, drop it altogether */
+				cfg_free_value_internal(opt);
+				cfg_dealloc(arena, (void *)opt->name);
+				continue;
+			}
+
+			if (opt->type != CFGT_SEC) {
+				if (!is_set(CFGF_RESET, opt->flags)) {
+					cfg_clear_values(opt);
+					cfg_init_default(cfg, opt, defs ? &defs[i] : NULL, &scanner);
+				}
+			} else if (is_set(CFGF_MULTI, opt->flags)) {
+				cfg_clear_values(opt);
+			} else if (!opt->nvalues) {
+				/* Removed single section, see cfg_opt_lazyinit() */
+				opt->flags &= ~CFGF_DEFINIT;
+				cfg_init_default(cfg, opt, NULL, &scanner);
+			}
+		}
+
+		if (opt->type == CFGT_SEC) {
+			for (j = 0; j < opt->nvalues; j++) {
+				cfg_t *sec = cfg_opt_vals(opt)[j].section;
+
+				if (sec && is_set(CFGF_STALE, sec->flags))
+					cfg_reparse_end(sec, opt->subopts);
+			}
+		}
+
+		if (n != i)
+			cfg->opts[n] = *opt;
+		n++;
+	}
+
+	/* New end marker after dropped options */
+	if (n != i) {
+		memset(&cfg->opts[n], 0, sizeof(cfg_opt_t));
+		cfg_index_opts(cfg);
+	}
+
+	cfg_scanner_free(scanner);
+}
+
+static int cfg_parse_internal(cfg_t *cfg, int level, int force_state, cfg_opt_t *force_opt)
+{
+	int state = 0;
+	char *comment = NULL;
+	char *opttitle = NULL;
+	char *titlebuf = NULL;	/* section titles of this level, reused */
+	size_t titlesz = 0;
+	cfg_opt_t *opt = NULL;
+	cfg_value_t *val = NULL;
+	cfg_t *sec;
+	char *yylval;
+	cfg_opt_t funcopt = CFG_STR(NULL, NULL, 0);
+
+	int ignore = 0;		/* ignore until this token, traverse parser w/o error */
+	int num_values = 0;	/* number of values found for a list option */
+	int rc;
+
+	if (force_state != -1)
+		state = force_state;
+	if (force_opt)
+		opt = force_opt;
+
+	while (1) {
+		int tok = cfg_yylex(cfg, &yylval);
+
+		if (tok == 0) {
+			/* lexer.l should have called cfg_error() */
+			goto error;
+		}
+
+		if (tok == EOF) {
+			if (state != 0) {
+				cfg_error(cfg, _("premature end of file"));
+				goto error;
+			}
+
+			if (opt && is_set(CFGF_DEPRECATED, opt->flags))
+				cfg_handle_deprecated(cfg, opt);
+
+			if (comment)
+				free(comment);
+			free(titlebuf);
+
+			return STATE_EOF;
+		}
 
 		switch (state) {
 		case 0:	/* expecting an option name */
 			if (opt && is_set(CFGF_DEPRECATED, opt->flags))
 				cfg_handle_deprecated(cfg, opt);
 
-			switch (tok) {
-			case '}':
-				if (level == 0) {
-					cfg_error(cfg, _("unexpected closing brace"));
-					goto error;
-				}
-				if (comment)
-					free(comment);
+			switch (tok) {
+			case '}':
+				if (level == 0) {
+					cfg_error(cfg, _("unexpected closing brace"));
+					goto error;
+				}
+				if (comment)
+					free(comment);
+				free(titlebuf);
+
+				return STATE_EOF;
+
+			case CFGT_STR:
+				break;
+
+			case CFGT_COMMENT:
+				if (!is_set(CFGF_COMMENTS, cfg->flags))
+					continue;
+
+				if (comment)
+					free(comment);
+				comment = strdup(yylval);
+				continue;
+
+			default:
+				cfg_error(cfg, _("unexpected token '%s'"), yylval);
+				goto error;
+			}
+
+			opt = cfg_getopt(cfg, yylval);
+			if (!opt) {
+				if (is_set(CFGF_IGNORE_UNKNOWN, cfg->flags)) {
+					state = 10;
+					break;
+				}
+
+				/* Not found, is it a dynamic key-value section? */
+				if (is_set(CFGF_KEYSTRVAL, cfg->flags)) {
+					opt = cfg_addopt(cfg, yylval);
+					if (!opt)
+						goto error;
+
+					state = 1;
+					break;
+				}
+
+				goto error;
+			}
+
+			if (opt->type == CFGT_SEC) {
+				if (is_set(CFGF_TITLE, opt->flags))
+					state = 6;
+				else
+					state = 5;
+			} else if (opt->type == CFGT_FUNC) {
+				state = 7;
+			} else {
+				state = 1;
+			}
+			break;
+
+		case 1:	/* expecting an equal sign or plus-equal sign */
+			if (!opt)
+				goto error;
+
+			if (tok == '+') {
+				if (!is_set(CFGF_LIST, opt->flags)) {
+					cfg_error(cfg, _("attempt to append to non-list option '%s'"), opt->name);
+					goto error;
+				}
+				/* Even if the reset flag was set by
+				 * cfg_init_defaults, appending to the defaults
+				 * should be ok.
+				 */
+				opt->flags &= ~CFGF_RESET;
+			} else if (tok == '=') {
+				/* set the (temporary) reset flag to clear the old
+				 * values, since we obviously didn't want to append */
+				opt->flags |= CFGF_RESET;
+			} else {
+				cfg_error(cfg, _("missing equal sign after option '%s'"), opt->name);
+				goto error;
+			}
+
+			if (is_set(CFGF_STALE, opt->flags))
+				cfg_opt_touch(cfg, opt);
+			opt->flags |= CFGF_MODIFIED;
+
+			if (is_set(CFGF_LIST, opt->flags)) {
+				state = 3;
+				num_values = 0;
+			} else {
+				state = 2;
+			}
+			break;
+
+		case 2:	/* expecting an option value */
+			if (tok == '}' && opt && is_set(CFGF_LIST, opt->flags)) {
+				state = 0;
+				if (num_values == 0 && is_set(CFGF_RESET, opt->flags))
+					/* Reset flags was set, and the empty list was
+					 * specified. Free all old values. */
+					cfg_free_value_internal(opt);
+				break;
+			}
+
+			if (tok != CFGT_STR) {
+				cfg_error(cfg, _("unexpected token '%s'"), yylval);
+				goto error;
+			}
+
+			if (cfg_setopt(cfg, opt, yylval) == NULL)
+				goto error;
+
+			if (opt && opt->validcb && (*opt->validcb) (cfg, opt) != 0)
+				goto error;
+
+			/* Inherit last read comment */
+			cfg_opt_setcomment(opt, comment);
+			if (comment)
+				free(comment);
+			comment = NULL;
+
+			if (opt && is_set(CFGF_LIST, opt->flags)) {
+				++num_values;
+				state = 4;
+			} else {
+				state = 0;
+			}
+			break;
+
+		case 3:	/* expecting an opening brace for a list option */
+			if (tok != '{') {
+				if (tok != CFGT_STR) {
+					cfg_error(cfg, _("unexpected token '%s'"), yylval);
+					goto error;
+				}
+
+				if (cfg_setopt(cfg, opt, yylval) == NULL)
+					goto error;
+				if (opt && opt->validcb && (*opt->validcb) (cfg, opt) != 0)
+					goto error;
+				++num_values;
+				state = 0;
+			} else {
+				state = 2;
+			}
+			break;
+
+		case 4:	/* expecting a separator for a list option, or closing (list) brace */
+			if (tok == ',') {
+				state = 2;
+			} else if (tok == '}') {
+				state = 0;
+				if (opt && opt->validcb && (*opt->validcb) (cfg, opt) != 0)
+					goto error;
+			} else {
+				cfg_error(cfg, _("unexpected token '%s'"), yylval);
+				goto error;
+			}
+			break;
+
+		case 5:	/* expecting an opening brace for a section */
+			if (tok != '{') {
+				cfg_error(cfg, _("missing opening brace for section '%s'"), opt ? opt->name : "");
+				goto error;
+			}
+
+			if (is_set(CFGF_STALE, opt->flags))
+				cfg_opt_touch(cfg, opt);
+			val = cfg_setopt(cfg, opt, opttitle);
+			if (!val)
+				goto error;
+
+			opttitle = NULL;
+
+			sec = val->section;
+			sec->path = cfg->path; /* Remember global search path */
+			sec->line = cfg->line;
+			sec->errfunc = cfg->errfunc;
+			sec->scanner = cfg->scanner;
+			rc = cfg_parse_internal(sec, level + 1, -1, NULL);
+			sec->scanner = NULL;
+			if (rc != STATE_EOF)
+				goto error;
+
+			cfg->line = sec->line;
+			if (is_set(CFGF_STALE, sec->flags))
+				cfg_reparse_end(sec, opt->subopts);
+			if (opt && opt->validcb && (*opt->validcb) (cfg, opt) != 0)
+				goto error;
+			state = 0;
+			break;
+
+		case 6:	/* expecting a title for a section */
+			if (tok != CFGT_STR) {
+				cfg_error(cfg, _("missing title for section '%s'"), opt ? opt->name : "");
+				goto error;
+			} else {
+				size_t len = strlen(yylval) + 1;
+
+				if (len > titlesz) {
+					char *buf = realloc(titlebuf, len);
+
+					if (!buf)
+						goto error;
+					titlebuf = buf;
+					titlesz = len;
+				}
+				opttitle = memcpy(titlebuf, yylval, len);
+			}
+			state = 5;
+			break;
+
+		case 7:	/* expecting an opening parenthesis for a function */
+			if (tok != '(') {
+				cfg_error(cfg, _("missing parenthesis for function '%s'"), opt ? opt->name : "");
+				goto error;
+			}
+			state = 8;
+			break;
+
+		case 8:	/* expecting a function parameter or a closing paren */
+			if (tok == ')') {
+				if (call_function(cfg, opt, &funcopt))
+					goto error;
+				state = 0;
+			} else if (tok == CFGT_STR) {
+				val = cfg_addval(&funcopt);
+				if (!val)
+					goto error;
+
+				val->string = strdup(yylval);
+				if (!val->string)
+					goto error;
+
+				state = 9;
+			} else {
+				cfg_error(cfg, _("syntax error in call of function '%s'"), opt ? opt->name : "");
+				goto error;
+			}
+			break;
+
+		case 9:	/* expecting a comma in a function or a closing paren */
+			if (tok == ')') {
+				if (call_function(cfg, opt, &funcopt))
+					goto error;
+				state = 0;
+			} else if (tok == ',') {
+				state = 8;
+			} else {
+				cfg_error(cfg, _("syntax error in call of function '%s'"), opt ? opt->name : "");
+				goto error;
+			}
+			break;
+
+		case 10: /* unknown option, mini-discard parser states: 10-15 */
+			if (comment) {
+				free(comment);
+				comment = NULL;
+			}
+
+			if (tok == '+') {
+				ignore = '=';
+				state = 13; /* Append to list, should be followed by '=' */
+			} else if (tok == '=') {
+				ignore = 0;
+				state = 14; /* Assignment, regular handling */
+			} else if (tok == '(') {
+				ignore = ')';
+				state = 13; /* Function, ignore until end of param list */
+			} else if (tok == '{') {
+				state = 12; /* Section, ignore all until closing brace */
+			} else if (tok == CFGT_STR) {
+				state = 11; /* No '=' ... must be a titled section */
+			} else if (tok == '}' && force_state == 10) {
+				if (comment)
+					free(comment);
+				free(titlebuf);
+
+				return STATE_CONTINUE;
+			}
+			break;
+
+		case 11: /* unknown option, expecting start of title section */
+			if (tok != '{') {
+				cfg_error(cfg, _("unexpected token '%s'"), yylval);
+				goto error;
+			}
+			state = 12;
+			break;
+
+		case 12: /* unknown option, recursively ignore entire sub-section */
+			rc = cfg_parse_internal(cfg, level + 1, 10, NULL);
+			if (rc != STATE_CONTINUE)
+				goto error;
+			ignore = '}';
+			state = 13;
+			break;
+
+		case 13: /* unknown option, consume tokens silently until end of func/list */
+			if (tok != ignore)
+				break;
+
+			if (ignore == '=') {
+				ignore = 0;
+				state = 14;
+				break;
+			}
+
+			/* Are we done with recursive ignore of sub-section? */
+			if (force_state == 10) {
+				if (comment)
+					free(comment);
+				free(titlebuf);
+
+				return STATE_CONTINUE;
+			}
+
+			ignore = 0;
+			state = 0;
+			break;
+
+		case 14: /* unknown option, assuming value or start of list */
+			if (tok == '{') {
+				ignore = '}';
+				state = 13;
+				break;
+			}
+
+			if (tok != CFGT_STR) {
+				cfg_error(cfg, _("unexpected token '%s'"), yylval);
+				goto error;
+			}
+
+			ignore = 0;
+			if (force_state == 10)
+				state = 15;
+			else
+				state = 0;
+			break;
+
+		case 15: /* unknown option, dummy read of next parameter in sub-section */
+			state = 10;
+			break;
+
+		default:
+			cfg_error(cfg, _("Internal error in cfg_parse_internal(), unknown state %d"), state);
+			goto error;
+		}
+	}
+
+	if (comment)
+		free(comment);
+	free(titlebuf);
+
+	return STATE_EOF;
+
+error:
+	free(titlebuf);
+	if (comment)
+		free(comment);
+
+	return STATE_ERROR;
+}
+
+static int cfg_set_filename(cfg_t *cfg, const char *filename)
+{
+	cfg_arena_t *arena = cfg_self_arena(cfg);
+	char *fn;
+
+	if (cfg_frozen(cfg))
+		return CFG_FAIL;
+
+	/* Same file again, e.g. on reload */
+	if (cfg->filename && strcmp(cfg->filename, filename) == 0)
+		return CFG_SUCCESS;
+
+	fn = cfg_strdup(arena, filename);
+	if (!fn)
+		return CFG_FAIL;
+
+	cfg_dealloc(arena, cfg->filename);
+	cfg->filename = fn;
+
+	return CFG_SUCCESS;
+}
+
+/* Parse from the current buffer of a scanner, which is reset for reuse */
+static int cfg_parse_scanner(cfg_t *cfg, void *scanner)
+{
+	void *prev = cfg->scanner;
+	int ret;
+
+	if (cfg_frozen(cfg))
+		return CFG_PARSE_ERROR;
+
+	cfg->scanner = scanner;
+	cfg->line = 1;
+	ret = cfg_parse_internal(cfg, 0, -1, NULL);
+	cfg_scan_reset(scanner, cfg);
+	cfg->scanner = prev;
+	if (ret == STATE_ERROR)
+		return CFG_PARSE_ERROR;
+
+	return CFG_SUCCESS;
+}
+
+/* Same as cfg_parse_scanner(), but for a new scanner, which is released */
+static int cfg_parse_scanner_once(cfg_t *cfg, void *scanner)
+{
+	int ret;
+
+	ret = cfg_parse_scanner(cfg, scanner);
+	cfg_scanner_free(scanner);
+
+	return ret;
+}
+
+DLLIMPORT int cfg_parse_fp(cfg_t *cfg, FILE *fp)
+{
+	void *scanner;
+
+	if (!cfg || !fp) {
+		errno = EINVAL;
+		return CFG_PARSE_ERROR;
+	}
+
+	if (!cfg->filename && cfg_set_filename(cfg, "FILE"))
+		return CFG_PARSE_ERROR;
+
+	scanner = cfg_scanner_new();
+	if (!scanner)
+		return CFG_PARSE_ERROR;
+
+	cfg_scan_fp_begin(scanner, fp);
+
+	return cfg_parse_scanner_once(cfg, scanner);
+}
+
+/* Scan a writable buffer in place, it must end with two NUL bytes */
+static int cfg_parse_inplace(cfg_t *cfg, char *base, size_t size)
+{
+	void *scanner;
+
+	scanner = cfg_scanner_new();
+	if (!scanner)
+		return CFG_PARSE_ERROR;
+
+	if (cfg_scan_mem_begin(scanner, base, size)) {
+		cfg_scanner_free(scanner);
+		return CFG_PARSE_ERROR;
+	}
+
+	return cfg_parse_scanner_once(cfg, scanner);
+}
+
+/*
+ * Scan a regular file without stdio, from a buffer the file is read
+ * into, or with CFGF_MMAP from a private writable mapping when possible.
+ * A mapping raises SIGBUS if the file shrinks meanwhile, hence opt-in.
+ * Any other kind of file is read through cfg_parse_fp().
+ */
+static int cfg_parse_file(cfg_t *cfg, FILE *fp)
+{
+#ifdef HAVE_SYS_STAT_H
+	struct stat st;
+	size_t size, n;
+	char *buf;
+	int ret;
+
+	if (fstat(fileno(fp), &st) || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+	    (unsigned long long)st.st_size > SIZE_MAX - 2)
+		return cfg_parse_fp(cfg, fp);
+	size = (size_t)st.st_size;
+
+#ifdef HAVE_SYS_MMAN_H
+	{
+		long pagesz = sysconf(_SC_PAGESIZE);
+
+		/*
+		 * Flex needs two NUL bytes after the data, the part of the
+		 * last page past the end of the file is zero filled.
+		 */
+		if (is_set(CFGF_MMAP, cfg->flags) && pagesz > 0 &&
+		    size % pagesz && size % pagesz <= (size_t)pagesz - 2) {
+			buf = mmap(NULL, size + 2, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+			if (buf != MAP_FAILED) {
+				ret = cfg_parse_inplace(cfg, buf, size + 2);
+				munmap(buf, size + 2);
+
+				return ret;
+			}
+		}
+	}
+#endif
+
+	buf = malloc(size + 2);
+	if (!buf)
+		return cfg_parse_fp(cfg, fp);
+
+	n = fread(buf, 1, size, fp);
+	if (ferror(fp)) {
+		free(buf);
+		return CFG_FILE_ERROR;
+	}
+
+	buf[n] = buf[n + 1] = 0;
+	ret = cfg_parse_inplace(cfg, buf, n + 2);
+	free(buf);
+
+	return ret;
+#else
+	return cfg_parse_fp(cfg, fp);
+#endif
+}
+
+static char *cfg_make_fullpath(const char *dir, const char *file)
+{
+	int np;
+	char *path;
+	size_t len;
+
+	if (!dir || !file) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	len = strlen(dir) + strlen(file) + 2;
+	path = malloc(len);
+	if (!path)
+		return NULL;
+
+	np = snprintf(path, len, "%s/%s", dir, file);
+
+	/*
+	 * np is the number of characters that would have
+	 * been printed if there was enough room in path.
+	 * if np >= n then the snprintf() was truncated
+	 * (which must be a bug).
+	 */
+	assert(np < (int)len);
+
+	return path;
+}
+
+DLLIMPORT char *cfg_searchpath(cfg_searchpath_t *p, const char *file)
+{
+	char *fullpath;
+#ifdef HAVE_SYS_STAT_H
+	struct stat st;
+#endif
+	int err;
+
+	if (!p || !file) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (file[0] == '/') {
+		fullpath = strdup(file);
+		if (!fullpath)
+			return NULL;
+		goto check;
+	}
+
+	if ((fullpath = cfg_searchpath(p->next, file)) != NULL)
+		return fullpath;
+
+	if ((fullpath = cfg_make_fullpath(p->dir, file)) == NULL)
+		return NULL;
+
+check:
+#ifdef HAVE_SYS_STAT_H
+	err = stat((const char *)fullpath, &st);
+	if ((!err) && S_ISREG(st.st_mode))
+		return fullpath;
+	if (!err)
+		err = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+	else
+		err = errno;
+#else
+	/* needs an alternative check here for win32 */
+	err = ENOENT;
+#endif
+
+	free(fullpath);
+	errno = err;
+	return NULL;
+}
+
+static int cfg_stat_file(const char *filename, long long *size, long long *mtime)
+{
+#ifdef HAVE_SYS_STAT_H
+	struct stat st;
+
+	if (stat(filename, &st))
+		return -1;
+
+	*size = st.st_size;
+	*mtime = st.st_mtime;
+
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * Remember a file the parser reads, with its size and modification
+ * time, for cfg_cache_save().  Nothing is recorded if it cannot be
+ * stat()ed, a cache of the tree then cannot be saved.
+ */
+static void cfg_add_source(cfg_t *cfg, const char *filename)
+{
+	cfg_schema_t *schema = cfg->schema;
+	cfg_source_t *src = NULL;
+	long long size, mtime;
+	unsigned int i;
+
+	if (!schema)
+		return;
+
+	for (i = 0; i < schema->nsources; i++) {
+		if (strcmp(schema->sources[i].name, filename) == 0) {
+			src = &schema->sources[i];
+			break;
+		}
+	}
+
+	if (cfg_stat_file(filename, &size, &mtime)) {
+		if (src)
+			src->mtime = -1;
+		return;
+	}
+
+	if (!src) {
+		char *name = strdup(filename);
+
+		src = realloc(schema->sources, (schema->nsources + 1) * sizeof(cfg_source_t));
+		if (!src || !name) {
+			free(name);
+			if (src)
+				schema->sources = src;
+			return;
+		}
+		schema->sources = src;
+		src = &schema->sources[schema->nsources++];
+		src->name = name;
+	}
+	src->size = size;
+	src->mtime = mtime;
+}
+
+/* Look up filename in the search path, or expand it */
+static char *cfg_resolve_file(cfg_t *cfg, const char *filename)
+{
+	if (cfg->path)
+		return cfg_searchpath(cfg->path, filename);
+
+	return cfg_tilde_expand(filename);
+}
+
+/* Look up filename in the search path, or expand it, and open it */
+static FILE *cfg_open_file(cfg_t *cfg, const char *filename)
+{
+	FILE *fp;
+	char *fn;
+	int ret;
+
+	fn = cfg_resolve_file(cfg, filename);
+	if (!fn)
+		return NULL;
+
+	ret = cfg_set_filename(cfg, fn);
+	free(fn);
+	if (ret)
+		return NULL;
+
+	fp = fopen(cfg->filename, "r");
+	if (fp)
+		cfg_add_source(cfg, cfg->filename);
+
+	return fp;
+}
+
+DLLIMPORT int cfg_parse(cfg_t *cfg, const char *filename)
+{
+	int ret;
+	FILE *fp;
+
+	if (!cfg || !filename) {
+		errno = EINVAL;
+		return CFG_FILE_ERROR;
+	}
+
+	fp = cfg_open_file(cfg, filename);
+	if (!fp)
+		return CFG_FILE_ERROR;
+
+	ret = cfg_parse_file(cfg, fp);
+	fclose(fp);
+
+	return ret;
+}
+
+DLLIMPORT int cfg_parse_mem(cfg_t *cfg, const char *buf, size_t len)
+{
+	void *scanner;
+
+	if (!cfg || (!buf && len)) {
+		errno = EINVAL;
+		return CFG_PARSE_ERROR;
+	}
+
+	if (cfg_set_filename(cfg, "[buf]"))
+		return CFG_PARSE_ERROR;
+
+	scanner = cfg_scanner_new();
+	if (!scanner)
+		return CFG_PARSE_ERROR;
+
+	if (cfg_scan_bytes_begin(scanner, buf ? buf : "", len)) {
+		cfg_scanner_free(scanner);
+		return CFG_PARSE_ERROR;
+	}
+
+	return cfg_parse_scanner_once(cfg, scanner);
+}
+
+DLLIMPORT int cfg_parse_mem_inplace(cfg_t *cfg, char *buf, size_t size)
+{
+	if (!cfg || !buf || size < 2 || buf[size - 2] || buf[size - 1]) {
+		errno = EINVAL;
+		return CFG_PARSE_ERROR;
+	}
+
+	if (cfg_set_filename(cfg, "[buf]"))
+		return CFG_PARSE_ERROR;
+
+	return cfg_parse_inplace(cfg, buf, size);
+}
+
+DLLIMPORT int cfg_parse_buf(cfg_t *cfg, const char *buf)
+{
+	if (!cfg) {
+		errno = EINVAL;
+		return CFG_PARSE_ERROR;
+	}
+
+	if (!buf)
+		return CFG_SUCCESS;
+
+	return cfg_parse_mem(cfg, buf, strlen(buf));
+}
+
+/*
+ * Incremental reparse, cfg_reparse_begin() marks the tree, the parser
+ * recycles what it assigns again, and cfg_reparse_end() sweeps up.
+ */
+DLLIMPORT int cfg_reparse(cfg_t *cfg, const char *filename)
+{
+	int ret;
+	FILE *fp;
+
+	if (!cfg || !filename) {
+		errno = EINVAL;
+		return CFG_FILE_ERROR;
+	}
+
+	if (cfg_frozen(cfg))
+		return CFG_FILE_ERROR;
+
+	fp = cfg_open_file(cfg, filename);
+	if (!fp)
+		return CFG_FILE_ERROR;
+
+	cfg_reparse_begin(cfg);
+	ret = cfg_parse_file(cfg, fp);
+	cfg_reparse_end(cfg, NULL);
+	fclose(fp);
+
+	return ret;
+}
+
+DLLIMPORT int cfg_reparse_buf(cfg_t *cfg, const char *buf)
+{
+	int ret;
+
+	if (!cfg) {
+		errno = EINVAL;
+		return CFG_PARSE_ERROR;
+	}
+
+	if (cfg_frozen(cfg))
+		return CFG_PARSE_ERROR;
+
+	cfg_reparse_begin(cfg);
+	ret = cfg_parse_buf(cfg, buf);
+	cfg_reparse_end(cfg, NULL);
+
+	return ret;
+}
+
+/* reusable parser context */
+
+struct cfg_parser_t {
+	void *scanner;
+	char *buf;		/**< input of the last parse */
+	size_t size;		/**< allocated size of buf */
+};
+
+DLLIMPORT cfg_parser_t *cfg_parser_new(void)
+{
+	cfg_parser_t *parser;
+
+	parser = calloc(1, sizeof(cfg_parser_t));
+	if (!parser)
+		return NULL;
+
+	parser->scanner = cfg_scanner_new();
+	if (!parser->scanner) {
+		free(parser);
+		return NULL;
+	}
+
+	return parser;
+}
+
+DLLIMPORT void cfg_parser_free(cfg_parser_t *parser)
+{
+	if (!parser)
+		return;
+
+	cfg_scanner_free(parser->scanner);
+	free(parser->buf);
+	free(parser);
+}
+
+/* Make room for len bytes of input and the two NUL bytes flex needs */
+static int cfg_parser_reserve(cfg_parser_t *parser, size_t len)
+{
+	size_t size = parser->size;
+	char *buf;
+
+	if (len > SIZE_MAX / 2 - 2) {
+		errno = ENOMEM;
+		return CFG_FAIL;
+	}
+	if (len + 2 <= size)
+		return CFG_SUCCESS;
+
+	if (size < len + 2)
+		size = len + 2;
+	if (size < 2 * parser->size)
+		size = 2 * parser->size;
+
+	buf = realloc(parser->buf, size);
+	if (!buf)
+		return CFG_FAIL;
+
+	parser->buf = buf;
+	parser->size = size;
+
+	return CFG_SUCCESS;
+}
+
+/* Parse len bytes of input from the start of the buffer */
+static int cfg_parser_run(cfg_parser_t *parser, cfg_t *cfg, size_t len)
+{
+	parser->buf[len] = parser->buf[len + 1] = 0;
+	if (cfg_scan_mem_begin(parser->scanner, parser->buf, len + 2))
+		return CFG_PARSE_ERROR;
+
+	return cfg_parse_scanner(cfg, parser->scanner);
+}
+
+DLLIMPORT int cfg_parser_parse_fp(cfg_parser_t *parser, cfg_t *cfg, FILE *fp)
+{
+	size_t len = 0, n;
+#ifdef HAVE_SYS_STAT_H
+	struct stat st;
+#endif
+
+	if (!parser || !cfg || !fp) {
+		errno = EINVAL;
+		return CFG_PARSE_ERROR;
+	}
+
+	if (!cfg->filename && cfg_set_filename(cfg, "FILE"))
+		return CFG_PARSE_ERROR;
+
+#ifdef HAVE_SYS_STAT_H
+	/* Read a regular file in one go, if it did not grow meanwhile */
+	if (!fstat(fileno(fp), &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+	    (unsigned long long)st.st_size < SIZE_MAX / 2 - 2 && cfg_parser_reserve(parser, st.st_size + 1))
+		return CFG_PARSE_ERROR;
+#endif
+
+	do {
+		if (cfg_parser_reserve(parser, len + 1))
+			return CFG_PARSE_ERROR;
+
+		n = fread(parser->buf + len, 1, parser->size - len - 2, fp);
+		len += n;
+	} while (n > 0);
+
+	if (ferror(fp))
+		return CFG_FILE_ERROR;
+
+	return cfg_parser_run(parser, cfg, len);
+}
+
+DLLIMPORT int cfg_parser_parse(cfg_parser_t *parser, cfg_t *cfg, const char *filename)
+{
+	FILE *fp;
+	int ret;
+
+	if (!parser || !cfg || !filename) {
+		errno = EINVAL;
+		return CFG_FILE_ERROR;
+	}
+
+	fp = cfg_open_file(cfg, filename);
+	if (!fp)
+		return CFG_FILE_ERROR;
+
+	ret = cfg_parser_parse_fp(parser, cfg, fp);
+	fclose(fp);
+
+	return ret;
+}
+
+DLLIMPORT int cfg_parser_parse_mem(cfg_parser_t *parser, cfg_t *cfg, const char *buf, size_t len)
+{
+	if (!parser || !cfg || (!buf && len)) {
+		errno = EINVAL;
+		return CFG_PARSE_ERROR;
+	}
+
+	if (cfg_set_filename(cfg, "[buf]") || cfg_parser_reserve(parser, len))
+		return CFG_PARSE_ERROR;
+
+	if (len)
+		memcpy(parser->buf, buf, len);
+
+	return cfg_parser_run(parser, cfg, len);
+}
+
+DLLIMPORT cfg_t *cfg_init(cfg_opt_t *opts, cfg_flag_t flags)
+{
+	cfg_t *cfg;
+
+	cfg = calloc(1, sizeof(cfg_t));
+	if (!cfg)
+		return NULL;
+
+	cfg->name = strdup("root");
+	if (!cfg->name) {
+		free(cfg);
+		return NULL;
+	}
+
+	cfg->schema = cfg_schema_new(opts, flags);
+	if (!cfg->schema) {
+		free(cfg->name);
+		free(cfg);
+		return NULL;
+	}
+	cfg->schema->root = cfg;
+
+	cfg->opts = cfg_instopt_array(cfg, cfg->schema->opts);
+	if (!cfg->opts) {
+		cfg_schema_put(cfg->schema);
+		free(cfg->name);
+		free(cfg);
+		return NULL;
+	}
+
+	cfg->flags = flags;
+	cfg->filename = NULL;
+	cfg->line = 0;
+	cfg->errfunc = NULL;
+	cfg_index_opts(cfg);
+
+#if defined(ENABLE_NLS) && defined(HAVE_GETTEXT)
+	bindtextdomain(PACKAGE, LOCALEDIR);
+#endif
+
+	cfg_check_dupopts(cfg, cfg->schema->opts);
+	cfg_init_defaults(cfg, NULL);
+
+	return cfg;
+}
+
+/* shared state of the cfg_parse_files() workers */
+struct cfg_batch {
+	cfg_opt_t *opts;
+	cfg_flag_t flags;
+	cfg_errfunc_t errfunc;
+	const char **filenames;
+	cfg_t **cfgs;
+	unsigned int nfiles;
+	unsigned int next;	/* next file to pick up */
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t lock;
+#endif
+};
+
+/*
+ * strerror() need not be thread-safe, the cfg_parse_files() workers
+ * and the lexer use this instead
+ */
+const char *cfg_strerror(int err, char *buf, size_t len)
+{
+#if defined(HAVE_STRERROR_R) && defined(STRERROR_R_CHAR_P)
+	return strerror_r(err, buf, len);
+#elif defined(HAVE_STRERROR_R)
+	if (strerror_r(err, buf, len))
+		snprintf(buf, len, "error %d", err);
+	return buf;
+#else
+	/* e.g. Windows, where strerror() uses a per-thread buffer */
+	(void)buf;
+	(void)len;
+	return strerror(err);
+#endif
+}
+
+static cfg_t *cfg_batch_parse(struct cfg_batch *batch, const char *filename)
+{
+	char buf[128];
+	cfg_t *cfg;
+	int ret;
+
+	cfg = cfg_init(batch->opts, batch->flags);
+	if (!cfg)
+		return NULL;
+
+	cfg_set_error_function(cfg, batch->errfunc);
+	ret = cfg_parse(cfg, filename);
+	if (ret == CFG_FILE_ERROR)
+		cfg_error(cfg, "%s: %s", filename, cfg_strerror(errno, buf, sizeof(buf)));
+	if (ret != CFG_SUCCESS) {
+		cfg_free(cfg);
+		return NULL;
+	}
+
+	return cfg;
+}
+
+static void *cfg_batch_worker(void *arg)
+{
+	struct cfg_batch *batch = arg;
+
+	while (1) {
+		unsigned int i;
+
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_lock(&batch->lock);
+#endif
+		i = batch->next;
+		if (i < batch->nfiles)
+			batch->next++;
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_unlock(&batch->lock);
+#endif
+		if (i >= batch->nfiles)
+			break;
+
+		batch->cfgs[i] = cfg_batch_parse(batch, batch->filenames[i]);
+	}
+
+	return NULL;
+}
+
+DLLIMPORT cfg_t **cfg_parse_files(cfg_opt_t *opts, cfg_flag_t flags, cfg_errfunc_t errfunc,
+				  const char **filenames, unsigned int nfiles, unsigned int nthreads)
+{
+	struct cfg_batch batch;
+#ifdef HAVE_PTHREAD_H
+	pthread_t *threads;
+	unsigned int i, n = 0;
+#endif
+
+	if (!opts || (nfiles && !filenames)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	memset(&batch, 0, sizeof(batch));
+	batch.opts = opts;
+	batch.flags = flags;
+	batch.errfunc = errfunc;
+	batch.filenames = filenames;
+	batch.nfiles = nfiles;
+	batch.cfgs = calloc(nfiles ? nfiles : 1, sizeof(cfg_t *));
+	if (!batch.cfgs)
+		return NULL;
 
-				return STATE_EOF;
+#ifdef HAVE_PTHREAD_H
+#ifdef _SC_NPROCESSORS_ONLN
+	if (!nthreads) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
 
-			case CFGT_STR:
-				break;
+		nthreads = ncpu > 0 ? (unsigned int)ncpu : 1;
+	}
+#endif
+	if (nthreads > nfiles)
+		nthreads = nfiles;
 
-			case CFGT_COMMENT:
-				if (!is_set(CFGF_COMMENTS, cfg->flags))
-					continue;
+	if (pthread_mutex_init(&batch.lock, NULL)) {
+		free(batch.cfgs);
+		return NULL;
+	}
 
-				if (comment)
-					free(comment);
-				comment = strdup(cfg_yylval);
-				continue;
+	/* The calling thread is one of the workers, if threads cannot be
+	 * created it simply gets more of the work */
+	threads = nthreads > 1 ? calloc(nthreads - 1, sizeof(pthread_t)) : NULL;
+	for (n = 0; threads && n < nthreads - 1; n++) {
+		if (pthread_create(&threads[n], NULL, cfg_batch_worker, &batch))
+			break;
+	}
+	cfg_batch_worker(&batch);
 
-			default:
-				cfg_error(cfg, _("unexpected token '%s'"), cfg_yylval);
-				goto error;
-			}
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&batch.lock);
+	free(threads);
+#else
+	(void)nthreads;
+	cfg_batch_worker(&batch);
+#endif
 
-			opt = cfg_getopt(cfg, cfg_yylval);
-			if (!opt) {
-				if (is_set(CFGF_IGNORE_UNKNOWN, cfg->flags)) {
-					state = 10;
-					break;
-				}
+	return batch.cfgs;
+}
+
+/* snapshots */
+
+/*
+ * Atomic counters for cfg_live_t, with a global lock as fallback for
+ * compilers without the __atomic builtins.
+ */
+#ifdef __ATOMIC_SEQ_CST
+#define cfg_atomic_load(p)        __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define cfg_atomic_loadp(p)       __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define cfg_atomic_add(p, n)      __atomic_add_fetch(p, n, __ATOMIC_SEQ_CST)
+#define cfg_atomic_xchg(p, v)     __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#else
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t cfg_atomic_lock = PTHREAD_MUTEX_INITIALIZER;
+#define cfg_atomic_begin()        pthread_mutex_lock(&cfg_atomic_lock)
+#define cfg_atomic_end()          pthread_mutex_unlock(&cfg_atomic_lock)
+#else
+#define cfg_atomic_begin()
+#define cfg_atomic_end()
+#endif
+
+static unsigned long cfg_atomic_load(unsigned long *p)
+{
+	unsigned long v;
+
+	cfg_atomic_begin();
+	v = *p;
+	cfg_atomic_end();
+
+	return v;
+}
+
+static unsigned long cfg_atomic_add(unsigned long *p, long n)
+{
+	unsigned long v;
+
+	cfg_atomic_begin();
+	v = *p += n;
+	cfg_atomic_end();
+
+	return v;
+}
+
+static cfg_snapshot_t *cfg_atomic_loadp(cfg_snapshot_t **p)
+{
+	cfg_snapshot_t *v;
+
+	cfg_atomic_begin();
+	v = *p;
+	cfg_atomic_end();
+
+	return v;
+}
+
+static cfg_snapshot_t *cfg_atomic_xchg(cfg_snapshot_t **p, cfg_snapshot_t *v)
+{
+	cfg_snapshot_t *old;
+
+	cfg_atomic_begin();
+	old = *p;
+	*p = v;
+	cfg_atomic_end();
+
+	return old;
+}
+#endif
+
+struct cfg_snapshot_t {
+	cfg_t *cfg;
+	unsigned long refcount;
+};
+
+/*
+ * Readers announce themselves in the counter of the current epoch
+ * while they take a reference, a publisher bumps the epoch after the
+ * swap and waits for the counter of the previous epoch to drain.
+ */
+struct cfg_live_t {
+	cfg_snapshot_t *current;
+	unsigned long epoch;
+	unsigned long readers[2];
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t lock;	/* serializes publishers */
+#endif
+};
+
+/*
+ * Make a tree safe for concurrent readers: everything the getters
+ * would create on first use is created now.  Sections are marked after
+ * their children, creating a lazy section goes through cfg_setopt().
+ */
+static void cfg_freeze(cfg_t *cfg)
+{
+	cfg_opt_t *opt;
+
+	for (opt = cfg_firstopt(cfg); opt; opt = cfg_nextopt(opt)) {
+		unsigned int i = 0;
+		cfg_t *sec;
+
+		if (opt->type != CFGT_SEC)
+			continue;
+
+		while ((sec = cfg_opt_nextsec(opt, &i)) != NULL)
+			cfg_freeze(sec);
+		if (is_set(CFGF_TITLE, opt->flags) && !opt->index && opt->nvalues > 0)
+			cfg_index_titles(opt);
+	}
+
+	cfg->flags |= CFGF_FROZEN;
+}
+
+static cfg_snapshot_t *cfg_snapshot_new(cfg_t *cfg)
+{
+	cfg_snapshot_t *snap;
+
+	if (!cfg) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	snap = calloc(1, sizeof(cfg_snapshot_t));
+	if (!snap)
+		return NULL;
+
+	cfg_freeze(cfg);
+	snap->cfg = cfg;
+	snap->refcount = 1;
+
+	return snap;
+}
+
+DLLIMPORT cfg_live_t *cfg_live_new(cfg_t *cfg)
+{
+	cfg_live_t *live;
+
+	live = calloc(1, sizeof(cfg_live_t));
+	if (!live)
+		return NULL;
+
+#ifdef HAVE_PTHREAD_H
+	if (pthread_mutex_init(&live->lock, NULL)) {
+		free(live);
+		return NULL;
+	}
+#endif
+
+	live->current = cfg_snapshot_new(cfg);
+	if (!live->current) {
+		cfg_live_free(live);
+		return NULL;
+	}
+
+	return live;
+}
+
+DLLIMPORT int cfg_live_publish(cfg_live_t *live, cfg_t *cfg)
+{
+	cfg_snapshot_t *snap, *old;
+	unsigned long epoch;
+
+	if (!live) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	snap = cfg_snapshot_new(cfg);
+	if (!snap)
+		return CFG_FAIL;
+
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&live->lock);
+#endif
+	old = cfg_atomic_xchg(&live->current, snap);
+	epoch = cfg_atomic_add(&live->epoch, 1) - 1;
+
+	/* Readers of the previous epoch may still be about to take a
+	 * reference to the old snapshot, new ones only see the new one */
+	while (cfg_atomic_load(&live->readers[epoch & 1])) {
+#ifdef HAVE_PTHREAD_H
+		sched_yield();
+#endif
+	}
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&live->lock);
+#endif
+
+	cfg_snapshot_release(old);
+
+	return CFG_SUCCESS;
+}
+
+DLLIMPORT cfg_snapshot_t *cfg_live_acquire(cfg_live_t *live)
+{
+	cfg_snapshot_t *snap;
+	unsigned long epoch;
+
+	if (!live) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	while (1) {
+		epoch = cfg_atomic_load(&live->epoch);
+		cfg_atomic_add(&live->readers[epoch & 1], 1);
+		if (cfg_atomic_load(&live->epoch) == epoch)
+			break;
+
+		/* A publisher got in between, it may not wait for us */
+		cfg_atomic_add(&live->readers[epoch & 1], -1);
+	}
+
+	snap = cfg_atomic_loadp(&live->current);
+	cfg_atomic_add(&snap->refcount, 1);
+	cfg_atomic_add(&live->readers[epoch & 1], -1);
+
+	return snap;
+}
+
+DLLIMPORT void cfg_live_free(cfg_live_t *live)
+{
+	if (!live)
+		return;
+
+	cfg_snapshot_release(live->current);
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_destroy(&live->lock);
+#endif
+	free(live);
+}
+
+DLLIMPORT cfg_t *cfg_snapshot_cfg(cfg_snapshot_t *snap)
+{
+	if (!snap) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return snap->cfg;
+}
+
+DLLIMPORT void cfg_snapshot_release(cfg_snapshot_t *snap)
+{
+	if (!snap || cfg_atomic_add(&snap->refcount, -1))
+		return;
+
+	/* Frozen sections can only be freed */
+	cfg_free(snap->cfg);
+	free(snap);
+}
+
+/* binary cache */
+
+/*
+ * The cache is one flat image in native byte order, with 32-bit offsets
+ * from the start of the image instead of pointers: a header, the
+ * source files, and the records of the root section, its options,
+ * their values, and sub-sections after their parent.  Strings are
+ * stored once, NUL terminated, offset 0 is a NULL string.  Options
+ * still holding their defaults are left out.
+ */
+#define CFG_CACHE_MAGIC    "libconf\x01"
+#define CFG_CACHE_VERSION  1
+#define CFG_CACHE_ORDER    0x01020304
+#define CFG_CACHE_FLAGS    (CFGF_RESET | CFGF_MODIFIED | CFGF_COMMENTS)
+#define CFG_CACHE_AT(buf, off, type) ((type *)((char *)(buf) + (off)))
+
+struct cfg_cache_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t order;		/* CFG_CACHE_ORDER as written */
+	uint64_t size;		/* of the whole image */
+	int64_t stamp;		/* time written */
+	uint32_t nsources;	/* cfg_cache_src after the header */
+	uint32_t root;		/* cfg_cache_sec of the root section */
+};
+
+struct cfg_cache_src {
+	uint64_t size;
+	int64_t mtime;
+	uint64_t hash;
+	uint32_t name;
+	uint32_t reserved;
+};
+
+struct cfg_cache_sec {
+	uint32_t filename;
+	int32_t line;
+	uint32_t title;
+	uint32_t nopts;
+	uint32_t opts;		/* nopts cfg_cache_opt */
+	uint32_t reserved;
+};
+
+struct cfg_cache_opt {
+	uint32_t name;
+	uint32_t hint;		/* index in its section when written */
+	uint32_t type;
+	uint32_t flags;		/* CFG_CACHE_FLAGS of the option */
+	uint32_t comment;
+	uint32_t nvalues;
+	uint32_t values;	/* nvalues cfg_cache_val */
+	uint32_t reserved;
+};
+
+union cfg_cache_val {
+	int64_t number;
+	double fpnumber;
+	uint64_t offset;	/* string or cfg_cache_sec */
+};
+
+struct cfg_cache_writer {
+	char *buf;
+	size_t len;
+	size_t size;
+	uint32_t *strs;		/* offsets of the strings written */
+	unsigned int nstrs;
+	cfg_index_t *index;	/* of strs */
+};
+
+static int cfg_hash_file(const char *filename, uint64_t *hash, uint64_t *size)
+{
+	unsigned char buf[65536];
+	uint64_t h = 14695981039346656037ULL;	/* FNV-1a */
+	size_t i, n;
+	FILE *fp;
+
+	fp = fopen(filename, "rb");
+	if (!fp)
+		return CFG_FAIL;
+
+	*size = 0;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		for (i = 0; i < n; i++)
+			h = (h ^ buf[i]) * 1099511628211ULL;
+		*size += n;
+	}
+	if (ferror(fp)) {
+		fclose(fp);
+		return CFG_FAIL;
+	}
+	fclose(fp);
+	*hash = h;
+
+	return CFG_SUCCESS;
+}
+
+/* Reserve len zeroed bytes, aligned for the records */
+static int cfg_cache_reserve(struct cfg_cache_writer *w, size_t len, size_t align, uint32_t *off)
+{
+	size_t pos = (w->len + align - 1) & ~(align - 1);
+
+	if (pos + len > UINT32_MAX) {
+		errno = EFBIG;
+		return CFG_FAIL;
+	}
+
+	if (pos + len > w->size) {
+		size_t size = w->size ? w->size : 4096;
+		char *buf;
+
+		while (size < pos + len)
+			size *= 2;
+		buf = realloc(w->buf, size);
+		if (!buf)
+			return CFG_FAIL;
+		memset(buf + w->size, 0, size - w->size);
+		w->buf = buf;
+		w->size = size;
+	}
+
+	*off = (uint32_t)pos;
+	w->len = pos + len;
+
+	return CFG_SUCCESS;
+}
+
+static const char *cfg_cache_strkey(void *ctx, unsigned int elem)
+{
+	struct cfg_cache_writer *w = ctx;
+
+	return w->buf + w->strs[elem];
+}
+
+static int cfg_cache_putstr(struct cfg_cache_writer *w, const char *str, uint32_t *off)
+{
+	size_t len;
+	long int i;
+	uint32_t *strs;
+
+	*off = 0;
+	if (!str)
+		return CFG_SUCCESS;
+
+	len = strlen(str);
+	i = cfg_index_find(w->index, str, len, 0, cfg_cache_strkey, w);
+	if (i >= 0) {
+		*off = w->strs[i];
+		return CFG_SUCCESS;
+	}
+
+	if (cfg_cache_reserve(w, len + 1, 1, off))
+		return CFG_FAIL;
+	memcpy(w->buf + *off, str, len + 1);
+
+	strs = realloc(w->strs, (w->nstrs + 1) * sizeof(uint32_t));
+	if (!strs)
+		return CFG_FAIL;
+	w->strs = strs;
+	w->strs[w->nstrs] = *off;
+	if (cfg_index_add(w->index, str, w->nstrs, cfg_cache_strkey, w))
+		return CFG_FAIL;
+	w->nstrs++;
+
+	return CFG_SUCCESS;
+}
+
+/* Options that differ from a new section, with values as set by the user */
+static int cfg_cache_keep(cfg_opt_t *opt)
+{
+	switch (opt->type) {
+	case CFGT_SEC:
+		return opt->nvalues > 0;
+
+	case CFGT_INT:
+	case CFGT_FLOAT:
+	case CFGT_BOOL:
+	case CFGT_STR:
+	case CFGT_PTR:
+		return is_set(CFGF_MODIFIED, opt->flags) ||
+			(!is_set(CFGF_RESET, opt->flags) && opt->nvalues > 0);
+
+	default:
+		return 0;
+	}
+}
+
+static int cfg_cache_putsec(struct cfg_cache_writer *w, cfg_t *sec, uint32_t *secoff)
+{
+	uint32_t optoff = 0, filename, title;
+	struct cfg_cache_sec *rec;
+	unsigned int i, j, n = 0;
+	cfg_opt_t *opt;
+
+	for (opt = cfg_firstopt(sec); opt; opt = cfg_nextopt(opt))
+		n += cfg_cache_keep(opt);
+
+	if (cfg_cache_reserve(w, sizeof(struct cfg_cache_sec), 8, secoff) ||
+	    (n && cfg_cache_reserve(w, n * sizeof(struct cfg_cache_opt), 8, &optoff)) ||
+	    cfg_cache_putstr(w, sec->filename, &filename) ||
+	    cfg_cache_putstr(w, sec->title, &title))
+		return CFG_FAIL;
+
+	rec = CFG_CACHE_AT(w->buf, *secoff, struct cfg_cache_sec);
+	rec->filename = filename;
+	rec->line = sec->line;
+	rec->title = title;
+	rec->nopts = n;
+	rec->opts = optoff;
+
+	for (opt = cfg_firstopt(sec), i = 0; opt; opt = cfg_nextopt(opt)) {
+		uint32_t name, comment, ref, valoff = 0;
+		struct cfg_cache_opt *orec;
+		unsigned int nvalues;
+
+		if (!cfg_cache_keep(opt))
+			continue;
+
+		/* User-defined values cannot be stored */
+		if (opt->type == CFGT_PTR) {
+			errno = EINVAL;
+			return CFG_FAIL;
+		}
+
+		nvalues = opt->simple_value.ptr ? 1 : opt->nvalues;
+		if (cfg_cache_putstr(w, opt->name, &name) ||
+		    cfg_cache_putstr(w, opt->comment, &comment) ||
+		    (nvalues && cfg_cache_reserve(w, nvalues * sizeof(union cfg_cache_val), 8, &valoff)))
+			return CFG_FAIL;
+
+		for (j = 0; j < nvalues; j++) {
+			union cfg_cache_val val;
+
+			switch (opt->type) {
+			case CFGT_INT:
+				val.number = cfg_opt_getnint(opt, j);
+				break;
 
-				/* Not found, is it a dynamic key-value section? */
-				if (is_set(CFGF_KEYSTRVAL, cfg->flags)) {
-					opt = cfg_addopt(cfg, cfg_yylval);
-					if (!opt)
-						goto error;
+			case CFGT_FLOAT:
+				val.fpnumber = cfg_opt_getnfloat(opt, j);
+				break;
 
-					state = 1;
-					break;
-				}
+			case CFGT_BOOL:
+				val.number = cfg_opt_getnbool(opt, j);
+				break;
 
-				goto error;
-			}
+			case CFGT_STR:
+				if (cfg_cache_putstr(w, cfg_opt_getnstr(opt, j), &ref))
+					return CFG_FAIL;
+				val.offset = ref;
+				break;
 
-			if (opt->type == CFGT_SEC) {
-				if (is_set(CFGF_TITLE, opt->flags))
-					state = 6;
-				else
-					state = 5;
-			} else if (opt->type == CFGT_FUNC) {
-				state = 7;
-			} else {
-				state = 1;
+			default:
+				if (cfg_cache_putsec(w, cfg_opt_vals(opt)[j].section, &ref))
+					return CFG_FAIL;
+				val.offset = ref;
+				break;
 			}
-			break;
+			CFG_CACHE_AT(w->buf, valoff, union cfg_cache_val)[j] = val;
+		}
 
-		case 1:	/* expecting an equal sign or plus-equal sign */
-			if (!opt)
-				goto error;
+		orec = CFG_CACHE_AT(w->buf, optoff, struct cfg_cache_opt) + i++;
+		orec->name = name;
+		orec->hint = opt - sec->opts;
+		orec->type = opt->type;
+		orec->flags = opt->flags & CFG_CACHE_FLAGS;
+		orec->comment = comment;
+		orec->nvalues = nvalues;
+		orec->values = valoff;
+	}
 
-			if (tok == '+') {
-				if (!is_set(CFGF_LIST, opt->flags)) {
-					cfg_error(cfg, _("attempt to append to non-list option '%s'"), opt->name);
-					goto error;
-				}
-				/* Even if the reset flag was set by
-				 * cfg_init_defaults, appending to the defaults
-				 * should be ok.
-				 */
-				opt->flags &= ~CFGF_RESET;
-			} else if (tok == '=') {
-				/* set the (temporary) reset flag to clear the old
-				 * values, since we obviously didn't want to append */
-				opt->flags |= CFGF_RESET;
-			} else {
-				cfg_error(cfg, _("missing equal sign after option '%s'"), opt->name);
-				goto error;
-			}
+	return CFG_SUCCESS;
+}
 
-			opt->flags |= CFGF_MODIFIED;
+static int cfg_cache_write(struct cfg_cache_writer *w, cfg_t *cfg)
+{
+	cfg_schema_t *schema = cfg->schema;
+	struct cfg_cache_hdr *hdr;
+	uint32_t hdroff, srcoff = 0, root;
+	unsigned int i;
 
-			if (is_set(CFGF_LIST, opt->flags)) {
-				state = 3;
-				num_values = 0;
-			} else {
-				state = 2;
-			}
-			break;
+	if (cfg_cache_reserve(w, sizeof(struct cfg_cache_hdr), 8, &hdroff) ||
+	    (schema->nsources &&
+	     cfg_cache_reserve(w, schema->nsources * sizeof(struct cfg_cache_src), 8, &srcoff)))
+		return CFG_FAIL;
 
-		case 2:	/* expecting an option value */
-			if (tok == '}' && opt && is_set(CFGF_LIST, opt->flags)) {
-				state = 0;
-				if (num_values == 0 && is_set(CFGF_RESET, opt->flags))
-					/* Reset flags was set, and the empty list was
-					 * specified. Free all old values. */
-					cfg_free_value(opt);
-				break;
-			}
+	for (i = 0; i < schema->nsources; i++) {
+		cfg_source_t *src = &schema->sources[i];
+		struct cfg_cache_src *rec;
+		long long size, mtime;
+		uint64_t hash, len;
+		uint32_t name;
+
+		/* Changed since it was parsed, the tree is out of date */
+		if (src->mtime == -1 || cfg_stat_file(src->name, &size, &mtime) ||
+		    size != src->size || mtime != src->mtime ||
+		    cfg_hash_file(src->name, &hash, &len) || len != (uint64_t)size) {
+			errno = ESTALE;
+			return CFG_FAIL;
+		}
 
-			if (tok != CFGT_STR) {
-				cfg_error(cfg, _("unexpected token '%s'"), cfg_yylval);
-				goto error;
-			}
+		if (cfg_cache_putstr(w, src->name, &name))
+			return CFG_FAIL;
 
-			if (cfg_setopt(cfg, opt, cfg_yylval) == NULL)
-				goto error;
+		rec = CFG_CACHE_AT(w->buf, srcoff, struct cfg_cache_src) + i;
+		rec->size = size;
+		rec->mtime = mtime;
+		rec->hash = hash;
+		rec->name = name;
+	}
 
-			if (opt && opt->validcb && (*opt->validcb) (cfg, opt) != 0)
-				goto error;
+	if (cfg_cache_putsec(w, cfg, &root))
+		return CFG_FAIL;
 
-			/* Inherit last read comment */
-			cfg_opt_setcomment(opt, comment);
-			if (comment)
-				free(comment);
-			comment = NULL;
+	hdr = CFG_CACHE_AT(w->buf, hdroff, struct cfg_cache_hdr);
+	memcpy(hdr->magic, CFG_CACHE_MAGIC, sizeof(hdr->magic));
+	hdr->version = CFG_CACHE_VERSION;
+	hdr->order = CFG_CACHE_ORDER;
+	hdr->size = w->len;
+	hdr->stamp = time(NULL);
+	hdr->nsources = schema->nsources;
+	hdr->root = root;
 
-			if (opt && is_set(CFGF_LIST, opt->flags)) {
-				++num_values;
-				state = 4;
-			} else {
-				state = 0;
-			}
-			break;
+	return CFG_SUCCESS;
+}
 
-		case 3:	/* expecting an opening brace for a list option */
-			if (tok != '{') {
-				if (tok != CFGT_STR) {
-					cfg_error(cfg, _("unexpected token '%s'"), cfg_yylval);
-					goto error;
-				}
+/* Write to a temporary file renamed over the cache, which may be mapped */
+static int cfg_cache_store(const char *filename, const char *buf, size_t len)
+{
+	size_t n = strlen(filename);
+	char *tmp;
+	FILE *fp;
+	int ret;
 
-				if (cfg_setopt(cfg, opt, cfg_yylval) == NULL)
-					goto error;
-				if (opt && opt->validcb && (*opt->validcb) (cfg, opt) != 0)
-					goto error;
-				++num_values;
-				state = 0;
-			} else {
-				state = 2;
-			}
-			break;
+	tmp = malloc(n + 8);
+	if (!tmp)
+		return CFG_FAIL;
+	memcpy(tmp, filename, n);
+#ifdef HAVE_UNISTD_H
+	{
+		int fd;
+
+		memcpy(tmp + n, ".XXXXXX", 8);
+		fd = mkstemp(tmp);
+		fp = fd == -1 ? NULL : fdopen(fd, "wb");
+		if (fd != -1 && !fp)
+			close(fd);
+	}
+#else
+	memcpy(tmp + n, ".tmp", 5);
+	fp = fopen(tmp, "wb");
+#endif
+	if (!fp) {
+		free(tmp);
+		return CFG_FAIL;
+	}
 
-		case 4:	/* expecting a separator for a list option, or closing (list) brace */
-			if (tok == ',') {
-				state = 2;
-			} else if (tok == '}') {
-				state = 0;
-				if (opt && opt->validcb && (*opt->validcb) (cfg, opt) != 0)
-					goto error;
-			} else {
-				cfg_error(cfg, _("unexpected token '%s'"), cfg_yylval);
-				goto error;
-			}
-			break;
+	ret = fwrite(buf, 1, len, fp) != len;
+	ret |= fclose(fp) != 0;
+	if (!ret)
+		ret = rename(tmp, filename) != 0;
+	if (ret) {
+		remove(tmp);
+		ret = CFG_FAIL;
+	}
+	free(tmp);
 
-		case 5:	/* expecting an opening brace for a section */
-			if (tok != '{') {
-				cfg_error(cfg, _("missing opening brace for section '%s'"), opt ? opt->name : "");
-				goto error;
-			}
+	return ret;
+}
 
-			val = cfg_setopt(cfg, opt, opttitle);
-			if (!val)
-				goto error;
+DLLIMPORT int cfg_cache_save(cfg_t *cfg, const char *filename)
+{
+	struct cfg_cache_writer w;
+	int ret;
 
-			if (opttitle)
-				free(opttitle);
-			opttitle = NULL;
+	if (!cfg || !cfg->schema || !filename) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
 
-			val->section->path = cfg->path; /* Remember global search path */
-			val->section->line = cfg->line;
-			val->section->errfunc = cfg->errfunc;
-			rc = cfg_parse_internal(val->section, level + 1, -1, NULL);
-			if (rc != STATE_EOF)
-				goto error;
+	memset(&w, 0, sizeof(w));
+	w.index = cfg_index_new(NULL, 64);
+	if (!w.index)
+		return CFG_FAIL;
 
-			cfg->line = val->section->line;
-			if (opt && opt->validcb && (*opt->validcb) (cfg, opt) != 0)
-				goto error;
-			state = 0;
-			break;
+	ret = cfg_cache_write(&w, cfg);
+	if (!ret)
+		ret = cfg_cache_store(filename, w.buf, w.len);
 
-		case 6:	/* expecting a title for a section */
-			if (tok != CFGT_STR) {
-				cfg_error(cfg, _("missing title for section '%s'"), opt ? opt->name : "");
-				goto error;
-			} else {
-				opttitle = strdup(cfg_yylval);
-				if (!opttitle)
-					goto error;
-			}
-			state = 5;
-			break;
+	cfg_index_free(w.index);
+	free(w.strs);
+	free(w.buf);
 
-		case 7:	/* expecting an opening parenthesis for a function */
-			if (tok != '(') {
-				cfg_error(cfg, _("missing parenthesis for function '%s'"), opt ? opt->name : "");
-				goto error;
-			}
-			state = 8;
-			break;
+	return ret;
+}
 
-		case 8:	/* expecting a function parameter or a closing paren */
-			if (tok == ')') {
-				if (call_function(cfg, opt, &funcopt))
-					goto error;
-				state = 0;
-			} else if (tok == CFGT_STR) {
-				val = cfg_addval(&funcopt);
-				if (!val)
-					goto error;
+/* Records and strings of a cache image, checked against its size */
+static const void *cfg_cache_rec(const cfg_image_t *img, uint32_t off, size_t size, uint32_t count)
+{
+	if (off % 8 || off > img->size || count > (img->size - off) / size)
+		return NULL;
 
-				val->string = strdup(cfg_yylval);
-				if (!val->string)
-					goto error;
+	return (const char *)img->addr + off;
+}
 
-				state = 9;
-			} else {
-				cfg_error(cfg, _("syntax error in call of function '%s'"), opt ? opt->name : "");
-				goto error;
-			}
-			break;
+static int cfg_cache_strok(const cfg_image_t *img, uint32_t off)
+{
+	return off == 0 || (off < img->size && memchr((const char *)img->addr + off, 0, img->size - off));
+}
 
-		case 9:	/* expecting a comma in a function or a closing paren */
-			if (tok == ')') {
-				if (call_function(cfg, opt, &funcopt))
-					goto error;
-				state = 0;
-			} else if (tok == ',') {
-				state = 8;
-			} else {
-				cfg_error(cfg, _("syntax error in call of function '%s'"), opt ? opt->name : "");
-				goto error;
-			}
-			break;
+static const char *cfg_cache_str(const cfg_image_t *img, uint32_t off)
+{
+	return off ? (const char *)img->addr + off : NULL;
+}
 
-		case 10: /* unknown option, mini-discard parser states: 10-15 */
-			if (comment) {
-				free(comment);
-				comment = NULL;
-			}
+/* Find a schema option by name, at the index it was written at if possible */
+static cfg_opt_t *cfg_cache_findopt(cfg_opt_t *opts, unsigned int nopts, uint32_t hint,
+				    const char *name, int nocase)
+{
+	unsigned int i;
 
-			if (tok == '+') {
-				ignore = '=';
-				state = 13; /* Append to list, should be followed by '=' */
-			} else if (tok == '=') {
-				ignore = 0;
-				state = 14; /* Assignment, regular handling */
-			} else if (tok == '(') {
-				ignore = ')';
-				state = 13; /* Function, ignore until end of param list */
-			} else if (tok == '{') {
-				state = 12; /* Section, ignore all until closing brace */
-			} else if (tok == CFGT_STR) {
-				state = 11; /* No '=' ... must be a titled section */
-			} else if (tok == '}' && force_state == 10) {
-				if (comment)
-					free(comment);
+	if (hint < nopts && strcmp(opts[hint].name, name) == 0)
+		return &opts[hint];
 
-				return STATE_CONTINUE;
-			}
-			break;
+	for (i = 0; i < nopts; i++) {
+		if (cfg_keyncmp(opts[i].name, name, strlen(name), nocase) == 0)
+			return &opts[i];
+	}
 
-		case 11: /* unknown option, expecting start of title section */
-			if (tok != '{') {
-				cfg_error(cfg, _("unexpected token '%s'"), cfg_yylval);
-				goto error;
-			}
-			state = 12;
-			break;
+	return NULL;
+}
 
-		case 12: /* unknown option, recursively ignore entire sub-section */
-			rc = cfg_parse_internal(cfg, level + 1, 10, NULL);
-			if (rc != STATE_CONTINUE)
-				goto error;
-			ignore = '}';
-			state = 13;
-			break;
+/*
+ * Check a section record against the options of its schema, before
+ * anything is loaded.  Sub-sections always come after their parent,
+ * which rules out cycles.
+ */
+static int cfg_cache_checksec(const cfg_image_t *img, uint32_t off, uint32_t parent,
+			      cfg_opt_t *opts, int keystrval, int nocase)
+{
+	const struct cfg_cache_sec *rec;
+	const struct cfg_cache_opt *orecs;
+	unsigned int i, j, nopts = cfg_numopts(opts);
+
+	rec = cfg_cache_rec(img, off, sizeof(*rec), 1);
+	if (!rec || off <= parent || !cfg_cache_strok(img, rec->filename) || !cfg_cache_strok(img, rec->title))
+		return CFG_FAIL;
 
-		case 13: /* unknown option, consume tokens silently until end of func/list */
-			if (tok != ignore)
-				break;
+	orecs = cfg_cache_rec(img, rec->opts, sizeof(*orecs), rec->nopts);
+	if (!orecs)
+		return CFG_FAIL;
 
-			if (ignore == '=') {
-				ignore = 0;
-				state = 14;
-				break;
-			}
+	for (i = 0; i < rec->nopts; i++) {
+		const struct cfg_cache_opt *orec = &orecs[i];
+		const union cfg_cache_val *vals;
+		cfg_flag_t flags = 0;
+		cfg_opt_t *opt = NULL;
 
-			/* Are we done with recursive ignore of sub-section? */
-			if (force_state == 10) {
-				if (comment)
-					free(comment);
+		if (!orec->name || !cfg_cache_strok(img, orec->name) || !cfg_cache_strok(img, orec->comment))
+			return CFG_FAIL;
 
-				return STATE_CONTINUE;
-			}
+		if (opts)
+			opt = cfg_cache_findopt(opts, nopts, orec->hint, cfg_cache_str(img, orec->name), nocase);
+		if (opt) {
+			if (opt->type != orec->type)
+				return CFG_FAIL;
+			flags = opt->flags;
+		} else if (!keystrval || orec->type != CFGT_STR) {
+			return CFG_FAIL;
+		}
 
-			ignore = 0;
-			state = 0;
-			break;
+		if (orec->nvalues > 1 && !(flags & (CFGF_LIST | CFGF_MULTI)))
+			return CFG_FAIL;
 
-		case 14: /* unknown option, assuming value or start of list */
-			if (tok == '{') {
-				ignore = '}';
-				state = 13;
+		vals = cfg_cache_rec(img, orec->values, sizeof(*vals), orec->nvalues);
+		if (!vals)
+			return CFG_FAIL;
+
+		for (j = 0; j < orec->nvalues; j++) {
+			switch (orec->type) {
+			case CFGT_INT:
+			case CFGT_FLOAT:
+			case CFGT_BOOL:
 				break;
-			}
 
-			if (tok != CFGT_STR) {
-				cfg_error(cfg, _("unexpected token '%s'"), cfg_yylval);
-				goto error;
-			}
+			case CFGT_STR:
+				if (vals[j].offset > UINT32_MAX || !cfg_cache_strok(img, vals[j].offset))
+					return CFG_FAIL;
+				break;
 
-			ignore = 0;
-			if (force_state == 10)
-				state = 15;
-			else
-				state = 0;
-			break;
+			case CFGT_SEC:
+				if (vals[j].offset > UINT32_MAX ||
+				    cfg_cache_checksec(img, vals[j].offset, off, opt->subopts,
+						       is_set(CFGF_KEYSTRVAL, opt->flags), nocase))
+					return CFG_FAIL;
 
-		case 15: /* unknown option, dummy read of next parameter in sub-section */
-			state = 10;
-			break;
+				/* Only the first of several sections may be untitled */
+				if (is_set(CFGF_TITLE, opt->flags) && j > 0 &&
+				    !CFG_CACHE_AT(img->addr, vals[j].offset, const struct cfg_cache_sec)->title)
+					return CFG_FAIL;
+				break;
 
-		default:
-			cfg_error(cfg, _("Internal error in cfg_parse_internal(), unknown state %d"), state);
-			goto error;
+			default:
+				return CFG_FAIL;
+			}
 		}
 	}
 
-	if (comment)
-		free(comment);
+	return CFG_SUCCESS;
+}
 
-	return STATE_EOF;
+/*
+ * A file changed in the second the cache was written may still have
+ * the same modification time, and is hashed like any other change.
+ */
+static int cfg_cache_fresh(const cfg_image_t *img, const struct cfg_cache_src *src, int64_t stamp)
+{
+	const char *name = cfg_cache_str(img, src->name);
+	long long size, mtime;
+	uint64_t hash, len;
 
-error:
-	if (opttitle)
-		free(opttitle);
-	if (comment)
-		free(comment);
+	if (!name)
+		return 0;
 
-	return STATE_ERROR;
+	if (!cfg_stat_file(name, &size, &mtime)) {
+		if ((uint64_t)size != src->size)
+			return 0;
+		if (mtime == src->mtime && mtime < stamp)
+			return 1;
+	}
+
+	if (cfg_hash_file(name, &hash, &len))
+		return 0;
+
+	return len == src->size && hash == src->hash;
 }
 
-DLLIMPORT int cfg_parse_fp(cfg_t *cfg, FILE *fp)
+static int cfg_cache_check(cfg_t *cfg, const cfg_image_t *img, const char *source)
 {
-	int ret;
+	const struct cfg_cache_hdr *hdr;
+	const struct cfg_cache_src *srcs;
+	unsigned int i;
 
-	if (!cfg || !fp) {
-		errno = EINVAL;
-		return CFG_PARSE_ERROR;
+	hdr = cfg_cache_rec(img, 0, sizeof(*hdr), 1);
+	if (!hdr || memcmp(hdr->magic, CFG_CACHE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != CFG_CACHE_VERSION || hdr->order != CFG_CACHE_ORDER || hdr->size != img->size)
+		goto corrupt;
+
+	srcs = cfg_cache_rec(img, sizeof(*hdr), sizeof(*srcs), hdr->nsources);
+	if (!srcs)
+		goto corrupt;
+	for (i = 0; i < hdr->nsources; i++) {
+		if (!srcs[i].name || !cfg_cache_strok(img, srcs[i].name))
+			goto corrupt;
 	}
 
-	if (!cfg->filename)
-		cfg->filename = strdup("FILE");
-	if (!cfg->filename)
-		return CFG_PARSE_ERROR;
+	/* A cache of another file */
+	if (source && (!hdr->nsources || strcmp(cfg_cache_str(img, srcs[0].name), source))) {
+		errno = ESTALE;
+		return CFG_FAIL;
+	}
 
-	cfg->line = 1;
-	cfg_scan_fp_begin(fp);
-	ret = cfg_parse_internal(cfg, 0, -1, NULL);
-	cfg_scan_fp_end();
-	if (ret == STATE_ERROR)
-		return CFG_PARSE_ERROR;
+	if (cfg_cache_checksec(img, hdr->root, 0, cfg->opts, is_set(CFGF_KEYSTRVAL, cfg->flags),
+			       is_set(CFGF_NOCASE, cfg->flags)))
+		goto corrupt;
+
+	for (i = 0; i < hdr->nsources; i++) {
+		if (!cfg_cache_fresh(img, &srcs[i], hdr->stamp)) {
+			errno = ESTALE;
+			return CFG_FAIL;
+		}
+	}
 
 	return CFG_SUCCESS;
+
+corrupt:
+	errno = EINVAL;
+	return CFG_FAIL;
 }
 
-static char *cfg_make_fullpath(const char *dir, const char *file)
+static cfg_opt_t *cfg_cache_getopt(cfg_t *sec, const char *name, uint32_t hint)
 {
-	int np;
-	char *path;
-	size_t len;
+	cfg_opt_t *opt;
 
-	if (!dir || !file) {
-		errno = EINVAL;
-		return NULL;
+	if (hint < cfg_num(sec) && strcmp(sec->opts[hint].name, name) == 0)
+		return &sec->opts[hint];
+
+	opt = cfg_getopt_leaf(sec, name, strlen(name));
+	if (!opt)
+		opt = cfg_addopt(sec, (char *)name);
+
+	return opt;
+}
+
+/*
+ * Load a checked section record into sec, like the parser would.  With
+ * CFGF_ARENA string values are not copied, they point into the image.
+ */
+static int cfg_cache_loadsec(const cfg_image_t *img, uint32_t off, cfg_t *sec, int inplace)
+{
+	const struct cfg_cache_sec *rec = CFG_CACHE_AT(img->addr, off, const struct cfg_cache_sec);
+	const struct cfg_cache_opt *orecs = CFG_CACHE_AT(img->addr, rec->opts, const struct cfg_cache_opt);
+	const char *filename = cfg_cache_str(img, rec->filename);
+	unsigned int i, j;
+
+	if (filename && (!sec->filename || strcmp(sec->filename, filename))) {
+		char *dup = cfg_strdup(cfg_self_arena(sec), filename);
+
+		if (!dup)
+			return CFG_FAIL;
+		cfg_dealloc(cfg_self_arena(sec), sec->filename);
+		sec->filename = dup;
 	}
+	sec->line = rec->line;
 
-	len = strlen(dir) + strlen(file) + 2;
-	path = malloc(len);
-	if (!path)
-		return NULL;
+	for (i = 0; i < rec->nopts; i++) {
+		const struct cfg_cache_opt *orec = &orecs[i];
+		const union cfg_cache_val *vals = CFG_CACHE_AT(img->addr, orec->values, const union cfg_cache_val);
+		const char *comment = cfg_cache_str(img, orec->comment);
+		cfg_opt_t *opt;
 
-	np = snprintf(path, len, "%s/%s", dir, file);
+		opt = cfg_cache_getopt(sec, cfg_cache_str(img, orec->name), orec->hint);
+		if (!opt)
+			return CFG_FAIL;
 
-	/*
-	 * np is the number of characters that would have
-	 * been printed if there was enough room in path.
-	 * if np >= n then the snprintf() was truncated
-	 * (which must be a bug).
-	 */
-	assert(np < (int)len);
+		if (opt->type == CFGT_SEC) {
+			for (j = 0; j < orec->nvalues; j++) {
+				const struct cfg_cache_sec *srec;
+				cfg_value_t *val;
+
+				srec = CFG_CACHE_AT(img->addr, vals[j].offset, const struct cfg_cache_sec);
+				val = cfg_setopt(sec, opt, cfg_cache_str(img, srec->title));
+				if (!val || cfg_cache_loadsec(img, vals[j].offset, val->section, inplace))
+					return CFG_FAIL;
+			}
+		} else {
+			if (!opt->simple_value.ptr)
+				cfg_clear_values(opt);
 
-	return path;
+			for (j = 0; j < orec->nvalues; j++) {
+				cfg_value_t value, *val;
+
+				switch (opt->type) {
+				case CFGT_INT:
+					value.number = vals[j].number;
+					break;
+
+				case CFGT_FLOAT:
+					value.fpnumber = vals[j].fpnumber;
+					break;
+
+				case CFGT_BOOL:
+					value.boolean = vals[j].number ? cfg_true : cfg_false;
+					break;
+
+				default:
+					value.string = (char *)cfg_cache_str(img, vals[j].offset);
+					if (inplace && !opt->simple_value.ptr) {
+						val = cfg_opt_getval(opt, j);
+						if (!val)
+							return CFG_FAIL;
+						val->string = value.string;
+						continue;
+					}
+					break;
+				}
+
+				if (cfg_opt_setnval(opt, opt->type, value, j, 0))
+					return CFG_FAIL;
+			}
+		}
+
+		if (comment) {
+			char *dup = cfg_strdup(cfg_opt_arena(opt), comment);
+
+			if (!dup)
+				return CFG_FAIL;
+			cfg_dealloc(cfg_opt_arena(opt), opt->comment);
+			opt->comment = dup;
+		}
+		opt->flags &= ~CFG_CACHE_FLAGS;
+		opt->flags |= orec->flags & CFG_CACHE_FLAGS;
+	}
+
+	return CFG_SUCCESS;
 }
 
-DLLIMPORT char *cfg_searchpath(cfg_searchpath_t *p, const char *file)
+static int cfg_cache_map(cfg_image_t *img, const char *filename)
 {
-	char *fullpath;
 #ifdef HAVE_SYS_STAT_H
 	struct stat st;
-	int err;
 #endif
+	size_t len = 0, n;
+	char *buf = NULL;
+	FILE *fp;
 
-	if (!p || !file) {
-		errno = EINVAL;
-		return NULL;
-	}
+	memset(img, 0, sizeof(*img));
+	fp = fopen(filename, "rb");
+	if (!fp)
+		return CFG_FAIL;
 
-	if (file[0] == '/') {
-		fullpath = strdup(file);
-		if (!fullpath)
-			return NULL;
-		goto check;
+#if defined(HAVE_SYS_STAT_H) && defined(HAVE_SYS_MMAN_H)
+	if (!fstat(fileno(fp), &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+	    (unsigned long long)st.st_size <= UINT32_MAX) {
+		/* Private and writable, string values may point into it */
+		img->addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+		if (img->addr != MAP_FAILED) {
+			img->size = st.st_size;
+			img->mapped = 1;
+			fclose(fp);
+			return CFG_SUCCESS;
+		}
+		img->addr = NULL;
 	}
+#endif
 
-	if ((fullpath = cfg_searchpath(p->next, file)) != NULL)
-		return fullpath;
+	do {
+		char *tmp = realloc(buf, len + 65536);
 
-	if ((fullpath = cfg_make_fullpath(p->dir, file)) == NULL)
-		return NULL;
+		if (!tmp) {
+			free(buf);
+			fclose(fp);
+			return CFG_FAIL;
+		}
+		buf = tmp;
+		n = fread(buf + len, 1, 65536, fp);
+		len += n;
+	} while (n > 0 && len <= UINT32_MAX);
+
+	if (ferror(fp)) {
+		free(buf);
+		fclose(fp);
+		return CFG_FAIL;
+	}
+	fclose(fp);
 
-check:
-#ifdef HAVE_SYS_STAT_H
-	err = stat((const char *)fullpath, &st);
-	if ((!err) && S_ISREG(st.st_mode))
-		return fullpath;
-#else
-	/* needs an alternative check here for win32 */
-#endif
+	img->addr = buf;
+	img->size = len;
 
-	free(fullpath);
-	return NULL;
+	return CFG_SUCCESS;
 }
 
-DLLIMPORT int cfg_parse(cfg_t *cfg, const char *filename)
+/* Remember the files the image was made from, to save it again */
+static void cfg_cache_sources(cfg_t *cfg, const cfg_image_t *img)
 {
-	int ret;
-	char *fn;
-	FILE *fp;
+	const struct cfg_cache_hdr *hdr = img->addr;
+	const struct cfg_cache_src *srcs = CFG_CACHE_AT(img->addr, sizeof(*hdr), const struct cfg_cache_src);
+	cfg_schema_t *schema = cfg->schema;
+	unsigned int i, j;
+
+	for (i = 0; i < hdr->nsources; i++) {
+		const char *name = cfg_cache_str(img, srcs[i].name);
+
+		cfg_add_source(cfg, name);
+		for (j = 0; j < schema->nsources; j++) {
+			if (strcmp(schema->sources[j].name, name) == 0) {
+				schema->sources[j].size = srcs[i].size;
+				schema->sources[j].mtime = srcs[i].mtime;
+			}
+		}
+	}
+}
 
-	if (!cfg || !filename) {
+static int cfg_cache_load_source(cfg_t *cfg, const char *filename, const char *source)
+{
+	const struct cfg_cache_hdr *hdr;
+	cfg_image_t img, *keep;
+	int inplace, ret;
+
+	if (!cfg || !cfg->schema || !filename) {
 		errno = EINVAL;
 		return CFG_FILE_ERROR;
 	}
 
-	if (cfg->path)
-		fn = cfg_searchpath(cfg->path, filename);
-	else
-		fn = cfg_tilde_expand(filename);
-	if (!fn)
+	if (cfg_frozen(cfg) || cfg_cache_map(&img, filename))
 		return CFG_FILE_ERROR;
 
-	free(cfg->filename);
-	cfg->filename = fn;
+	if (cfg_cache_check(cfg, &img, source)) {
+		int err = errno;
 
-	fp = fopen(cfg->filename, "r");
-	if (!fp)
+		cfg_image_free(&img);
+		errno = err;
 		return CFG_FILE_ERROR;
+	}
 
-	ret = cfg_parse_fp(cfg, fp);
-	fclose(fp);
+	/* The image outlives the load if string values point into it */
+	keep = NULL;
+	inplace = cfg_arena(cfg) != NULL;
+	if (inplace) {
+		keep = malloc(sizeof(cfg_image_t));
+		if (!keep)
+			inplace = 0;
+	}
 
-	return ret;
+	hdr = img.addr;
+	ret = cfg_cache_loadsec(&img, hdr->root, cfg, inplace);
+	if (!ret)
+		cfg_cache_sources(cfg, &img);
+
+	if (keep) {
+		*keep = img;
+		keep->next = cfg->schema->images;
+		cfg->schema->images = keep;
+	} else {
+		cfg_image_free(&img);
+	}
+
+	return ret ? CFG_PARSE_ERROR : CFG_SUCCESS;
 }
 
-DLLIMPORT int cfg_parse_buf(cfg_t *cfg, const char *buf)
+DLLIMPORT int cfg_cache_load(cfg_t *cfg, const char *filename)
+{
+	return cfg_cache_load_source(cfg, filename, NULL);
+}
+
+DLLIMPORT int cfg_parse_cached(cfg_t *cfg, const char *filename, const char *cachefile)
 {
+	char *source;
 	int ret;
-	char *fn;
-	FILE *fp;
 
-	if (!cfg) {
+	if (!cfg || !filename || !cachefile) {
 		errno = EINVAL;
-		return CFG_PARSE_ERROR;
+		return CFG_FILE_ERROR;
 	}
 
-	if (!buf)
-		return CFG_SUCCESS;
-
-	fn = strdup("[buf]");
-	if (!fn)
-		return CFG_PARSE_ERROR;
-
-	free(cfg->filename);
-	cfg->filename = fn;
-
-	fp = fmemopen((void *)buf, strlen(buf), "r");
-	if (!fp) {
-		/*
-		 * fmemopen() on older GLIBC versions do not accept zero
-		 * length buffers for some reason.  This is a workaround.
-		 */
-		if (strlen(buf) > 0)
-			return CFG_FILE_ERROR;
-
-		return CFG_SUCCESS;
+	source = cfg_resolve_file(cfg, filename);
+	if (source) {
+		ret = cfg_cache_load_source(cfg, cachefile, source);
+		free(source);
+		if (ret != CFG_FILE_ERROR)
+			return ret;
 	}
 
-	ret = cfg_parse_fp(cfg, fp);
-	fclose(fp);
+	ret = cfg_parse(cfg, filename);
+	if (ret == CFG_SUCCESS)
+		cfg_cache_save(cfg, cachefile);
 
 	return ret;
 }
 
-DLLIMPORT cfg_t *cfg_init(cfg_opt_t *opts, cfg_flag_t flags)
+#ifndef _WIN32
+/*
+ * Home directory of user, or of the effective user if NULL, or NULL if
+ * not found.  cfg_parse_files() expands tildes on worker threads, so
+ * use the reentrant lookups where available.
+ */
+static char *cfg_home_dir(const char *user)
 {
-	cfg_t *cfg;
-
-	cfg = calloc(1, sizeof(cfg_t));
-	if (!cfg)
-		return NULL;
-
-	cfg->name = strdup("root");
-	if (!cfg->name) {
-		free(cfg);
-		return NULL;
-	}
+#if defined(HAVE_GETPWNAM_R) && defined(HAVE_GETPWUID_R)
+	struct passwd pwd, *passwd = NULL;
+	size_t len = 1024;
+	char *buf = NULL, *dir = NULL;
+	int rc;
 
-	cfg->opts = cfg_dupopt_array(opts);
-	if (!cfg->opts) {
-		free(cfg->name);
-		free(cfg);
-		return NULL;
-	}
+	do {
+		char *tmp = realloc(buf, len);
 
-	cfg->flags = flags;
-	cfg->filename = NULL;
-	cfg->line = 0;
-	cfg->errfunc = NULL;
+		if (!tmp)
+			break;
+		buf = tmp;
+		if (user)
+			rc = getpwnam_r(user, &pwd, buf, len, &passwd);
+		else
+			rc = getpwuid_r(geteuid(), &pwd, buf, len, &passwd);
+		len *= 2;
+	} while (rc == ERANGE && len <= 1024 * 1024);
 
-#if defined(ENABLE_NLS) && defined(HAVE_GETTEXT)
-	bindtextdomain(PACKAGE, LOCALEDIR);
-#endif
+	if (passwd)
+		dir = strdup(passwd->pw_dir);
+	free(buf);
 
-	cfg_init_defaults(cfg);
+	return dir;
+#else
+	struct passwd *passwd;
 
-	return cfg;
+	if (user)
+		passwd = getpwnam(user);
+	else
+		passwd = getpwuid(geteuid());
+
+	return passwd ? strdup(passwd->pw_dir) : NULL;
+#endif
 }
+#endif
 
 DLLIMPORT char *cfg_tilde_expand(const char *filename)
 {
@@ -1886,12 +5025,12 @@ DLLIMPORT char *cfg_tilde_expand(const char *filename)
 #ifndef _WIN32
 	/* Do tilde expansion */
 	if (filename[0] == '~') {
-		struct passwd *passwd = NULL;
 		const char *file = NULL;
+		char *home;
 
 		if (filename[1] == '/' || filename[1] == 0) {
 			/* ~ or ~/path */
-			passwd = getpwuid(geteuid());
+			home = cfg_home_dir(NULL);
 			file = filename + 1;
 		} else {
 			char *user; /* ~user or ~user/path */
@@ -1908,17 +5047,20 @@ DLLIMPORT char *cfg_tilde_expand(const char *filename)
 
 			strncpy(user, &filename[1], len);
 			user[len] = 0;
-			passwd = getpwnam(user);
+			home = cfg_home_dir(user);
 			free(user);
 		}
 
-		if (passwd) {
-			expanded = malloc(strlen(passwd->pw_dir) + strlen(file) + 1);
-			if (!expanded)
+		if (home) {
+			expanded = malloc(strlen(home) + strlen(file) + 1);
+			if (!expanded) {
+				free(home);
 				return NULL;
+			}
 
-			strcpy(expanded, passwd->pw_dir);
+			strcpy(expanded, home);
 			strcat(expanded, file);
+			free(home);
 		}
 	}
 #endif
@@ -1928,39 +5070,88 @@ DLLIMPORT char *cfg_tilde_expand(const char *filename)
 	return expanded;
 }
 
-DLLIMPORT int cfg_free_value(cfg_opt_t *opt)
+/* Release the values in slots first up to, but not including, last */
+static void cfg_release_values(cfg_opt_t *opt, unsigned int first, unsigned int last)
 {
-	if (!opt) {
-		errno = EINVAL;
-		return CFG_FAIL;
+	cfg_arena_t *arena = cfg_opt_arena(opt);
+	cfg_value_t *vals;
+	unsigned int i;
+
+	if (first >= last)
+		return;
+
+	vals = cfg_opt_vals(opt);
+	for (i = first; i < last; i++) {
+		if (opt->type == CFGT_STR) {
+			cfg_dealloc(arena, vals[i].string);
+		} else if (opt->type == CFGT_SEC) {
+			vals[i].section->path = NULL; /* Global search path */
+			cfg_free(vals[i].section);
+		} else if (opt->type == CFGT_PTR && opt->freecb && vals[i].ptr) {
+			(opt->freecb) (vals[i].ptr);
+		}
+	}
+}
+
+/* Release all values, but keep the value array for reuse */
+static void cfg_clear_values(cfg_opt_t *opt)
+{
+	unsigned int n = cfg_opt_nslots(opt);
+
+	cfg_release_values(opt, 0, n);
+	if (n && opt->type == CFGT_SEC)
+		opt->gen++;
+
+	cfg_index_free(opt->index);
+	opt->index   = NULL;
+	opt->nvalues = 0;
+	opt->nold    = 0;
+}
+
+/* Release the previous values cfg_reparse() did not recycle */
+static void cfg_opt_trim(cfg_opt_t *opt)
+{
+	if (opt->nold > opt->nvalues) {
+		cfg_release_values(opt, opt->nvalues, opt->nold);
+		if (opt->type == CFGT_SEC) {
+			/* The index still points to released sections */
+			cfg_index_free(opt->index);
+			opt->index = NULL;
+			opt->gen++;
+		}
 	}
+	opt->nold = 0;
+}
 
+static int cfg_free_value_internal(cfg_opt_t *opt)
+{
+	cfg_arena_t *arena;
+
+	arena = cfg_opt_arena(opt);
 	if (opt->comment && !is_set(CFGF_RESET, opt->flags)) {
-		free(opt->comment);
+		cfg_dealloc(arena, opt->comment);
 		opt->comment = NULL;
 	}
 
-	if (opt->values) {
-		unsigned int i;
+	cfg_clear_values(opt);
+	cfg_dealloc(arena, opt->values);
+	opt->values = NULL;
+	opt->nalloc = 0;
 
-		for (i = 0; i < opt->nvalues; i++) {
-			if (opt->type == CFGT_STR) {
-				free((void *)opt->values[i]->string);
-			} else if (opt->type == CFGT_SEC) {
-				opt->values[i]->section->path = NULL; /* Global search path */
-				cfg_free(opt->values[i]->section);
-			} else if (opt->type == CFGT_PTR && opt->freecb && opt->values[i]->ptr) {
-				(opt->freecb) (opt->values[i]->ptr);
-			}
-			free(opt->values[i]);
-		}
-		free(opt->values);
+	return CFG_SUCCESS;
+}
+
+DLLIMPORT int cfg_free_value(cfg_opt_t *opt)
+{
+	if (!opt) {
+		errno = EINVAL;
+		return CFG_FAIL;
 	}
 
-	opt->values  = NULL;
-	opt->nvalues = 0;
+	if (cfg_frozen(opt->owner))
+		return CFG_FAIL;
 
-	return CFG_SUCCESS;
+	return cfg_free_value_internal(opt);
 }
 
 static void cfg_free_opt_array(cfg_opt_t *opts)
@@ -1977,6 +5168,8 @@ static void cfg_free_opt_array(cfg_opt_t *opts)
 			free((void *)opts[i].def.string);
 		if (opts[i].subopts)
 			cfg_free_opt_array(opts[i].subopts);
+		cfg_clear_values(&opts[i]);
+		free(opts[i].values);
 	}
 	free(opts);
 }
@@ -1994,35 +5187,45 @@ static int cfg_free_searchpath(cfg_searchpath_t *p)
 
 DLLIMPORT int cfg_free(cfg_t *cfg)
 {
-	int i;
-	int isroot = 0;
+	cfg_arena_t *arena;
+	cfg_opt_t *opt;
 
 	if (!cfg) {
 		errno = EINVAL;
 		return CFG_FAIL;
 	}
 
-	if (cfg->comment)
-		free(cfg->comment);
+	/*
+	 * In arena mode sections are released with the arena, values only
+	 * need to be visited to call free callbacks.  The root itself is
+	 * allocated from the heap.
+	 */
+	arena = cfg_arena(cfg);
+	if (!arena || cfg->schema->freecb) {
+		for (opt = cfg_firstopt(cfg); opt; opt = cfg_nextopt(opt))
+			cfg_free_value_internal(opt);
+	}
 
-	for (i = 0; cfg->opts[i].name; ++i)
-		cfg_free_value(&cfg->opts[i]);
+	if (arena && cfg != cfg->schema->root)
+		return CFG_SUCCESS;
 
-	cfg_free_opt_array(cfg->opts);
+	if (!arena) {
+		if (cfg->comment)
+			free(cfg->comment);
+		cfg_free_instopt_array(NULL, cfg->opts);
+		cfg_index_free(cfg->index);
+		if (cfg->title)
+			free(cfg->title);
+	}
+	cfg_schema_put(cfg->schema);
 	cfg_free_searchpath(cfg->path);
 
-	if (cfg->name) {
-		isroot = !strcmp(cfg->name, "root");
+	if (cfg->name)
 		free(cfg->name);
-	}
-	if (cfg->title)
-		free(cfg->title);
 	if (cfg->filename)
 		free(cfg->filename);
 
 	free(cfg);
-	if (isroot)
-		cfg_yylex_destroy();
 
 	return CFG_SUCCESS;
 }
@@ -2041,7 +5244,13 @@ DLLIMPORT int cfg_include(cfg_t *cfg, cfg_opt_t *opt, int argc, const char **arg
 		return 1;
 	}
 
-	return cfg_lexer_include(cfg, argv[0]);
+	if (cfg_lexer_include(cfg, argv[0]))
+		return CFG_PARSE_ERROR;
+
+	/* Now the name of the included file */
+	cfg_add_source(cfg, cfg->filename);
+
+	return CFG_SUCCESS;
 }
 
 static cfg_value_t *cfg_opt_getval(cfg_opt_t *opt, unsigned int index)
@@ -2053,18 +5262,21 @@ static cfg_value_t *cfg_opt_getval(cfg_opt_t *opt, unsigned int index)
 		return NULL;
 	}
 
+	if (cfg_frozen(opt->owner))
+		return NULL;
+
 	if (opt->simple_value.ptr)
 		val = (cfg_value_t *)opt->simple_value.ptr;
 	else {
 		if (is_set(CFGF_RESET, opt->flags)) {
-			cfg_free_value(opt);
+			cfg_clear_values(opt);
 			opt->flags &= ~CFGF_RESET;
 		}
 
 		if (index >= opt->nvalues)
 			val = cfg_addval(opt);
 		else
-			val = opt->values[index];
+			val = &cfg_opt_vals(opt)[index];
 	}
 
 	return val;
@@ -2079,13 +5291,16 @@ DLLIMPORT int cfg_opt_setcomment(cfg_opt_t *opt, char *comment)
 		return CFG_FAIL;
 	}
 
+	if (cfg_frozen(opt->owner))
+		return CFG_FAIL;
+
 	oldcomment = opt->comment;
-	newcomment = strdup(comment);
+	newcomment = cfg_strdup(cfg_opt_arena(opt), comment);
 	if (!newcomment)
 		return CFG_FAIL;
 
 	if (oldcomment)
-		free(oldcomment);
+		cfg_dealloc(cfg_opt_arena(opt), oldcomment);
 	opt->comment = newcomment;
 	opt->flags |= CFGF_COMMENTS;
 	opt->flags |= CFGF_MODIFIED;
@@ -2098,25 +5313,111 @@ DLLIMPORT int cfg_setcomment(cfg_t *cfg, const char *name, char *comment)
 	return cfg_opt_setcomment(cfg_getopt(cfg, name), comment);
 }
 
-DLLIMPORT int cfg_opt_setnint(cfg_opt_t *opt, long int value, unsigned int index)
+/*
+ * Call the change callbacks of the option, its section and the sections
+ * above, innermost first.
+ */
+static void cfg_opt_notify(cfg_opt_t *opt, cfg_diff_t what, unsigned int index)
+{
+	cfg_t *sec;
+
+	if (opt->changecb)
+		(*opt->changecb)(opt->owner, opt, what, index);
+
+	for (sec = opt->owner; sec; sec = sec->parent) {
+		if (sec->changecb)
+			(*sec->changecb)(opt->owner, opt, what, index);
+	}
+}
+
+/*
+ * Set the value at index, or add one after the last.  Only the public
+ * setters notify, not cfg_init_defaults() or cfg_setlist() for each
+ * value.
+ */
+static int cfg_opt_setnval(cfg_opt_t *opt, cfg_type_t type, cfg_value_t value,
+			   unsigned int index, int notify)
 {
+	cfg_diff_t what = CFG_DIFF_CHANGED;
+	char *oldstr = NULL;
+	cfg_arena_t *arena;
 	cfg_value_t *val;
+	unsigned int n;
+	int reset;
 
-	if (!opt || opt->type != CFGT_INT) {
+	if (!opt || opt->type != type) {
 		errno = EINVAL;
 		return CFG_FAIL;
 	}
 
+	n = opt->nvalues;
+	reset = is_set(CFGF_RESET, opt->flags);
 	val = cfg_opt_getval(opt, index);
 	if (!val)
 		return CFG_FAIL;
 
-	val->number = value;
+	/* Default values are replaced, see cfg_opt_getval() */
+	if (opt->simple_value.ptr) {
+		index = 0;
+	} else if (reset) {
+		index = 0;
+	} else if (index >= n) {
+		what = CFG_DIFF_ADDED;
+		index = n;
+	}
+
+	switch (type) {
+	case CFGT_INT:
+		val->number = value.number;
+		break;
+
+	case CFGT_FLOAT:
+		val->fpnumber = value.fpnumber;
+		break;
+
+	case CFGT_BOOL:
+		val->boolean = value.boolean;
+		break;
+
+	case CFGT_STR:
+		if (val->string)
+			oldstr = val->string;
+
+		arena = opt->simple_value.ptr ? NULL : cfg_opt_arena(opt);
+		if (value.string) {
+			char *newstr;
+
+			newstr = cfg_strdup(arena, value.string);
+			if (!newstr)
+				return CFG_FAIL;
+			val->string = newstr;
+		} else {
+			val->string = NULL;
+		}
+
+		if (oldstr)
+			cfg_dealloc(arena, oldstr);
+		break;
+
+	default:
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
 	opt->flags |= CFGF_MODIFIED;
 
+	if (notify)
+		cfg_opt_notify(opt, what, index);
+
 	return CFG_SUCCESS;
 }
 
+DLLIMPORT int cfg_opt_setnint(cfg_opt_t *opt, long int value, unsigned int index)
+{
+	cfg_value_t val = { .number = value };
+
+	return cfg_opt_setnval(opt, CFGT_INT, val, index, 1);
+}
+
 DLLIMPORT int cfg_setnint(cfg_t *cfg, const char *name, long int value, unsigned int index)
 {
 	cfg_opt_t *opt;
@@ -2135,21 +5436,9 @@ DLLIMPORT int cfg_setint(cfg_t *cfg, const char *name, long int value)
 
 DLLIMPORT int cfg_opt_setnfloat(cfg_opt_t *opt, double value, unsigned int index)
 {
-	cfg_value_t *val;
-
-	if (!opt || opt->type != CFGT_FLOAT) {
-		errno = EINVAL;
-		return CFG_FAIL;
-	}
-
-	val = cfg_opt_getval(opt, index);
-	if (!val)
-		return CFG_FAIL;
-
-	val->fpnumber = value;
-	opt->flags |= CFGF_MODIFIED;
+	cfg_value_t val = { .fpnumber = value };
 
-	return CFG_SUCCESS;
+	return cfg_opt_setnval(opt, CFGT_FLOAT, val, index, 1);
 }
 
 DLLIMPORT int cfg_setnfloat(cfg_t *cfg, const char *name, double value, unsigned int index)
@@ -2170,21 +5459,9 @@ DLLIMPORT int cfg_setfloat(cfg_t *cfg, const char *name, double value)
 
 DLLIMPORT int cfg_opt_setnbool(cfg_opt_t *opt, cfg_bool_t value, unsigned int index)
 {
-	cfg_value_t *val;
-
-	if (!opt || opt->type != CFGT_BOOL) {
-		errno = EINVAL;
-		return CFG_FAIL;
-	}
-
-	val = cfg_opt_getval(opt, index);
-	if (!val)
-		return CFG_FAIL;
-
-	val->boolean = value;
-	opt->flags |= CFGF_MODIFIED;
+	cfg_value_t val = { .boolean = value };
 
-	return CFG_SUCCESS;
+	return cfg_opt_setnval(opt, CFGT_BOOL, val, index, 1);
 }
 
 DLLIMPORT int cfg_setnbool(cfg_t *cfg, const char *name, cfg_bool_t value, unsigned int index)
@@ -2199,35 +5476,9 @@ DLLIMPORT int cfg_setbool(cfg_t *cfg, const char *name, cfg_bool_t value)
 
 DLLIMPORT int cfg_opt_setnstr(cfg_opt_t *opt, const char *value, unsigned int index)
 {
-	char *newstr, *oldstr = NULL;
-	cfg_value_t *val;
-
-	if (!opt || opt->type != CFGT_STR) {
-		errno = EINVAL;
-		return CFG_FAIL;
-	}
-
-	val = cfg_opt_getval(opt, index);
-	if (!val)
-		return CFG_FAIL;
+	cfg_value_t val = { .string = (char *)value };
 
-	if (val->string)
-		oldstr = val->string;
-
-	if (value) {
-		newstr = strdup(value);
-		if (!newstr)
-			return CFG_FAIL;
-		val->string = newstr;
-	} else {
-		val->string = NULL;
-	}
-
-	if (oldstr)
-		free(oldstr);
-	opt->flags |= CFGF_MODIFIED;
-
-	return CFG_SUCCESS;
+	return cfg_opt_setnval(opt, CFGT_STR, val, index, 1);
 }
 
 DLLIMPORT int cfg_setnstr(cfg_t *cfg, const char *name, const char *value, unsigned int index)
@@ -2249,32 +5500,34 @@ DLLIMPORT int cfg_setstr(cfg_t *cfg, const char *name, const char *value)
 static int cfg_addlist_internal(cfg_opt_t *opt, unsigned int nvalues, va_list ap)
 {
 	int result = CFG_FAIL;
+	cfg_value_t val;
 	unsigned int i;
 
 	for (i = 0; i < nvalues; i++) {
 		switch (opt->type) {
 		case CFGT_INT:
-			result = cfg_opt_setnint(opt, va_arg(ap, int), opt->nvalues);
+			val.number = va_arg(ap, int);
 			break;
 
 		case CFGT_FLOAT:
-			result = cfg_opt_setnfloat(opt, va_arg(ap, double), opt->nvalues);
+			val.fpnumber = va_arg(ap, double);
 			break;
 
 		case CFGT_BOOL:
-			result = cfg_opt_setnbool(opt, va_arg(ap, cfg_bool_t), opt->nvalues);
+			val.boolean = va_arg(ap, cfg_bool_t);
 			break;
 
 		case CFGT_STR:
-			result = cfg_opt_setnstr(opt, va_arg(ap, char *), opt->nvalues);
+			val.string = va_arg(ap, char *);
 			break;
 
 		case CFGT_FUNC:
 		case CFGT_SEC:
 		default:
 			result = CFG_SUCCESS;
-			break;
+			continue;
 		}
+		result = cfg_opt_setnval(opt, opt->type, val, opt->nvalues, 0);
 	}
 
 	return result;
@@ -2290,10 +5543,14 @@ DLLIMPORT int cfg_setlist(cfg_t *cfg, const char *name, unsigned int nvalues, ..
 		return CFG_FAIL;
 	}
 
-	cfg_free_value(opt);
+	if (cfg_frozen(cfg))
+		return CFG_FAIL;
+
+	cfg_free_value_internal(opt);
 	va_start(ap, nvalues);
 	cfg_addlist_internal(opt, nvalues, ap);
 	va_end(ap);
+	cfg_opt_notify(opt, CFG_DIFF_CHANGED, 0);
 
 	return CFG_SUCCESS;
 }
@@ -2302,19 +5559,53 @@ DLLIMPORT int cfg_addlist(cfg_t *cfg, const char *name, unsigned int nvalues, ..
 {
 	va_list ap;
 	cfg_opt_t *opt = cfg_getopt(cfg, name);
+	unsigned int first;
+	int reset;
 
 	if (!opt || !is_set(CFGF_LIST, opt->flags)) {
 		errno = EINVAL;
 		return CFG_FAIL;
 	}
 
+	if (cfg_frozen(cfg))
+		return CFG_FAIL;
+
+	reset = is_set(CFGF_RESET, opt->flags);
+	first = reset ? 0 : opt->nvalues;
 	va_start(ap, nvalues);
 	cfg_addlist_internal(opt, nvalues, ap);
 	va_end(ap);
+	if (opt->nvalues > first)
+		cfg_opt_notify(opt, reset ? CFG_DIFF_CHANGED : CFG_DIFF_ADDED, first);
 
 	return CFG_SUCCESS;
 }
 
+DLLIMPORT int cfg_opt_reserve(cfg_opt_t *opt, unsigned int nvalues)
+{
+	if (!opt) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	if (cfg_frozen(opt->owner))
+		return CFG_FAIL;
+
+	/* Nothing to do for user owned storage, or for a single inline value */
+	if (opt->simple_value.ptr || (!opt->values && nvalues <= 1))
+		return CFG_SUCCESS;
+
+	if (nvalues <= opt->nalloc)
+		return CFG_SUCCESS;
+
+	return cfg_opt_resize(opt, nvalues);
+}
+
+DLLIMPORT int cfg_reserve(cfg_t *cfg, const char *name, unsigned int nvalues)
+{
+	return cfg_opt_reserve(cfg_getopt(cfg, name), nvalues);
+}
+
 DLLIMPORT cfg_t *cfg_addtsec(cfg_t *cfg, const char *name, const char *title)
 {
 	cfg_opt_t *opt;
@@ -2335,6 +5626,7 @@ DLLIMPORT cfg_t *cfg_addtsec(cfg_t *cfg, const char *name, const char *title)
 	val->section->path = cfg->path; /* Remember global search path. */
 	val->section->line = 1;
 	val->section->errfunc = cfg->errfunc;
+	cfg_opt_notify(opt, CFG_DIFF_ADDED, val - cfg_opt_vals(opt));
 
 	return val->section;
 }
@@ -2343,12 +5635,16 @@ DLLIMPORT int cfg_opt_rmnsec(cfg_opt_t *opt, unsigned int index)
 {
 	unsigned int n;
 	cfg_value_t *val;
+	cfg_t *sec;
 
 	if (!opt || opt->type != CFGT_SEC) {
 		errno = EINVAL;
 		return CFG_FAIL;
 	}
 
+	if (cfg_frozen(opt->owner))
+		return CFG_FAIL;
+
 	n = cfg_opt_size(opt);
 	if (index >= n)
 		return CFG_FAIL;
@@ -2357,14 +5653,25 @@ DLLIMPORT int cfg_opt_rmnsec(cfg_opt_t *opt, unsigned int index)
 	if (!val)
 		return CFG_FAIL;
 
+	if (opt->index) {
+		if (val->section && val->section->title) {
+			cfg_index_del(opt->index, val->section->title, index, cfg_title_key, opt);
+		} else {
+			cfg_index_free(opt->index);
+			opt->index = NULL;
+		}
+	}
+
+	opt->gen++;
+	sec = val->section;
 	if (index + 1 != n) {
 		/* not removing last, move the tail */
-		memmove(&opt->values[index], &opt->values[index + 1], sizeof(opt->values[index]) * (n - index - 1));
+		memmove(val, val + 1, sizeof(*val) * (n - index - 1));
 	}
 	--opt->nvalues;
 
-	cfg_free(val->section);
-	free(val);
+	cfg_free(sec);
+	cfg_opt_notify(opt, CFG_DIFF_REMOVED, index);
 
 	return CFG_SUCCESS;
 }
@@ -2379,83 +5686,250 @@ DLLIMPORT int cfg_rmsec(cfg_t *cfg, const char *name)
 	cfg_opt_t *opt;
 	long int index;
 
-	opt = cfg_getopt_secidx(cfg, name, &index);
+	opt = cfg_getopt_secidx(cfg, name, &index, NULL);
 	return cfg_opt_rmnsec(opt, index);
 }
 
 DLLIMPORT int cfg_opt_rmtsec(cfg_opt_t *opt, const char *title)
 {
-	unsigned int i, n;
+	long int i;
+
+	if (!opt || !title) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	if (!is_set(CFGF_TITLE, opt->flags))
+		return CFG_FAIL;
+
+	i = cfg_opt_gettsecidx(opt, title);
+	if (i < 0)
+		return CFG_FAIL;
+
+	return cfg_opt_rmnsec(opt, i);
+}
+
+DLLIMPORT int cfg_rmtsec(cfg_t *cfg, const char *name, const char *title)
+{
+	return cfg_opt_rmtsec(cfg_getopt(cfg, name), title);
+}
+
+/*
+ * Printing collects the output in a growing buffer.  cfg_print() and
+ * friends flush it to the stream in large writes, cfg_print_buf()
+ * returns it.
+ */
+#define CFG_PRINT_FLUSH 65536
+
+struct cfg_printer {
+	char *buf;
+	size_t len;
+	size_t size;
+	FILE *fp;		/* stream to flush to, NULL for cfg_print_buf() */
+	FILE *tmp;		/* collects print callback output, without fp */
+	int err;		/* errno of the first failure */
+};
+
+static void cfg_print_init(struct cfg_printer *p, FILE *fp)
+{
+	memset(p, 0, sizeof(*p));
+	p->fp = fp;
+}
+
+/* Room for len more bytes, and a terminating zero */
+static int cfg_print_reserve(struct cfg_printer *p, size_t len)
+{
+	size_t size;
+	char *buf;
+
+	if (p->err)
+		return CFG_FAIL;
+	if (p->size - p->len > len)
+		return CFG_SUCCESS;
+
+	size = p->size ? p->size : 256;
+	while (size - p->len <= len) {
+		if (size > SIZE_MAX / 2) {
+			p->err = ENOMEM;
+			return CFG_FAIL;
+		}
+		size *= 2;
+	}
+
+	buf = realloc(p->buf, size);
+	if (!buf) {
+		p->err = ENOMEM;
+		return CFG_FAIL;
+	}
+	p->buf = buf;
+	p->size = size;
+
+	return CFG_SUCCESS;
+}
+
+static void cfg_print_flush(struct cfg_printer *p)
+{
+	if (!p->fp || !p->len)
+		return;
+
+	if (!p->err && fwrite(p->buf, 1, p->len, p->fp) != p->len)
+		p->err = EIO;
+	p->len = 0;
+}
+
+static void cfg_print_put(struct cfg_printer *p, const char *str, size_t len)
+{
+	if (cfg_print_reserve(p, len))
+		return;
+
+	memcpy(p->buf + p->len, str, len);
+	p->len += len;
+	if (p->fp && p->len >= CFG_PRINT_FLUSH)
+		cfg_print_flush(p);
+}
+
+static void cfg_print_puts(struct cfg_printer *p, const char *str)
+{
+	cfg_print_put(p, str, strlen(str));
+}
+
+static void cfg_print_fmt(struct cfg_printer *p, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (cfg_print_reserve(p, 64))
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(p->buf + p->len, p->size - p->len, fmt, ap);
+	va_end(ap);
+	if (len < 0) {
+		p->err = EINVAL;
+		return;
+	}
+
+	if ((size_t)len >= p->size - p->len) {
+		if (cfg_print_reserve(p, len))
+			return;
+		va_start(ap, fmt);
+		vsnprintf(p->buf + p->len, p->size - p->len, fmt, ap);
+		va_end(ap);
+	}
+
+	p->len += len;
+	if (p->fp && p->len >= CFG_PRINT_FLUSH)
+		cfg_print_flush(p);
+}
+
+/* Same as "%ld", without the format parsing of snprintf() */
+static void cfg_print_long(struct cfg_printer *p, long int num)
+{
+	char digits[3 * sizeof(num) + 2], *ptr = digits + sizeof(digits);
+	unsigned long int val = num < 0 ? 0UL - (unsigned long int)num : (unsigned long int)num;
+
+	do {
+		*--ptr = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	if (num < 0)
+		*--ptr = '-';
+
+	cfg_print_put(p, ptr, digits + sizeof(digits) - ptr);
+}
+
+/* Flush and release the printer, returns CFG_FAIL with errno set on error */
+static int cfg_print_end(struct cfg_printer *p)
+{
+	cfg_print_flush(p);
+	if (p->tmp)
+		fclose(p->tmp);
+	free(p->buf);
 
-	if (!opt || !title) {
-		errno = EINVAL;
+	if (p->err) {
+		errno = p->err;
 		return CFG_FAIL;
 	}
 
-	if (!is_set(CFGF_TITLE, opt->flags))
-		return CFG_FAIL;
+	return CFG_SUCCESS;
+}
 
-	n = cfg_opt_size(opt);
-	for (i = 0; i < n; i++) {
-		cfg_t *sec = cfg_opt_getnsec(opt, i);
+/*
+ * Print callbacks write to a stream.  Flush what is buffered before
+ * calling them, or without a stream, collect their output in a
+ * temporary file.
+ */
+static void cfg_print_call(struct cfg_printer *p, cfg_opt_t *opt, unsigned int index)
+{
+	long len;
 
-		if (!sec || !sec->title)
-			return CFG_FAIL;
+	if (p->err)
+		return;
 
-		if (is_set(CFGF_NOCASE, opt->flags)) {
-			if (strcasecmp(title, sec->title) == 0)
-				break;
-		} else {
-			if (strcmp(title, sec->title) == 0)
-				break;
+	if (p->fp) {
+		cfg_print_flush(p);
+		opt->pf(opt, index, p->fp);
+		return;
+	}
+
+	if (!p->tmp) {
+		p->tmp = tmpfile();
+		if (!p->tmp) {
+			p->err = errno;
+			return;
 		}
 	}
-	if (i == n)
-		return CFG_FAIL;
 
-	return cfg_opt_rmnsec(opt, i);
-}
+	rewind(p->tmp);
+	opt->pf(opt, index, p->tmp);
+	len = ftell(p->tmp);
+	rewind(p->tmp);
+	if (len < 0) {
+		p->err = EIO;
+		return;
+	}
 
-DLLIMPORT int cfg_rmtsec(cfg_t *cfg, const char *name, const char *title)
-{
-	return cfg_opt_rmtsec(cfg_getopt(cfg, name), title);
+	if (cfg_print_reserve(p, len))
+		return;
+	if (fread(p->buf + p->len, 1, len, p->tmp) != (size_t)len) {
+		p->err = EIO;
+		return;
+	}
+	p->len += len;
 }
 
-DLLIMPORT int cfg_opt_nprint_var(cfg_opt_t *opt, unsigned int index, FILE *fp)
+static void cfg_print_var(struct cfg_printer *p, cfg_opt_t *opt, unsigned int index)
 {
 	const char *str;
-
-	if (!opt || !fp) {
-		errno = EINVAL;
-		return CFG_FAIL;
-	}
+	size_t len;
 
 	switch (opt->type) {
 	case CFGT_INT:
-		fprintf(fp, "%ld", cfg_opt_getnint(opt, index));
+		cfg_print_long(p, cfg_opt_getnint(opt, index));
 		break;
 
 	case CFGT_FLOAT:
-		fprintf(fp, "%f", cfg_opt_getnfloat(opt, index));
+		cfg_print_fmt(p, "%f", cfg_opt_getnfloat(opt, index));
 		break;
 
 	case CFGT_STR:
 		str = cfg_opt_getnstr(opt, index);
-		fprintf(fp, "\"");
+		cfg_print_put(p, "\"", 1);
 		while (str && *str) {
-			if (*str == '"')
-				fprintf(fp, "\\\"");
-			else if (*str == '\\')
-				fprintf(fp, "\\\\");
-			else
-				fprintf(fp, "%c", *str);
-			str++;
+			/* Copy runs without quotes or backslashes as is */
+			len = strcspn(str, "\"\\");
+			cfg_print_put(p, str, len);
+			str += len;
+			if (*str) {
+				cfg_print_put(p, "\\", 1);
+				cfg_print_put(p, str++, 1);
+			}
 		}
-		fprintf(fp, "\"");
+		cfg_print_put(p, "\"", 1);
 		break;
 
 	case CFGT_BOOL:
-		fprintf(fp, "%s", cfg_opt_getnbool(opt, index) ? "true" : "false");
+		cfg_print_puts(p, cfg_opt_getnbool(opt, index) ? "true" : "false");
 		break;
 
 	case CFGT_NONE:
@@ -2465,122 +5939,183 @@ DLLIMPORT int cfg_opt_nprint_var(cfg_opt_t *opt, unsigned int index, FILE *fp)
 	case CFGT_COMMENT:
 		break;
 	}
-
-	return CFG_SUCCESS;
 }
 
-static void cfg_indent(FILE *fp, int indent)
+static void cfg_print_value(struct cfg_printer *p, cfg_opt_t *opt, unsigned int index)
 {
-	while (indent--)
-		fprintf(fp, "  ");
+	if (opt->pf)
+		cfg_print_call(p, opt, index);
+	else
+		cfg_print_var(p, opt, index);
 }
 
-static int cfg_opt_print_pff_indent(cfg_opt_t *opt, FILE *fp,
-				    cfg_print_filter_func_t pff, int indent)
+DLLIMPORT int cfg_opt_nprint_var(cfg_opt_t *opt, unsigned int index, FILE *fp)
 {
+	struct cfg_printer p;
+
 	if (!opt || !fp) {
 		errno = EINVAL;
 		return CFG_FAIL;
 	}
 
+	cfg_print_init(&p, fp);
+	cfg_print_var(&p, opt, index);
+
+	return cfg_print_end(&p);
+}
+
+static void cfg_indent(struct cfg_printer *p, int indent)
+{
+	static const char spaces[] = "                                ";
+	size_t len, n;
+
+	len = indent > 0 ? 2 * (size_t)indent : 0;
+	while (len > 0) {
+		n = len < sizeof(spaces) - 1 ? len : sizeof(spaces) - 1;
+		cfg_print_put(p, spaces, n);
+		len -= n;
+	}
+}
+
+static void cfg_print_opt(struct cfg_printer *p, cfg_opt_t *opt,
+			  cfg_print_filter_func_t pff, int indent)
+{
 	if (is_set(CFGF_COMMENTS, opt->flags) && opt->comment) {
-		cfg_indent(fp, indent);
-		fprintf(fp, "/* %s */\n", opt->comment);
+		cfg_indent(p, indent);
+		cfg_print_puts(p, "/* ");
+		cfg_print_puts(p, opt->comment);
+		cfg_print_puts(p, " */\n");
 	}
 
 	if (opt->type == CFGT_SEC) {
+		unsigned int i = 0;
 		cfg_t *sec;
-		unsigned int i;
 
-		for (i = 0; i < cfg_opt_size(opt); i++) {
-			sec = cfg_opt_getnsec(opt, i);
-			cfg_indent(fp, indent);
-			if (is_set(CFGF_TITLE, opt->flags))
-				fprintf(fp, "%s \"%s\" {\n", opt->name, cfg_title(sec));
-			else
-				fprintf(fp, "%s {\n", opt->name);
-			cfg_print_pff_indent(sec, fp, pff, indent + 1);
-			cfg_indent(fp, indent);
-			fprintf(fp, "}\n");
+		while (!p->err && (sec = cfg_opt_nextsec(opt, &i)) != NULL) {
+			cfg_indent(p, indent);
+			cfg_print_puts(p, opt->name);
+			if (is_set(CFGF_TITLE, opt->flags)) {
+				cfg_print_puts(p, " \"");
+				cfg_print_puts(p, cfg_title(sec) ? cfg_title(sec) : "");
+				cfg_print_puts(p, "\" {\n");
+			} else {
+				cfg_print_puts(p, " {\n");
+			}
+			cfg_print_sec(p, sec, pff, indent + 1);
+			cfg_indent(p, indent);
+			cfg_print_puts(p, "}\n");
 		}
 	} else if (opt->type != CFGT_FUNC && opt->type != CFGT_NONE) {
 		if (is_set(CFGF_LIST, opt->flags)) {
-			cfg_indent(fp, indent);
-			fprintf(fp, "%s = {", opt->name);
-
-			if (opt->nvalues) {
-				unsigned int i;
-
-				if (opt->pf)
-					opt->pf(opt, 0, fp);
-				else
-					cfg_opt_nprint_var(opt, 0, fp);
-				for (i = 1; i < opt->nvalues; i++) {
-					fprintf(fp, ", ");
-					if (opt->pf)
-						opt->pf(opt, i, fp);
-					else
-						cfg_opt_nprint_var(opt, i, fp);
-				}
+			unsigned int i;
+
+			cfg_indent(p, indent);
+			cfg_print_puts(p, opt->name);
+			cfg_print_puts(p, " = {");
+			for (i = 0; i < opt->nvalues; i++) {
+				if (i)
+					cfg_print_puts(p, ", ");
+				cfg_print_value(p, opt, i);
 			}
-
-			fprintf(fp, "}");
+			cfg_print_puts(p, "}");
 		} else {
-			cfg_indent(fp, indent);
+			cfg_indent(p, indent);
 			/* comment out the option if is not set */
 			if (cfg_opt_size(opt) == 0 ||
 			    (opt->type == CFGT_STR && !cfg_opt_getnstr(opt, 0)))
-				fprintf(fp, "# ");
-			fprintf(fp, "%s=", opt->name);
-			if (opt->pf)
-				opt->pf(opt, 0, fp);
-			else
-				cfg_opt_nprint_var(opt, 0, fp);
+				cfg_print_puts(p, "# ");
+			cfg_print_puts(p, opt->name);
+			cfg_print_puts(p, "=");
+			cfg_print_value(p, opt, 0);
 		}
 
-		fprintf(fp, "\n");
+		cfg_print_puts(p, "\n");
 	} else if (opt->pf) {
-		cfg_indent(fp, indent);
-		opt->pf(opt, 0, fp);
-		fprintf(fp, "\n");
+		cfg_indent(p, indent);
+		cfg_print_call(p, opt, 0);
+		cfg_print_puts(p, "\n");
 	}
-
-	return CFG_SUCCESS;
 }
 
 DLLIMPORT int cfg_opt_print_indent(cfg_opt_t *opt, FILE *fp, int indent)
 {
-	return cfg_opt_print_pff_indent(opt, fp, NULL, indent);
+	struct cfg_printer p;
+
+	if (!opt || !fp) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	cfg_print_init(&p, fp);
+	cfg_print_opt(&p, opt, NULL, indent);
+
+	return cfg_print_end(&p);
 }
 
 DLLIMPORT int cfg_opt_print(cfg_opt_t *opt, FILE *fp)
 {
-	return cfg_opt_print_pff_indent(opt, fp, NULL, 0);
+	return cfg_opt_print_indent(opt, fp, 0);
 }
 
-static int cfg_print_pff_indent(cfg_t *cfg, FILE *fp,
-				cfg_print_filter_func_t fb_pff, int indent)
+static void cfg_print_sec(struct cfg_printer *p, cfg_t *cfg,
+			  cfg_print_filter_func_t fb_pff, int indent)
 {
-	int i, result = CFG_SUCCESS;
+	cfg_print_filter_func_t pff = cfg->pff ? cfg->pff : fb_pff;
+	cfg_opt_t *opt;
 
-	for (i = 0; cfg->opts[i].name; i++) {
-		cfg_print_filter_func_t pff = cfg->pff ? cfg->pff : fb_pff;
-		if (pff && pff(cfg, &cfg->opts[i]))
+	for (opt = cfg_firstopt(cfg); opt && !p->err; opt = cfg_nextopt(opt)) {
+		if (pff && pff(cfg, opt))
 			continue;
-		result += cfg_opt_print_pff_indent(&cfg->opts[i], fp, pff, indent);
+		cfg_print_opt(p, opt, pff, indent);
 	}
-
-	return result;
 }
 
 DLLIMPORT int cfg_print_indent(cfg_t *cfg, FILE *fp, int indent)
 {
-	return cfg_print_pff_indent(cfg, fp, NULL, indent);
+	struct cfg_printer p;
+
+	if (!cfg || !fp) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	cfg_print_init(&p, fp);
+	cfg_print_sec(&p, cfg, NULL, indent);
+
+	return cfg_print_end(&p);
 }
 
 DLLIMPORT int cfg_print(cfg_t *cfg, FILE *fp)
 {
-	return cfg_print_pff_indent(cfg, fp, NULL, 0);
+	return cfg_print_indent(cfg, fp, 0);
+}
+
+DLLIMPORT char *cfg_print_buf(cfg_t *cfg, size_t *len)
+{
+	struct cfg_printer p;
+	char *buf;
+
+	if (!cfg) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	cfg_print_init(&p, NULL);
+	cfg_print_sec(&p, cfg, NULL, 0);
+	if (cfg_print_reserve(&p, 0) == CFG_SUCCESS)
+		p.buf[p.len] = 0;
+
+	buf = p.buf;
+	p.buf = NULL;
+	if (cfg_print_end(&p)) {
+		free(buf);
+		return NULL;
+	}
+
+	if (len)
+		*len = p.len;
+
+	return buf;
 }
 
 DLLIMPORT cfg_print_func_t cfg_opt_set_print_func(cfg_opt_t *opt, cfg_print_func_t pf)
@@ -2592,6 +6127,9 @@ DLLIMPORT cfg_print_func_t cfg_opt_set_print_func(cfg_opt_t *opt, cfg_print_func
 		return NULL;
 	}
 
+	if (cfg_frozen(opt->owner))
+		return NULL;
+
 	oldpf = opt->pf;
 	opt->pf = pf;
 
@@ -2672,6 +6210,14 @@ DLLIMPORT cfg_validate_callback_t cfg_set_validate_func(cfg_t *cfg, const char *
 	cfg_opt_t *opt;
 	cfg_validate_callback_t oldvf;
 
+	if (!cfg) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (cfg_frozen(cfg))
+		return NULL;
+
 	opt = cfg_getopt_array(cfg->opts, cfg->flags, name);
 	if (!opt)
 		return NULL;
@@ -2687,6 +6233,14 @@ DLLIMPORT cfg_validate_callback2_t cfg_set_validate_func2(cfg_t *cfg, const char
 	cfg_opt_t *opt;
 	cfg_validate_callback2_t oldvf;
 
+	if (!cfg) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (cfg_frozen(cfg))
+		return NULL;
+
 	opt = cfg_getopt_array(cfg->opts, cfg->flags, name);
 	if (!opt)
 		return NULL;
@@ -2697,6 +6251,309 @@ DLLIMPORT cfg_validate_callback2_t cfg_set_validate_func2(cfg_t *cfg, const char
 	return oldvf;
 }
 
+DLLIMPORT cfg_change_callback_t cfg_set_change_func(cfg_t *cfg, const char *name, cfg_change_callback_t cf)
+{
+	cfg_opt_t *opt;
+	cfg_change_callback_t oldcf;
+
+	if (!cfg) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (cfg_frozen(cfg))
+		return NULL;
+
+	opt = cfg_getopt_array(cfg->opts, cfg->flags, name);
+	if (!opt)
+		return NULL;
+
+	oldcf = opt->changecb;
+	opt->changecb = cf;
+
+	return oldcf;
+}
+
+DLLIMPORT cfg_change_callback_t cfg_set_sec_change_func(cfg_t *cfg, cfg_change_callback_t cf)
+{
+	cfg_change_callback_t oldcf;
+
+	if (!cfg) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (cfg_frozen(cfg))
+		return NULL;
+
+	oldcf = cfg->changecb;
+	cfg->changecb = cf;
+
+	return oldcf;
+}
+
+/* tree diff */
+
+struct cfg_diff_ctx {
+	cfg_diff_func_t func;
+	void *arg;
+	char *path;		/**< name of the current option or section */
+	size_t len;		/**< length of path */
+	size_t size;		/**< allocated size of path */
+};
+
+static int cfg_diff_reserve(struct cfg_diff_ctx *ctx, size_t len)
+{
+	size_t size = ctx->size ? ctx->size : 64;
+	char *path;
+
+	if (ctx->len + len < ctx->size)
+		return CFG_SUCCESS;
+
+	while (size <= ctx->len + len) {
+		if (size > SIZE_MAX / 2) {
+			errno = ENOMEM;
+			return CFG_FAIL;
+		}
+		size *= 2;
+	}
+
+	path = realloc(ctx->path, size);
+	if (!path)
+		return CFG_FAIL;
+	ctx->path = path;
+	ctx->size = size;
+
+	return CFG_SUCCESS;
+}
+
+static void cfg_diff_append(struct cfg_diff_ctx *ctx, const char *str, size_t len)
+{
+	memcpy(ctx->path + ctx->len, str, len);
+	ctx->len += len;
+	ctx->path[ctx->len] = 0;
+}
+
+/*
+ * Append an option to the path, with the title or index of a section
+ * if given, the way cfg_getopt_secidx() reads them back.  Titles that
+ * would not read back as is are quoted.
+ */
+static int cfg_diff_push(struct cfg_diff_ctx *ctx, const char *name, const char *title, long int index)
+{
+	size_t len = strlen(name);
+	char num[24];
+
+	if (cfg_diff_reserve(ctx, len + 1))
+		return CFG_FAIL;
+	if (ctx->len)
+		cfg_diff_append(ctx, "|", 1);
+	cfg_diff_append(ctx, name, len);
+
+	if (title && *title && *title != '\'' && !strchr(title, '|')) {
+		len = strlen(title);
+		if (cfg_diff_reserve(ctx, len + 1))
+			return CFG_FAIL;
+		cfg_diff_append(ctx, "=", 1);
+		cfg_diff_append(ctx, title, len);
+	} else if (title) {
+		/* worst case every character escaped */
+		len = strlen(title);
+		if (len > SIZE_MAX / 2 - 3 || cfg_diff_reserve(ctx, 2 * len + 3))
+			return CFG_FAIL;
+		cfg_diff_append(ctx, "='", 2);
+		for (; *title; title++) {
+			if (*title == '\'' || *title == '\\')
+				cfg_diff_append(ctx, "\\", 1);
+			cfg_diff_append(ctx, title, 1);
+		}
+		cfg_diff_append(ctx, "'", 1);
+	} else if (index >= 0) {
+		len = snprintf(num, sizeof(num), "=%ld", index);
+		if (cfg_diff_reserve(ctx, len))
+			return CFG_FAIL;
+		cfg_diff_append(ctx, num, len);
+	}
+
+	return CFG_SUCCESS;
+}
+
+static int cfg_diff_emit(struct cfg_diff_ctx *ctx, cfg_diff_t what, cfg_opt_t *oldopt, cfg_opt_t *newopt)
+{
+	return ctx->func(what, ctx->path, oldopt, newopt, ctx->arg);
+}
+
+/* Compare the values of two options, other than sections */
+static int cfg_diff_values(cfg_opt_t *a, cfg_opt_t *b)
+{
+	cfg_value_t *va, *vb;
+	unsigned int i;
+
+	if (a->type != b->type || a->nvalues != b->nvalues)
+		return 1;
+
+	va = cfg_opt_vals(a);
+	vb = cfg_opt_vals(b);
+	for (i = 0; i < a->nvalues; i++) {
+		switch (a->type) {
+		case CFGT_INT:
+			if (va[i].number != vb[i].number)
+				return 1;
+			break;
+
+		case CFGT_FLOAT:
+			if (va[i].fpnumber != vb[i].fpnumber)
+				return 1;
+			break;
+
+		case CFGT_BOOL:
+			if (va[i].boolean != vb[i].boolean)
+				return 1;
+			break;
+
+		case CFGT_STR:
+			if (!va[i].string || !vb[i].string) {
+				if (va[i].string != vb[i].string)
+					return 1;
+			} else if (strcmp(va[i].string, vb[i].string)) {
+				return 1;
+			}
+			break;
+
+		case CFGT_PTR:
+			if (va[i].ptr != vb[i].ptr)
+				return 1;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int cfg_diff_sec(struct cfg_diff_ctx *ctx, cfg_t *a, cfg_t *b);
+
+/* Match up the sections of a section option, and compare each pair */
+static int cfg_diff_secopt(struct cfg_diff_ctx *ctx, cfg_t *b, cfg_opt_t *oa, cfg_opt_t *ob)
+{
+	unsigned int i, na, nb;
+	size_t len = ctx->len;
+	int ret = 0;
+
+	na = cfg_opt_size(oa);
+	nb = cfg_opt_size(ob);
+
+	if (is_set(CFGF_MULTI | CFGF_TITLE, oa->flags) && is_set(CFGF_TITLE, ob->flags)) {
+		int nocase = is_set(CFGF_NOCASE, b->flags);
+
+		for (i = 0; i < na && !ret; i++) {
+			cfg_t *sa = cfg_opt_vals(oa)[i].section;
+			long int j = -1;
+
+			if (sa->title)
+				j = cfg_opt_findtsec(ob, sa->title, strlen(sa->title), nocase);
+			if (cfg_diff_push(ctx, oa->name, sa->title, i))
+				return CFG_FAIL;
+			if (j < 0)
+				ret = cfg_diff_emit(ctx, CFG_DIFF_REMOVED, oa, ob);
+			else
+				ret = cfg_diff_sec(ctx, sa, cfg_opt_vals(ob)[j].section);
+			ctx->path[ctx->len = len] = 0;
+		}
+
+		for (i = 0; i < nb && !ret; i++) {
+			cfg_t *sb = cfg_opt_vals(ob)[i].section;
+
+			if (sb->title && cfg_opt_findtsec(oa, sb->title, strlen(sb->title), nocase) >= 0)
+				continue;
+			if (cfg_diff_push(ctx, ob->name, sb->title, i))
+				return CFG_FAIL;
+			ret = cfg_diff_emit(ctx, CFG_DIFF_ADDED, oa, ob);
+			ctx->path[ctx->len = len] = 0;
+		}
+
+		return ret;
+	}
+
+	/* Untitled sections by position, a single one without index */
+	for (i = 0; (i < na || i < nb) && !ret; i++) {
+		long int index = is_set(CFGF_MULTI, oa->flags) ? (long int)i : -1;
+
+		if (cfg_diff_push(ctx, oa->name, NULL, index))
+			return CFG_FAIL;
+		if (i >= nb)
+			ret = cfg_diff_emit(ctx, CFG_DIFF_REMOVED, oa, ob);
+		else if (i >= na)
+			ret = cfg_diff_emit(ctx, CFG_DIFF_ADDED, oa, ob);
+		else
+			ret = cfg_diff_sec(ctx, cfg_opt_vals(oa)[i].section, cfg_opt_vals(ob)[i].section);
+		ctx->path[ctx->len = len] = 0;
+	}
+
+	return ret;
+}
+
+static int cfg_diff_sec(struct cfg_diff_ctx *ctx, cfg_t *a, cfg_t *b)
+{
+	size_t len = ctx->len;
+	cfg_opt_t *oa, *ob;
+	int ret = 0;
+
+	for (oa = cfg_firstopt(a); oa && !ret; oa = cfg_nextopt(oa)) {
+		if (oa->simple_value.ptr || oa->type == CFGT_FUNC)
+			continue;
+
+		ob = cfg_getopt_leaf(b, oa->name, strlen(oa->name));
+		if (ob && ob->type == CFGT_SEC && oa->type == CFGT_SEC) {
+			ret = cfg_diff_secopt(ctx, b, oa, ob);
+			continue;
+		}
+
+		if (ob && !cfg_diff_values(oa, ob))
+			continue;
+
+		if (cfg_diff_push(ctx, oa->name, NULL, -1))
+			return CFG_FAIL;
+		ret = cfg_diff_emit(ctx, ob ? CFG_DIFF_CHANGED : CFG_DIFF_REMOVED, oa, ob);
+		ctx->path[ctx->len = len] = 0;
+	}
+
+	/* Only free-form key/value options can be missing in the old tree */
+	for (ob = cfg_firstopt(b); ob && !ret; ob = cfg_nextopt(ob)) {
+		if (!is_set(CFGF_DYNAMIC, ob->flags) || cfg_getopt_leaf(a, ob->name, strlen(ob->name)))
+			continue;
+
+		if (cfg_diff_push(ctx, ob->name, NULL, -1))
+			return CFG_FAIL;
+		ret = cfg_diff_emit(ctx, CFG_DIFF_ADDED, NULL, ob);
+		ctx->path[ctx->len = len] = 0;
+	}
+
+	return ret;
+}
+
+DLLIMPORT int cfg_diff(cfg_t *oldcfg, cfg_t *newcfg, cfg_diff_func_t func, void *arg)
+{
+	struct cfg_diff_ctx ctx = { func, arg, NULL, 0, 0 };
+	int ret;
+
+	if (!oldcfg || !newcfg || !func) {
+		errno = EINVAL;
+		return CFG_FAIL;
+	}
+
+	if (cfg_diff_reserve(&ctx, 0))
+		return CFG_FAIL;
+	ctx.path[0] = 0;
+
+	ret = cfg_diff_sec(&ctx, oldcfg, newcfg);
+	free(ctx.path);
+
+	return ret;
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
@@ -100,6 +100,12 @@ typedef enum cfg_type_t cfg_type_t;
 #define CFGF_COMMENTS       (1 << 11) /**< Enable option annotation/comments support */
 #define CFGF_MODIFIED       (1 << 12) /**< option has been changed from its default value */
 #define CFGF_KEYSTRVAL      (1 << 13) /**< section has free-form key=value string options created when parsing file */
+#define CFGF_DYNAMIC        (1 << 14) /**< internal, do not set: option was added by cfg_addopt() and is owned by its section */
+#define CFGF_ARENA          (1 << 15) /**< allocate all sections and values from one arena, see cfg_init() */
+#define CFGF_LAZY           (1 << 16) /**< create single sections on first use, see cfg_init() */
+#define CFGF_STALE          (1 << 17) /**< internal, do not set: value or section not seen yet by cfg_reparse() */
+#define CFGF_FROZEN         (1 << 18) /**< section is published with cfg_live_new() or cfg_live_publish() and cannot be changed */
+#define CFGF_MMAP           (1 << 19) /**< scan files from a memory mapping, see cfg_parse() */
 
 /** Return codes from cfg_parse(), cfg_parse_boolean(), and cfg_set*() functions. */
 #define CFG_SUCCESS     0
@@ -114,6 +120,12 @@ typedef struct cfg_t cfg_t;
 typedef struct cfg_defvalue_t cfg_defvalue_t;
 typedef int cfg_flag_t;
 typedef struct cfg_searchpath_t cfg_searchpath_t;
+typedef struct cfg_index_t cfg_index_t;
+typedef struct cfg_path_t cfg_path_t;
+typedef struct cfg_schema_t cfg_schema_t;
+typedef struct cfg_parser_t cfg_parser_t;
+typedef struct cfg_snapshot_t cfg_snapshot_t;
+typedef struct cfg_live_t cfg_live_t;
 
 /** Function prototype used by CFGT_FUNC options.
  *
@@ -245,6 +257,65 @@ typedef void (*cfg_errfunc_t)(cfg_t *cfg, const char *fmt, va_list ap);
  */
 typedef int (*cfg_print_filter_func_t)(cfg_t *cfg, cfg_opt_t *opt);
 
+/** Kinds of differences reported by cfg_diff(). */
+enum cfg_diff_t {
+	CFG_DIFF_ADDED,   /**< option or section only in the new tree */
+	CFG_DIFF_REMOVED, /**< option or section only in the old tree */
+	CFG_DIFF_CHANGED  /**< option with different values in the trees */
+};
+typedef enum cfg_diff_t cfg_diff_t;
+
+/** Difference callback function, see cfg_diff().
+ *
+ * @param what The kind of difference.
+ * @param path Name of the option or section, as accepted by cfg_getopt()
+ * and cfg_getsec() of either tree, e.g. "host=www|port".  Only valid
+ * during the call.
+ * @param oldopt The option in the old tree, NULL if an option was added.
+ * @param newopt The option in the new tree, NULL if an option was
+ * removed.  For sections added or removed, both are the section option.
+ * @param arg The argument given to cfg_diff().
+ *
+ * @return Zero to continue, any other value stops cfg_diff() which
+ * then returns it.
+ */
+typedef int (*cfg_diff_func_t)(cfg_diff_t what, const char *path, cfg_opt_t *oldopt, cfg_opt_t *newopt, void *arg);
+
+/** Change callback prototype
+ *
+ * This callback function is called after a value has been changed with
+ * the cfg_set*(), cfg_add*(), and cfg_rm*() APIs, as well as their
+ * cfg_opt_*() counterparts.  It is not called while parsing, see
+ * cfg_diff() for comparing a configuration before and after a reload.
+ *
+ * @param cfg The section that opt belongs to.
+ * @param opt The option that changed.  For sections added or removed,
+ * this is the section option.
+ * @param what CFG_DIFF_ADDED if a value or section was added at index,
+ * CFG_DIFF_REMOVED if the section at index was removed, or
+ * CFG_DIFF_CHANGED if the value at index was set.  When all values of
+ * a list are replaced, e.g. by cfg_setlist(), this is called once with
+ * CFG_DIFF_CHANGED and index 0, and when several values are added by
+ * cfg_addlist(), once with the index of the first.
+ * @param index Index of the value or section.
+ *
+ * @see cfg_set_change_func(), cfg_set_sec_change_func()
+ */
+typedef void (*cfg_change_callback_t)(cfg_t *cfg, cfg_opt_t *opt, cfg_diff_t what, unsigned int index);
+
+/** Tree walking callback function, see cfg_walk().
+ *
+ * @param cfg The section that opt belongs to.
+ * @param opt The option.
+ * @param depth Depth of cfg below the section given to cfg_walk(),
+ * zero for its own options.
+ * @param arg The argument given to cfg_walk().
+ *
+ * @return Zero to continue, any other value stops cfg_walk() which
+ * then returns it.
+ */
+typedef int (*cfg_walk_func_t)(cfg_t *cfg, cfg_opt_t *opt, unsigned int depth, void *arg);
+
 /** Data structure holding information about a "section". Sections can
  * be nested. A section has a list of options (strings, numbers,
  * booleans or other sections) grouped together.
@@ -265,6 +336,16 @@ struct cfg_t {
 				 * any error message. */
 	cfg_searchpath_t *path;	/**< Linked list of directories to search */
 	cfg_print_filter_func_t pff; /**< Printing filter function */
+	cfg_index_t *index;	/**< Hash index of option names, used
+				 * internally to speed up cfg_getopt() */
+	cfg_schema_t *schema;	/**< Option definitions shared by all
+				 * sections of a cfg_init() tree */
+	void *scanner;		/**< Lexer state while this section is
+				 * being parsed, used internally */
+	cfg_t *parent;		/**< Section this section belongs to,
+				 * NULL for the root section */
+	cfg_change_callback_t changecb; /**< Change callback function for
+					 * this section and its sub-sections */
 };
 
 /** Data structure holding the value of a fundamental option value.
@@ -311,7 +392,12 @@ struct cfg_opt_t {
 	char *comment;	        /**< Optional comment/annotation */
 	cfg_type_t type;	/**< Type of option */
 	unsigned int nvalues;	/**< Number of values parsed */
-	cfg_value_t **values;	/**< Array of found values */
+	cfg_value_t *values;	/**< Array of found values, NULL if the
+				 * only value is stored in value */
+	cfg_value_t value;	/**< Inline storage for a single value */
+	unsigned int nalloc;	/**< Number of slots allocated in values */
+	unsigned int nold;	/**< Slots holding previous values to be
+				 * recycled by cfg_reparse(), used internally */
 	cfg_flag_t flags;	/**< Flags */
 	cfg_opt_t *subopts;	/**< Suboptions (only applies to sections) */
 	cfg_defvalue_t def;	/**< Default value */
@@ -322,8 +408,14 @@ struct cfg_opt_t {
 	cfg_callback_t parsecb;	/**< Value parsing callback function */
 	cfg_validate_callback_t  validcb;  /**< Value validating parsing callback function */
 	cfg_validate_callback2_t validcb2; /**< Value validating set callback function */
+	cfg_change_callback_t changecb; /**< Change callback function */
 	cfg_print_func_t pf;	/**< print callback function */
 	cfg_free_func_t freecb;	/***< user-defined memory release function */
+	cfg_index_t *index;	/**< Hash index of section titles, used
+				 * internally for CFGF_TITLE sections */
+	unsigned int gen;	/**< Generation, bumped when sections are
+				 * removed, used to detect stale cfg_path_t */
+	cfg_t *owner;		/**< Section this option belongs to */
 };
 
 extern const char __export confuse_copyright[];
@@ -664,10 +756,26 @@ extern const char __export confuse_author[];
  *     setlocale(LC_MESSAGES, "");
  *     setlocale(LC_CTYPE, "");
  * </pre>
+ * With CFGF_ARENA all sections, values, and strings of the returned
+ * tree are allocated from a few large chunks, which are released at
+ * once by cfg_free() on the returned context.  Memory of values that
+ * are changed or removed is only reclaimed then, so this is meant for
+ * configurations that are mostly parsed and read.
+ *
+ * With CFGF_LAZY a section that is not CFGF_MULTI is not created with
+ * its defaults by cfg_init(), but when it is first mentioned in the
+ * input, or first looked up by cfg_getopt(), cfg_getsec(), cfg_size()
+ * and the like.  This saves time and memory for large schemas where
+ * most sections are rarely configured.  Printing the configuration
+ * creates all of them.
+ *
+ * With CFGF_MMAP cfg_parse() scans regular files from a private memory
+ * mapping instead of reading them into a buffer, see cfg_parse().
+ *
  * @param opts An array of options
  * @param flags One or more flags (bitwise or'ed together). Currently only
- * CFGF_NOCASE and CFGF_IGNORE_UNKNOWN are available. Use 0 if no flags are
- * needed.
+ * CFGF_NOCASE, CFGF_IGNORE_UNKNOWN, CFGF_ARENA, CFGF_LAZY and CFGF_MMAP are available. Use 0 if
+ * no flags are needed.
  *
  * @return A configuration context structure. This pointer is passed
  * to almost all other functions as the first parameter.
@@ -710,6 +818,13 @@ DLLIMPORT char *__export cfg_searchpath(cfg_searchpath_t *path, const char *file
  * initialized (with cfg_init()) and parsed (with cfg_parse()), the
  * values can be read with the cfg_getXXX functions.
  *
+ * A regular file is read into a buffer and scanned there.  With
+ * CFGF_MMAP it is scanned from a private memory mapping instead, which
+ * saves the copy.  But if the file is truncated while it is parsed,
+ * e.g. by an editor or deployment tool rewriting it, touching the
+ * pages past the new end raises SIGBUS.  Only use CFGF_MMAP for files
+ * that are replaced by rename(), or never change while being parsed.
+ *
  * @param cfg The configuration file context as returned from cfg_init().
  * @param filename The name of the file to parse.
  *
@@ -746,6 +861,273 @@ DLLIMPORT int __export cfg_parse_fp(cfg_t *cfg, FILE *fp);
  */
 DLLIMPORT int __export cfg_parse_buf(cfg_t *cfg, const char *buf);
 
+/** Same as cfg_parse_buf() above, but takes a buffer of known length,
+ * which need not be zero-terminated.  The scanner works on a copy of
+ * the buffer, see cfg_parse_mem_inplace() to avoid it.
+ *
+ * @param cfg The configuration file context as returned from cfg_init().
+ * @param buf A buffer with configuration directives.
+ * @param len Number of bytes in the buffer.
+ *
+ * @see cfg_parse()
+ *
+ * @return POSIX OK(0), or non-zero on failure.
+ */
+DLLIMPORT int __export cfg_parse_mem(cfg_t *cfg, const char *buf, size_t len);
+
+/** Same as cfg_parse_mem(), but scans the buffer in place instead of
+ * a copy of it.  The buffer must be writable and its last two bytes
+ * must be zero, they are not parsed.  Tokens are terminated in the
+ * buffer while they are scanned, so it must not be read or changed by
+ * anyone else until the parse is done.
+ *
+ * @param cfg The configuration file context as returned from cfg_init().
+ * @param buf A buffer with configuration directives, followed by two
+ * zero bytes.
+ * @param size Number of bytes in the buffer, including the two zero
+ * bytes.
+ *
+ * @see cfg_parse_mem()
+ *
+ * @return POSIX OK(0), or non-zero on failure.  If the buffer does not
+ * end with two zero bytes, CFG_PARSE_ERROR with errno set to EINVAL.
+ */
+DLLIMPORT int __export cfg_parse_mem_inplace(cfg_t *cfg, char *buf, size_t size);
+
+/** Create a parser context, for programs that parse configurations
+ * over and over, e.g. on every reload.  The context keeps its scanner,
+ * the scanner's string buffer, and the input buffer between parses,
+ * so parsing input no larger than before allocates next to nothing.
+ *
+ * A context can be used with any cfg_t, but only for one parse at a
+ * time.  Give each thread its own context.
+ *
+ * @return A new parser context, or NULL if out of memory.  Release it
+ * with cfg_parser_free().
+ */
+DLLIMPORT cfg_parser_t *__export cfg_parser_new(void);
+
+/** Free a parser context and all buffers it keeps.
+ */
+DLLIMPORT void __export cfg_parser_free(cfg_parser_t *parser);
+
+/** Same as cfg_parse(), but using a reusable parser context.
+ *
+ * @param parser A parser context as returned from cfg_parser_new().
+ * @param cfg The configuration file context as returned from cfg_init().
+ * @param filename The name of the file to parse.
+ *
+ * @see cfg_parse()
+ */
+DLLIMPORT int __export cfg_parser_parse(cfg_parser_t *parser, cfg_t *cfg, const char *filename);
+
+/** Same as cfg_parse_fp(), but using a reusable parser context.  The
+ * file is read into the input buffer of the context until end of file.
+ *
+ * @see cfg_parser_parse()
+ */
+DLLIMPORT int __export cfg_parser_parse_fp(cfg_parser_t *parser, cfg_t *cfg, FILE *fp);
+
+/** Same as cfg_parse_mem(), but using a reusable parser context.  The
+ * buffer is copied to the input buffer of the context.
+ *
+ * @see cfg_parser_parse()
+ */
+DLLIMPORT int __export cfg_parser_parse_mem(cfg_parser_t *parser, cfg_t *cfg, const char *buf, size_t len);
+
+/** Parse a configuration file again into a configuration that has
+ * been parsed before, e.g. on reload.  The result is the same as if
+ * the file was parsed by cfg_parse() into a new cfg_t from cfg_init()
+ * with the same options, but sections and values that did not change
+ * are kept in place: the cfg_t of such a section stays the same, and
+ * unchanged strings are not allocated again.  Only what differs from
+ * the previous configuration is allocated or released, so reloading a
+ * large configuration after a small edit is much cheaper than a cold
+ * parse.
+ *
+ * Titled sections are matched by title, untitled ones in the order
+ * they appear.  Options not given in the new file get their default
+ * values back, and options created by CFGF_KEYSTRVAL sections that are
+ * gone are removed.  With CFGF_COMMENTS, comments of options are taken
+ * from the new file only.
+ *
+ * Validation callbacks run as usual, but note that an option not yet
+ * reached in the new file still has its previous value when a callback
+ * looks at it, not its default value.
+ *
+ * @param cfg The configuration file context to update.
+ * @param filename The name of the file to parse.
+ *
+ * @return On success, CFG_SUCCESS is returned.  If the file could not
+ * be opened, CFG_FILE_ERROR is returned and no values are changed.
+ * On a parse error CFG_PARSE_ERROR is returned, and @a cfg holds what
+ * was parsed up to the error, like a new cfg_t would.
+ *
+ * @see cfg_parse()
+ */
+DLLIMPORT int __export cfg_reparse(cfg_t *cfg, const char *filename);
+
+/** Same as cfg_reparse() above, but takes a character buffer as
+ * argument.
+ *
+ * @param cfg The configuration file context to update.
+ * @param buf A zero-terminated string with configuration directives.
+ *
+ * @see cfg_reparse(), cfg_parse_buf()
+ */
+DLLIMPORT int __export cfg_reparse_buf(cfg_t *cfg, const char *buf);
+
+/** Parse many independent configuration files with the same options.
+ * Each file gets its own cfg_t, as if by cfg_init() followed by
+ * cfg_parse(), and the files are parsed in parallel by a pool of
+ * worker threads.
+ *
+ * Errors are reported through @a errfunc, with the cfg_t of the file
+ * at hand, so the file name is available in its filename member.
+ * Note that the error function can be called from several threads
+ * at the same time.  So can cfg_tilde_expand() for the file names and
+ * for included files, which is only thread-safe on systems with
+ * getpwnam_r() and getpwuid_r().
+ *
+ * @param opts An array of options, see cfg_init().
+ * @param flags One or more flags, see cfg_init().
+ * @param errfunc Error reporting function, or NULL for the default.
+ * @param filenames Array of names of the files to parse.
+ * @param nfiles Number of entries in @a filenames.
+ * @param nthreads Maximum number of threads to use, zero for one per
+ * online CPU.  Without thread support all files are parsed by the
+ * calling thread.
+ *
+ * @return An array of @a nfiles configuration contexts, in the same
+ * order as @a filenames, or NULL if out of memory.  The entry for a
+ * file that could not be opened or parsed is NULL.  Release each
+ * entry with cfg_free(), and the array itself with free().
+ */
+DLLIMPORT cfg_t **__export cfg_parse_files(cfg_opt_t *opts, cfg_flag_t flags, cfg_errfunc_t errfunc,
+					   const char **filenames, unsigned int nfiles, unsigned int nthreads);
+
+/** Publish a configuration to be read by many threads.
+ *
+ * The configuration is frozen into an immutable snapshot: single
+ * sections created on first use are created, title indexes are built,
+ * and from then on all functions that would change it fail with
+ * EPERM, so that the getters never write to it.  Setters of callback
+ * functions return NULL then, with errno set.  Reader threads get
+ * the current snapshot with cfg_live_acquire(), and a control thread
+ * replaces it with cfg_live_publish(), e.g. after a reload.
+ *
+ * @param cfg A parsed configuration, as returned from cfg_init().  It
+ * now belongs to the snapshot, do not cfg_free() it.
+ *
+ * @return A new live configuration, or NULL on error with errno set.
+ * Release it with cfg_live_free().
+ */
+DLLIMPORT cfg_live_t *__export cfg_live_new(cfg_t *cfg);
+
+/** Replace the published configuration.
+ *
+ * The configuration is frozen like in cfg_live_new() and swapped in.
+ * Readers that already hold the old snapshot keep using it, it is
+ * freed when the last of them calls cfg_snapshot_release().  This
+ * only waits for readers in the middle of cfg_live_acquire(), never
+ * for readers holding a snapshot.  Calls from several threads are
+ * serialized.
+ *
+ * @param live The live configuration.
+ * @param cfg The new configuration, it now belongs to its snapshot.
+ *
+ * @return CFG_SUCCESS, or CFG_FAIL with errno set, in which case cfg
+ * is not published and still belongs to the caller.
+ */
+DLLIMPORT int __export cfg_live_publish(cfg_live_t *live, cfg_t *cfg);
+
+/** Get a reference to the published snapshot.
+ *
+ * This takes no locks, only a few atomic operations, and is safe to
+ * call from any number of threads concurrently with
+ * cfg_live_publish().
+ *
+ * @param live The live configuration.
+ *
+ * @return The current snapshot, to be released with
+ * cfg_snapshot_release(), or NULL with errno set if live is NULL.
+ */
+DLLIMPORT cfg_snapshot_t *__export cfg_live_acquire(cfg_live_t *live);
+
+/** Free a live configuration.
+ *
+ * Its reference to the current snapshot is released, snapshots still
+ * held by readers stay valid until released.  No thread may call
+ * cfg_live_acquire() or cfg_live_publish() on it anymore.
+ */
+DLLIMPORT void __export cfg_live_free(cfg_live_t *live);
+
+/** Return the configuration of a snapshot.
+ *
+ * The configuration is read-only, it is valid until the snapshot is
+ * released.
+ */
+DLLIMPORT cfg_t *__export cfg_snapshot_cfg(cfg_snapshot_t *snap);
+
+/** Release a snapshot returned from cfg_live_acquire().  The last
+ * release of a replaced snapshot frees its configuration.
+ */
+DLLIMPORT void __export cfg_snapshot_release(cfg_snapshot_t *snap);
+
+/** Save a parsed configuration to a binary cache file.
+ *
+ * The cache holds the sections, titles, values, comments, and the file
+ * and line of each section, in a form that cfg_cache_load() maps into
+ * memory without running the parser again.  Options that still hold
+ * their default values are not stored.  The cache is keyed on the size,
+ * modification time and a hash of the files parsed into the tree with
+ * cfg_parse() or included from them.  A tree parsed only from memory
+ * has no such files, and its cache is never stale.
+ *
+ * Effects of CFGT_FUNC options other than cfg_include(), and of
+ * environment variables, are not tracked.  The file is replaced
+ * atomically, so processes loading it at the same time are safe.
+ *
+ * @param cfg A configuration, as returned from cfg_init().
+ * @param filename Name of the cache file.
+ *
+ * @return CFG_SUCCESS, or CFG_FAIL with errno set.  ESTALE if a
+ * source file changed since it was parsed, EINVAL if an option of type
+ * CFGT_PTR is set.
+ */
+DLLIMPORT int __export cfg_cache_save(cfg_t *cfg, const char *filename);
+
+/** Load a cache file written by cfg_cache_save().
+ *
+ * The cache is checked against the options of cfg and against its
+ * source files before anything is loaded.  Its values are then set
+ * like cfg_parse() would set them, i.e., cfg is usually a new
+ * configuration from cfg_init() with the same options as the one that
+ * was saved.  With CFGF_ARENA, string values are not copied but point
+ * into the mapped cache, which is kept until cfg_free().
+ *
+ * @param cfg A configuration, as returned from cfg_init().
+ * @param filename Name of the cache file.
+ *
+ * @return CFG_SUCCESS, or CFG_FILE_ERROR with errno set and cfg
+ * unchanged: ESTALE if a source file changed, EINVAL if the cache is
+ * corrupt, written on another platform, or does not match the options.
+ * CFG_PARSE_ERROR if loading failed half-way, e.g. out of memory, as
+ * with a parse error cfg should then be freed.
+ */
+DLLIMPORT int __export cfg_cache_load(cfg_t *cfg, const char *filename);
+
+/** Parse a configuration file, or load it from its cache.
+ *
+ * If cachefile is an up-to-date cache of filename, it is loaded with
+ * cfg_cache_load().  Otherwise filename is parsed with cfg_parse(), and
+ * on success the cache is written with cfg_cache_save(), failing to
+ * write it is not an error.
+ *
+ * @return Same as cfg_parse().
+ */
+DLLIMPORT int __export cfg_parse_cached(cfg_t *cfg, const char *filename, const char *cachefile);
+
 /** Free the memory allocated for the values of a given option. Only
  * the values are freed, not the option itself (it is freed by cfg_free()).
  *
@@ -895,6 +1277,68 @@ DLLIMPORT cfg_bool_t __export cfg_getnbool(cfg_t *cfg, const char *name, unsigne
  */
 DLLIMPORT cfg_bool_t __export cfg_getbool(cfg_t *cfg, const char *name);
 
+/** Copy the values of an integer list, given a cfg_opt_t pointer.
+ *
+ * This is the same as calling cfg_opt_getnint() for each index, in a
+ * single pass over the values.
+ *
+ * @param opt The option structure (eg, as returned from cfg_getopt())
+ * @param values Array to copy the values to, may be NULL if nvalues is 0.
+ * @param nvalues Size of the values array, at most this many values
+ * are copied.
+ * @return The number of values of the option, which may be more than
+ * were copied, like snprintf(3).  On error 0 is returned and errno set.
+ * @see cfg_getints
+ */
+DLLIMPORT unsigned int __export cfg_opt_getints(cfg_opt_t *opt, long int *values, unsigned int nvalues);
+
+/** Copy the values of an integer list.
+ *
+ * The option is looked up once, so this is the fast way to read a
+ * long list, compared to calling cfg_getnint() for each index.
+ *
+ * @param cfg The configuration file context.
+ * @param name The name of the option.
+ * @param values Array to copy the values to, may be NULL if nvalues is 0.
+ * @param nvalues Size of the values array.
+ * @return The number of values of the option, see cfg_opt_getints().
+ */
+DLLIMPORT unsigned int __export cfg_getints(cfg_t *cfg, const char *name, long int *values, unsigned int nvalues);
+
+/** Copy the values of a floating point list, given a cfg_opt_t pointer.
+ * @see cfg_opt_getints
+ */
+DLLIMPORT unsigned int __export cfg_opt_getfloats(cfg_opt_t *opt, double *values, unsigned int nvalues);
+
+/** Copy the values of a floating point list.
+ * @see cfg_getints
+ */
+DLLIMPORT unsigned int __export cfg_getfloats(cfg_t *cfg, const char *name, double *values, unsigned int nvalues);
+
+/** Copy the values of a boolean list, given a cfg_opt_t pointer.
+ * @see cfg_opt_getints
+ */
+DLLIMPORT unsigned int __export cfg_opt_getbools(cfg_opt_t *opt, cfg_bool_t *values, unsigned int nvalues);
+
+/** Copy the values of a boolean list.
+ * @see cfg_getints
+ */
+DLLIMPORT unsigned int __export cfg_getbools(cfg_t *cfg, const char *name, cfg_bool_t *values, unsigned int nvalues);
+
+/** Copy the values of a string list, given a cfg_opt_t pointer.
+ *
+ * Only the pointers are copied, the strings still belong to the option
+ * and are valid until it is changed or freed.
+ *
+ * @see cfg_opt_getints
+ */
+DLLIMPORT unsigned int __export cfg_opt_getstrs(cfg_opt_t *opt, char **values, unsigned int nvalues);
+
+/** Copy the values of a string list.
+ * @see cfg_getints, cfg_opt_getstrs
+ */
+DLLIMPORT unsigned int __export cfg_getstrs(cfg_t *cfg, const char *name, char **values, unsigned int nvalues);
+
 
 DLLIMPORT void *__export cfg_opt_getnptr(cfg_opt_t *opt, unsigned int index);
 DLLIMPORT void *__export cfg_getnptr(cfg_t *cfg, const char *name, unsigned int indx);
@@ -1024,7 +1468,8 @@ DLLIMPORT int __export cfg_include(cfg_t *cfg, cfg_opt_t *opt, int argc, const c
  * @return The expanded filename is returned. If a ~user was not
  * found, the original filename is returned. In any case, a
  * dynamically allocated string is returned, which should be free()'d
- * by the caller.
+ * by the caller.  The user database is read with getpwnam_r() and
+ * getpwuid_r() where available, otherwise this is not thread-safe.
  */
 DLLIMPORT char *__export cfg_tilde_expand(const char *filename);
 
@@ -1045,6 +1490,63 @@ DLLIMPORT int __export cfg_parse_boolean(const char *s);
  */
 DLLIMPORT cfg_opt_t *cfg_getnopt(cfg_t *cfg, unsigned int index);
 
+/** Return the first option in a file or section
+ *
+ * Together with cfg_nextopt() this iterates over the options of a
+ * section in constant time per step, without allocating anything:
+ *
+ *     for (opt = cfg_firstopt(cfg); opt; opt = cfg_nextopt(opt))
+ *
+ * Options must not be added while iterating, e.g. by setting a new
+ * key in a CFGF_KEYSTRVAL section.
+ *
+ * @param cfg The configuration file or section context
+ * @return The first option, or NULL if there are no options.
+ */
+DLLIMPORT cfg_opt_t *__export cfg_firstopt(cfg_t *cfg);
+
+/** Return the option after opt in the same section
+ *
+ * @param opt An option returned by cfg_firstopt() or cfg_nextopt()
+ * @return The next option, or NULL if opt is the last one.
+ */
+DLLIMPORT cfg_opt_t *__export cfg_nextopt(cfg_opt_t *opt);
+
+/** Return the next section of a section option
+ *
+ * Iterates over the sections of a section option, in constant time
+ * per step and without allocating anything:
+ *
+ *     unsigned int i = 0;
+ *
+ *     while ((sec = cfg_opt_nextsec(opt, &i)) != NULL)
+ *
+ * @param opt The section option (eg, as returned from cfg_getopt())
+ * @param index Index of the section to return, zero to start, and
+ * incremented for the next call.
+ * @return The section, or NULL if there are no more sections.  On
+ * error NULL is returned and errno set.
+ */
+DLLIMPORT cfg_t *__export cfg_opt_nextsec(cfg_opt_t *opt, unsigned int *index);
+
+/** Walk a configuration tree depth-first
+ *
+ * Calls func for each option of cfg, in order, and for a section
+ * option walks each of its sections before continuing with the next
+ * option.  Nothing is allocated, the tree must not be changed during
+ * the walk.
+ *
+ * @param cfg The configuration file or section context
+ * @param func Called for each option.
+ * @param arg Passed on to func.
+ *
+ * @return Zero if done, or the non-zero value returned by func.  On
+ * error, CFG_FAIL is returned and errno set.
+ *
+ * @see cfg_walk_func_t
+ */
+DLLIMPORT int __export cfg_walk(cfg_t *cfg, cfg_walk_func_t func, void *arg);
+
 /** Return an option given it's name.
  *
  * @param cfg The configuration file context.
@@ -1055,6 +1557,46 @@ DLLIMPORT cfg_opt_t *cfg_getnopt(cfg_t *cfg, unsigned int index);
  */
 DLLIMPORT cfg_opt_t *__export cfg_getopt(cfg_t *cfg, const char *name);
 
+/** Compile an option name, as given to cfg_getopt(), into a path handle.
+ *
+ * The sub-sections, section titles and indexes in the name, e.g.,
+ * "server=web|listen|port", are resolved once.  The returned handle can
+ * then be used with cfg_path_getopt() to read the option without any
+ * string parsing, string comparisons or memory allocation.
+ *
+ * @param cfg The configuration file context.
+ * @param name The name of the option.
+ *
+ * @return A handle that must be released with cfg_path_free(), or NULL
+ * if the option is not found (errno is set to ENOENT) or on failure.
+ *
+ * @see cfg_path_getopt
+ */
+DLLIMPORT cfg_path_t *__export cfg_path_compile(cfg_t *cfg, const char *name);
+
+/** Return an option given a compiled path handle.
+ *
+ * A handle is only valid for the context it was compiled for.  When a
+ * section on the path is removed, e.g. with cfg_rmtsec() or
+ * cfg_rmnsec(), or all sections of an option on the path are replaced,
+ * the handle is considered stale even if it still would resolve to an
+ * option.  It must then be freed and compiled again.
+ *
+ * @param cfg The configuration file context.
+ * @param path The handle, as returned from cfg_path_compile().
+ *
+ * @return A pointer to the option, or NULL with errno set to ESTALE if
+ * the handle is stale, or to EINVAL if it was compiled for another
+ * context.
+ */
+DLLIMPORT cfg_opt_t *__export cfg_path_getopt(cfg_t *cfg, cfg_path_t *path);
+
+/** Free a path handle returned from cfg_path_compile().
+ *
+ * @param path The handle to free.
+ */
+DLLIMPORT void __export cfg_path_free(cfg_path_t *path);
+
 /** Set an option (create an instance of an option).
  *
  * @param cfg The configuration file context.
@@ -1281,6 +1823,29 @@ DLLIMPORT unsigned int __export cfg_num(cfg_t *cfg);
  */
 DLLIMPORT int __export cfg_addlist(cfg_t *cfg, const char *name, unsigned int nvalues, ...);
 
+/** Reserve room for values of a list option. Adding values grows the
+ * list geometrically, but when the final size is known up front this
+ * saves all reallocations and copying on the way there.
+ *
+ * @param opt The option structure (eg, as returned from cfg_getopt())
+ * @param nvalues Number of values the option should have room for,
+ * including the ones it already has.
+ *
+ * @return POSIX OK(0), or non-zero on failure.
+ */
+DLLIMPORT int __export cfg_opt_reserve(cfg_opt_t *opt, unsigned int nvalues);
+
+/** Reserve room for values of a list option.
+ * @see cfg_opt_reserve
+ *
+ * @param cfg The configuration file context.
+ * @param name The name of the option.
+ * @param nvalues Number of values the option should have room for.
+ *
+ * @return POSIX OK(0), or non-zero on failure.
+ */
+DLLIMPORT int __export cfg_reserve(cfg_t *cfg, const char *name, unsigned int nvalues);
+
 /** Set an option (create an instance of an option).
  *
  * @param cfg The configuration file context.
@@ -1430,6 +1995,21 @@ DLLIMPORT int __export cfg_print_indent(cfg_t *cfg, FILE *fp, int indent);
  */
 DLLIMPORT int __export cfg_print(cfg_t *cfg, FILE *fp);
 
+/** Print the options and values to a memory buffer.
+ *
+ * The output is the same as from cfg_print(), print callback functions
+ * and print filters included.
+ *
+ * @param cfg The configuration file context.
+ * @param len Set to the length of the text on success, unless NULL.
+ *
+ * @see cfg_print
+ *
+ * @return A zero-terminated string that should be free()'d by the
+ * caller, or NULL with errno set on failure.
+ */
+DLLIMPORT char *__export cfg_print_buf(cfg_t *cfg, size_t *len);
+
 /** Set a print callback function for an option.
  *
  * @param opt The option structure (eg, as returned from cfg_getopt())
@@ -1489,6 +2069,70 @@ DLLIMPORT cfg_validate_callback_t __export cfg_set_validate_func(cfg_t *cfg, con
  */
 DLLIMPORT cfg_validate_callback2_t __export cfg_set_validate_func2(cfg_t *cfg, const char *name, cfg_validate_callback2_t vf);
 
+/** Register a change callback function for an option.
+ *
+ * The callback is called after the option has been changed by any of
+ * the cfg_set*(), cfg_add*(), or cfg_rm*() functions.  Like
+ * cfg_set_validate_func2(), an option in a multiple section, e.g.
+ * "host|port", is registered for the sections created after this
+ * call.  Call this function on the section itself to register the
+ * option of an existing section.
+ *
+ * @param cfg The configuration file context.
+ * @param name The name of the option.
+ * @param cf The change callback function, or NULL to unregister.
+ *
+ * @return The old change callback function is returned.
+ *
+ * @see cfg_change_callback_t
+ */
+DLLIMPORT cfg_change_callback_t __export cfg_set_change_func(cfg_t *cfg, const char *name, cfg_change_callback_t cf);
+
+/** Register a change callback function for a section.
+ *
+ * The callback is called after any option in the section, or in one of
+ * its sub-sections, has been changed by the cfg_set*(), cfg_add*(), or
+ * cfg_rm*() functions.  It is called after the callback of the option,
+ * and before the callbacks of the sections above.  Registered on the
+ * root section it is called for every change in the tree.
+ *
+ * @param cfg The section.
+ * @param cf The change callback function, or NULL to unregister.
+ *
+ * @return The old change callback function is returned.
+ *
+ * @see cfg_change_callback_t
+ */
+DLLIMPORT cfg_change_callback_t __export cfg_set_sec_change_func(cfg_t *cfg, cfg_change_callback_t cf);
+
+/** Compare two configurations with the same options, e.g. before and
+ * after a reload, and report each difference to a callback.
+ *
+ * Options are compared by value: strings by contents, pointers by
+ * address.  Titled sections are matched by title, other multiple
+ * sections by their position.  A section only in one tree is reported
+ * as a whole, with its section option and a path like "host=www" or
+ * "rule=2", and its contents are not reported.  Sections in both trees
+ * are compared recursively.  Options created by CFGF_KEYSTRVAL sections
+ * may be added or removed, other options are changed.  Comments,
+ * function options, and options with simple values are not compared.
+ *
+ * Both trees are walked once, looking up titles and option names in
+ * the hash indexes of the other tree, so the cost is linear in the
+ * size of the trees.
+ *
+ * @param oldcfg The old configuration.
+ * @param newcfg The new configuration.
+ * @param func Called for each difference found, in tree order.
+ * @param arg Passed on to func.
+ *
+ * @return Zero if done, or the non-zero value returned by func.  On
+ * error, CFG_FAIL is returned and errno set.
+ *
+ * @see cfg_diff_func_t
+ */
+DLLIMPORT int __export cfg_diff(cfg_t *oldcfg, cfg_t *newcfg, cfg_diff_func_t func, void *arg);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,59 @@
+/* Count heap allocations done by the library
+ *
+ * Linked into the tests built with -Wl,--wrap=malloc,... to intercept
+ * allocations, see Makefile.am
+ */
+
+#include "check_confuse.h"
+#include <errno.h>
+#include <string.h>
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+
+unsigned long allocs;
+const char *strdup_fail;
+
+void *__wrap_malloc(size_t size)
+{
+	allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+	allocs++;
+	if (strdup_fail && strcmp(s, strdup_fail) == 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return __real_strdup(s);
+}
+
+char *__wrap_strndup(const char *s, size_t n)
+{
+	allocs++;
+	return __real_strndup(s, n);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
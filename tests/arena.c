@@ -0,0 +1,154 @@
+/* Compare CFGF_ARENA with regular allocation on a generated config
+ *
+ * Linked with -Wl,--wrap=malloc,... to count allocations, see Makefile.am
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+
+static unsigned int num_hosts;
+static int freed;
+
+static void free_ptr(void *ptr)
+{
+	freed++;
+	free(ptr);
+}
+
+static int parse_ptr(cfg_t *cfg, cfg_opt_t *opt, const char *value, void *result)
+{
+	*(void **)result = strdup(value);
+	return 0;
+}
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("port", 80, CFGF_NONE),
+	CFG_STR("address", NULL, CFGF_NONE),
+	CFG_STR_LIST("alias", NULL, CFGF_NONE),
+	CFG_SEC("env", NULL, CFGF_KEYSTRVAL),
+	CFG_END()
+};
+
+static unsigned long bench(const char *buf, cfg_flag_t flags)
+{
+	cfg_opt_t opts[] = {
+		CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_END()
+	};
+	double start, parsed, done;
+	unsigned long before;
+	cfg_t *cfg;
+
+	before = allocs;
+	start = now();
+	cfg = cfg_init(opts, flags);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+	parsed = now();
+	before = allocs - before;
+
+	fail_unless(cfg_size(cfg, "host") == num_hosts);
+	fail_unless(cfg_getint(cfg, "host=host47|port") == 47);
+	fail_unless(strcmp(cfg_getstr(cfg, "host=host47|address"), "10.0.0.47") == 0);
+	fail_unless(strcmp(cfg_getnstr(cfg, "host=host47|alias", 1), "www47") == 0);
+	fail_unless(strcmp(cfg_getstr(cfg, "host=host47|env|user"), "user47") == 0);
+
+	cfg_free(cfg);
+	done = now();
+
+	if (bench_enabled())
+		printf("%-6s %8lu allocs, parse %.3f s, free %.4f s\n", flags & CFGF_ARENA ? "arena" : "malloc",
+		       before, parsed - start, done - parsed);
+
+	return before;
+}
+
+static void mutate(void)
+{
+	cfg_opt_t opts[] = {
+		CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_PTR_CB("ptr", NULL, CFGF_LIST, parse_ptr, free_ptr),
+		CFG_END()
+	};
+	cfg_t *cfg, *sec;
+	int i;
+
+	cfg = cfg_init(opts, CFGF_ARENA);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, "host a { alias = {x, y} }\nhost b {}\nptr = {one, two}") == CFG_SUCCESS);
+
+	/* Replacing and growing values still works, old memory stays in the arena */
+	for (i = 0; i < 1000; i++) {
+		fail_unless(cfg_setstr(cfg, "host=a|address", "127.0.0.1") == CFG_SUCCESS);
+		fail_unless(cfg_addlist(cfg, "host=b|alias", 1, "z") == CFG_SUCCESS);
+	}
+	fail_unless(strcmp(cfg_getstr(cfg, "host=a|address"), "127.0.0.1") == 0);
+	fail_unless(cfg_size(cfg, "host=b|alias") == 1000);
+	fail_unless(cfg_setcomment(cfg, "host=a|port", "comment") == CFG_SUCCESS);
+
+	fail_unless(cfg_rmtsec(cfg, "host", "a") == CFG_SUCCESS);
+	sec = cfg_addtsec(cfg, "host", "c");
+	fail_unless(sec);
+	fail_unless(cfg_parse_buf(sec, "env { key = value }") == CFG_SUCCESS);
+	fail_unless(strcmp(cfg_getstr(cfg, "host=c|env|key"), "value") == 0);
+
+	/* Free callbacks are still called */
+	cfg_free(cfg);
+	fail_unless(freed == 2);
+}
+
+/* A key that cannot be copied leaves the section as it was */
+static void addopt_fail(void)
+{
+	cfg_opt_t opts[] = {
+		CFG_SEC("env", NULL, CFGF_KEYSTRVAL),
+		CFG_END()
+	};
+	cfg_t *cfg;
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, "env { a = 1 }") == CFG_SUCCESS);
+
+	strdup_fail = "b";
+	fail_unless(cfg_parse_buf(cfg, "env { b = 2 }") != CFG_SUCCESS);
+	strdup_fail = NULL;
+	fail_unless(cfg_num(cfg_getsec(cfg, "env")) == 1);
+
+	fail_unless(cfg_parse_buf(cfg, "env { c = 3 }") == CFG_SUCCESS);
+	fail_unless(strcmp(cfg_getstr(cfg, "env|c"), "3") == 0);
+	cfg_free(cfg);
+}
+
+int main(void)
+{
+	unsigned long heap, arena;
+	unsigned int i;
+	size_t len;
+	char *buf;
+
+	num_hosts = test_size(100, 20000);
+	buf = malloc(num_hosts * 200);
+	fail_unless(buf);
+	for (i = 0, len = 0; i < num_hosts; i++)
+		len += sprintf(buf + len, "host host%u {\n port = %u\n address = \"10.0.%u.%u\"\n"
+			       " alias = {web%u, www%u}\n env { user = user%u }\n}\n",
+			       i, i, i / 256, i % 256, i, i, i);
+
+	heap = bench(buf, CFGF_NONE);
+	arena = bench(buf, CFGF_ARENA);
+	fail_unless(arena * 10 < heap);
+	free(buf);
+
+	mutate();
+	addopt_fail();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
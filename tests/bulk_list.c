@@ -0,0 +1,131 @@
+/* Bulk list getters, compared to one cfg_getn*() call per index */
+
+#include "check_confuse.h"
+#include <errno.h>
+#include <string.h>
+
+static void types(void)
+{
+	cfg_opt_t opts[] = {
+		CFG_INT_LIST("ints", "{1, 2, 3}", CFGF_NONE),
+		CFG_FLOAT_LIST("floats", "{0.5, 1.5}", CFGF_NONE),
+		CFG_BOOL_LIST("bools", "{true, false, true}", CFGF_NONE),
+		CFG_STR_LIST("strs", "{a, b}", CFGF_NONE),
+		CFG_STR_LIST("empty", NULL, CFGF_NONE),
+		CFG_END()
+	};
+	long int ints[4] = { 0 };
+	double floats[2];
+	cfg_bool_t bools[3];
+	char *strs[2];
+	cfg_t *cfg;
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, "strs = {x, y, z}") == CFG_SUCCESS);
+
+	/* Size only */
+	fail_unless(cfg_getints(cfg, "ints", NULL, 0) == 3);
+
+	fail_unless(cfg_getints(cfg, "ints", ints, 4) == 3);
+	fail_unless(ints[0] == 1 && ints[1] == 2 && ints[2] == 3 && ints[3] == 0);
+	fail_unless(cfg_getfloats(cfg, "floats", floats, 2) == 2);
+	fail_unless(floats[0] == 0.5 && floats[1] == 1.5);
+	fail_unless(cfg_getbools(cfg, "bools", bools, 3) == 3);
+	fail_unless(bools[0] == cfg_true && bools[1] == cfg_false && bools[2] == cfg_true);
+
+	/* Truncated, the strings are not copied */
+	fail_unless(cfg_getstrs(cfg, "strs", strs, 2) == 3);
+	fail_unless(strcmp(strs[0], "x") == 0 && strcmp(strs[1], "y") == 0);
+	fail_unless(strs[1] == cfg_getnstr(cfg, "strs", 1));
+	fail_unless(cfg_getstrs(cfg, "empty", strs, 2) == 0);
+
+	/* Wrong type or no such option */
+	errno = 0;
+	fail_unless(cfg_getints(cfg, "floats", ints, 4) == 0);
+	fail_unless(errno == EINVAL);
+	fail_unless(cfg_getstrs(cfg, "nonexistent", strs, 2) == 0);
+	fail_unless(cfg_opt_getints(NULL, ints, 4) == 0);
+
+	cfg_free(cfg);
+}
+
+static void bench(void)
+{
+	cfg_opt_t sec_opts[] = {
+		CFG_INT_LIST("ports", NULL, CFGF_NONE),
+		CFG_STR_LIST("names", NULL, CFGF_NONE),
+		CFG_END()
+	};
+	cfg_opt_t opts[] = {
+		CFG_SEC("servers", sec_opts, CFGF_NONE),
+		CFG_END()
+	};
+	unsigned int i, n, num_values = test_size(1000, 100000);
+	double start, loop_time, bulk_time;
+	long int *ints, sum = 0;
+	char *buf, **strs;
+	size_t len;
+	cfg_t *cfg;
+
+	buf = malloc(num_values * 20 + 100);
+	fail_unless(buf);
+	len = sprintf(buf, "servers { ports = {");
+	for (i = 0; i < num_values; i++)
+		len += sprintf(buf + len, "%s%u", i ? ", " : "", i);
+	len += sprintf(buf + len, "} names = {");
+	for (i = 0; i < num_values; i++)
+		len += sprintf(buf + len, "%sn%u", i ? ", " : "", i);
+	sprintf(buf + len, "} }");
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+
+	ints = malloc(num_values * sizeof(*ints));
+	strs = malloc(num_values * sizeof(*strs));
+	fail_unless(ints && strs);
+
+	start = now();
+	for (i = 0; i < cfg_size(cfg, "servers|ports"); i++)
+		sum += cfg_getnint(cfg, "servers|ports", i);
+	for (i = 0; i < cfg_size(cfg, "servers|names"); i++)
+		strs[i] = cfg_getnstr(cfg, "servers|names", i);
+	loop_time = now() - start;
+	fail_unless(sum == (long int)num_values * (num_values - 1) / 2);
+
+	start = now();
+	n = cfg_getints(cfg, "servers|ports", ints, num_values);
+	fail_unless(cfg_getstrs(cfg, "servers|names", strs, num_values) == num_values);
+	bulk_time = now() - start;
+	fail_unless(n == num_values);
+
+	for (i = 0; i < n; i++) {
+		fail_unless(ints[i] == (long int)i);
+		fail_unless(strs[i] == cfg_getnstr(cfg, "servers|names", i));
+	}
+
+	if (bench_enabled())
+		printf("%u ints and strings: per index %.3f ms, bulk %.3f ms\n",
+		       num_values, loop_time * 1e3, bulk_time * 1e3);
+
+	cfg_free(cfg);
+	free(strs);
+	free(ints);
+	free(buf);
+}
+
+int main(void)
+{
+	types();
+	bench();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,355 @@
+/* Save a parsed configuration to a binary cache, and load it back
+ * instead of parsing, compared to parsing with cfg_parse()
+ */
+
+#include "check_confuse.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("port", 80, CFGF_NONE),
+	CFG_STR("address", NULL, CFGF_NONE),
+	CFG_STR_LIST("alias", "{www}", CFGF_NONE),
+	CFG_FLOAT("weight", 1.0, CFGF_NONE),
+	CFG_BOOL("enabled", cfg_true, CFGF_NONE),
+	CFG_SEC("env", NULL, CFGF_KEYSTRVAL),
+	CFG_END()
+};
+
+static cfg_opt_t log_opts[] = {
+	CFG_INT("level", 3, CFGF_NONE),
+	CFG_INT_LIST("facilities", "{1, 2}", CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t opts[] = {
+	CFG_STR("name", "default", CFGF_NONE),
+	CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_SEC("log", log_opts, CFGF_NONE),
+	CFG_FUNC("include", cfg_include),
+	CFG_END()
+};
+
+static cfg_opt_t other_opts[] = {
+	CFG_INT("name", 0, CFGF_NONE),
+	CFG_END()
+};
+
+static void write_file(const char *fn, const char *text)
+{
+	FILE *fp;
+
+	fp = fopen(fn, "w");
+	fail_unless(fp);
+	fputs(text, fp);
+	fclose(fp);
+}
+
+/* What cfg_print() writes, to compare trees */
+static char *print(cfg_t *cfg)
+{
+	FILE *fp = tmpfile();
+	char *buf;
+	long len;
+
+	fail_unless(fp);
+	fail_unless(cfg_print(cfg, fp) == CFG_SUCCESS);
+	len = ftell(fp);
+	rewind(fp);
+	buf = malloc(len + 1);
+	fail_unless(buf);
+	fail_unless(fread(buf, 1, len, fp) == (size_t)len);
+	buf[len] = 0;
+	fclose(fp);
+
+	return buf;
+}
+
+static cfg_t *parse(const char *fn, cfg_flag_t flags)
+{
+	cfg_t *cfg = cfg_init(opts, flags);
+
+	fail_unless(cfg);
+	fail_unless(cfg_parse(cfg, fn) == CFG_SUCCESS);
+
+	return cfg;
+}
+
+static int same(cfg_t *a, cfg_t *b)
+{
+	char *pa = print(a), *pb = print(b);
+	int ret = strcmp(pa, pb) == 0;
+
+	if (!ret)
+		printf("got:\n%sexpected:\n%s", pb, pa);
+	free(pa);
+	free(pb);
+
+	return ret;
+}
+
+static void roundtrip(const char *fn, const char *inc, const char *cache, cfg_flag_t flags)
+{
+	cfg_t *cfg, *loaded, *sec;
+	char *text;
+
+	cfg = parse(fn, flags);
+	fail_unless(cfg_setcomment(cfg, "host=a|port", "the port") == CFG_SUCCESS);
+	fail_unless(cfg_cache_save(cfg, cache) == CFG_SUCCESS);
+
+	loaded = cfg_init(opts, flags);
+	fail_unless(loaded);
+	fail_unless(cfg_cache_load(loaded, cache) == CFG_SUCCESS);
+	fail_unless(same(cfg, loaded));
+
+	/* File and line information, and values that were not printed */
+	fail_unless(strcmp(cfg_getopt(loaded, "host=a|port")->comment, "the port") == 0);
+	fail_unless(strcmp(loaded->filename, fn) == 0);
+	sec = cfg_gettsec(loaded, "host", "b");
+	fail_unless(sec && strcmp(sec->filename, inc) == 0 && sec->line == 2);
+	fail_unless(cfg_getnsec(loaded, "host", 0)->line == cfg_getnsec(cfg, "host", 0)->line);
+	fail_unless(cfg_size(loaded, "log|facilities") == 0);
+	fail_unless(cfg_getint(loaded, "log|level") == 3);
+
+	/* Loaded values can be changed like parsed ones */
+	fail_unless(cfg_setstr(loaded, "host=a|address", "changed") == CFG_SUCCESS);
+	fail_unless(cfg_addlist(loaded, "host=a|alias", 1, "more") == CFG_SUCCESS);
+	fail_unless(cfg_rmtsec(loaded, "host", "b") == CFG_SUCCESS);
+	text = print(loaded);
+	fail_unless(strstr(text, "address=\"changed\"") != NULL);
+	free(text);
+
+	/* A loaded tree can be cached again */
+	fail_unless(cfg_cache_save(loaded, cache) == CFG_SUCCESS);
+	cfg_free(loaded);
+	loaded = cfg_init(opts, flags);
+	fail_unless(cfg_cache_load(loaded, cache) == CFG_SUCCESS);
+	fail_unless(cfg_size(loaded, "host") == 2 && cfg_gettsec(loaded, "host", "b") == NULL);
+	fail_unless(cfg_size(loaded, "host=a|alias") == 3);
+
+	cfg_free(loaded);
+	cfg_free(cfg);
+}
+
+static void invalid(const char *fn, const char *inc, const char *cache)
+{
+	cfg_snapshot_t *snap;
+	cfg_t *cfg, *fresh;
+	cfg_live_t *live;
+	FILE *fp;
+	long len;
+
+	cfg = parse(fn, CFGF_NONE);
+	fail_unless(cfg_cache_save(cfg, cache) == CFG_SUCCESS);
+	cfg_free(cfg);
+
+	fresh = cfg_init(opts, CFGF_NONE);
+	fail_unless(fresh);
+
+	/* Other options */
+	cfg = cfg_init(other_opts, CFGF_NONE);
+	errno = 0;
+	fail_unless(cfg_cache_load(cfg, cache) == CFG_FILE_ERROR);
+	fail_unless(errno == EINVAL);
+	cfg_free(cfg);
+
+	/* Truncated */
+	fp = fopen(cache, "r+");
+	fail_unless(fp);
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fclose(fp);
+	fail_unless(truncate(cache, len - 1) == 0);
+	cfg = cfg_init(opts, CFGF_NONE);
+	errno = 0;
+	fail_unless(cfg_cache_load(cfg, cache) == CFG_FILE_ERROR);
+	fail_unless(errno == EINVAL);
+	fail_unless(same(fresh, cfg));
+	cfg_free(cfg);
+
+	/* Not a cache */
+	write_file(cache, "name = text");
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg_cache_load(cfg, cache) == CFG_FILE_ERROR);
+	fail_unless(cfg_cache_load(cfg, "nonexistent.cache") == CFG_FILE_ERROR);
+	cfg_free(cfg);
+
+	/* Same size, other contents, in the same second */
+	cfg = parse(fn, CFGF_NONE);
+	fail_unless(cfg_cache_save(cfg, cache) == CFG_SUCCESS);
+	cfg_free(cfg);
+	write_file(inc, "\nhost b { port = 7 }\n");
+	cfg = cfg_init(opts, CFGF_NONE);
+	errno = 0;
+	fail_unless(cfg_cache_load(cfg, cache) == CFG_FILE_ERROR);
+	fail_unless(errno == ESTALE);
+	fail_unless(same(fresh, cfg));
+	cfg_free(cfg);
+	write_file(inc, "\nhost b { port = 8 }\n");
+
+	/* Changed after it was parsed */
+	cfg = parse(fn, CFGF_NONE);
+	write_file(inc, "host b { port = 9 }\n");
+	errno = 0;
+	fail_unless(cfg_cache_save(cfg, cache) == CFG_FAIL);
+	fail_unless(errno == ESTALE);
+	cfg_free(cfg);
+	write_file(inc, "\nhost b { port = 8 }\n");
+
+	/* Published trees can be saved, not loaded into */
+	cfg = parse(fn, CFGF_NONE);
+	live = cfg_live_new(cfg);
+	fail_unless(live);
+	snap = cfg_live_acquire(live);
+	fail_unless(cfg_cache_save(cfg_snapshot_cfg(snap), cache) == CFG_SUCCESS);
+	errno = 0;
+	fail_unless(cfg_cache_load(cfg_snapshot_cfg(snap), cache) == CFG_FILE_ERROR);
+	fail_unless(errno == EPERM);
+	cfg_snapshot_release(snap);
+	cfg_live_free(live);
+
+	cfg_free(fresh);
+}
+
+static void cached(const char *fn, const char *inc, const char *cache)
+{
+	cfg_t *cfg, *parsed;
+
+	unlink(cache);
+	parsed = parse(fn, CFGF_NONE);
+
+	/* Parsed and written, then loaded */
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg_parse_cached(cfg, fn, cache) == CFG_SUCCESS);
+	fail_unless(access(cache, F_OK) == 0);
+	cfg_free(cfg);
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg_parse_cached(cfg, fn, cache) == CFG_SUCCESS);
+	fail_unless(same(parsed, cfg));
+	cfg_free(cfg);
+
+	/* Not a cache of this file */
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg_parse_cached(cfg, inc, cache) == CFG_SUCCESS);
+	fail_unless(cfg_size(cfg, "host") == 1);
+	cfg_free(cfg);
+
+	/* Parsed again after a change */
+	write_file(inc, "\nhost b { port = 6 }\n");
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg_parse_cached(cfg, fn, cache) == CFG_SUCCESS);
+	fail_unless(cfg_getint(cfg, "host=b|port") == 6);
+	cfg_free(cfg);
+	write_file(inc, "\nhost b { port = 8 }\n");
+
+	cfg_free(parsed);
+}
+
+static void bench(const char *fn, const char *cache, cfg_flag_t flags)
+{
+	unsigned int num_hosts = test_size(100, 20000);
+	unsigned int rounds = test_size(1, 3);
+	double best_parse = 1e9, best_load = 1e9;
+	cfg_t *cfg, *loaded;
+	unsigned int i;
+	FILE *fp;
+
+	fp = fopen(fn, "w");
+	fail_unless(fp);
+	for (i = 0; i < num_hosts; i++)
+		fprintf(fp, "host host%u {\n  port = %u\n  address = \"10.0.%u.%u\"\n"
+			"  alias = {web%u, www%u}\n  env { user = u%u }\n}\n",
+			i, i, i / 256, i % 256, i, i, i);
+	fclose(fp);
+
+	cfg = parse(fn, flags);
+	fail_unless(cfg_cache_save(cfg, cache) == CFG_SUCCESS);
+
+	for (i = 0; i < rounds; i++) {
+		double start;
+
+		loaded = cfg_init(opts, flags);
+		fail_unless(loaded);
+		start = now();
+		fail_unless(cfg_parse(loaded, fn) == CFG_SUCCESS);
+		start = now() - start;
+		if (start < best_parse)
+			best_parse = start;
+		cfg_free(loaded);
+
+		loaded = cfg_init(opts, flags);
+		fail_unless(loaded);
+		start = now();
+		fail_unless(cfg_cache_load(loaded, cache) == CFG_SUCCESS);
+		start = now() - start;
+		if (start < best_load)
+			best_load = start;
+		if (i < rounds - 1)
+			cfg_free(loaded);
+	}
+
+	fail_unless(same(cfg, loaded));
+	if (bench_enabled())
+		printf("%u hosts%s: parse %.1f ms, cache %.1f ms\n", num_hosts,
+		       flags & CFGF_ARENA ? " (arena)" : "", best_parse * 1e3, best_load * 1e3);
+
+	cfg_free(loaded);
+	cfg_free(cfg);
+}
+
+int main(void)
+{
+	char fn[] = "cache.XXXXXX", inc[] = "cache.inc.XXXXXX", cache[] = "cache.bin.XXXXXX";
+	char text[256];
+	int fd;
+
+	fd = mkstemp(fn);
+	fail_unless(fd != -1);
+	close(fd);
+	fd = mkstemp(inc);
+	fail_unless(fd != -1);
+	close(fd);
+	fd = mkstemp(cache);
+	fail_unless(fd != -1);
+	close(fd);
+
+	write_file(inc, "\nhost b { port = 8 }\n");
+	snprintf(text, sizeof(text),
+		 "name = \"quoted \\\"name\\\"\"\n"
+		 "host a {\n"
+		 "  port = 1\n"
+		 "  address = \"10.0.0.1\"\n"
+		 "  alias = {x, \"y z\"}\n"
+		 "  weight = 0.25\n"
+		 "  enabled = false\n"
+		 "  env { user = u shell = sh }\n"
+		 "}\n"
+		 "include(\"%s\")\n"
+		 "host c {}\n"
+		 "log { facilities = {} }\n", inc);
+	write_file(fn, text);
+
+	roundtrip(fn, inc, cache, CFGF_NONE);
+	roundtrip(fn, inc, cache, CFGF_ARENA);
+	roundtrip(fn, inc, cache, CFGF_LAZY);
+	invalid(fn, inc, cache);
+	cached(fn, inc, cache);
+
+	bench(fn, cache, CFGF_NONE);
+	bench(fn, cache, CFGF_ARENA);
+
+	unlink(fn);
+	unlink(inc);
+	unlink(cache);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,151 @@
+/* Test change callbacks for cfg_set*(), cfg_add*(), and cfg_rm*() */
+
+#include "check_confuse.h"
+#include <string.h>
+
+static char events[1024];
+
+static void record(const char *tag, cfg_t *cfg, cfg_opt_t *opt, cfg_diff_t what, unsigned int index)
+{
+	static const char *kind[] = { "added", "removed", "changed" };
+	size_t len = strlen(events);
+
+	snprintf(events + len, sizeof(events) - len, "%s %s:%s %s %u\n", tag,
+		 cfg_title(cfg) ? cfg_title(cfg) : cfg_name(cfg), opt->name, kind[what], index);
+}
+
+static void opt_changed(cfg_t *cfg, cfg_opt_t *opt, cfg_diff_t what, unsigned int index)
+{
+	record("opt", cfg, opt, what, index);
+}
+
+static void root_changed(cfg_t *cfg, cfg_opt_t *opt, cfg_diff_t what, unsigned int index)
+{
+	record("root", cfg, opt, what, index);
+}
+
+static void host_changed(cfg_t *cfg, cfg_opt_t *opt, cfg_diff_t what, unsigned int index)
+{
+	record("host", cfg, opt, what, index);
+}
+
+static int validate_level(cfg_t *cfg, cfg_opt_t *opt, void *value)
+{
+	return *(long int *)value < 0;
+}
+
+static int check(const char *expect)
+{
+	int ok = strcmp(events, expect) == 0;
+
+	if (!ok)
+		printf("got:\n%sexpected:\n%s", events, expect);
+	events[0] = 0;
+
+	return ok;
+}
+
+int main(void)
+{
+	cfg_opt_t host_opts[] = {
+		CFG_INT("port", 80, CFGF_NONE),
+		CFG_STR_LIST("alias", NULL, CFGF_NONE),
+		CFG_END()
+	};
+	cfg_opt_t opts[] = {
+		CFG_STR("name", NULL, CFGF_NONE),
+		CFG_INT("level", 3, CFGF_NONE),
+		CFG_INT_LIST("ports", "{1, 2}", CFGF_NONE),
+		CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_END()
+	};
+	char *multi[] = { "7", "8" };
+	cfg_t *cfg, *b;
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_set_sec_change_func(cfg, root_changed) == NULL);
+	fail_unless(cfg_set_change_func(cfg, "level", opt_changed) == NULL);
+	fail_unless(cfg_set_change_func(cfg, "host", opt_changed) == NULL);
+	fail_unless(cfg_set_change_func(cfg, "host|port", opt_changed) == NULL);
+	fail_unless(cfg_set_change_func(cfg, "nonexistent", opt_changed) == NULL);
+	cfg_set_validate_func2(cfg, "level", validate_level);
+
+	/* Parsing does not notify */
+	fail_unless(cfg_parse_buf(cfg, "name = one level = 4 host a {} host b { alias = {x} }") == CFG_SUCCESS);
+	fail_unless(check(""));
+
+	fail_unless(cfg_setint(cfg, "level", 5) == CFG_SUCCESS);
+	fail_unless(cfg_setstr(cfg, "name", "two") == CFG_SUCCESS);
+	fail_unless(check("opt root:level changed 0\n"
+			  "root root:level changed 0\n"
+			  "root root:name changed 0\n"));
+
+	/* Failed or rejected changes do not notify */
+	fail_unless(cfg_setint(cfg, "level", -1) == CFG_FAIL);
+	fail_unless(cfg_setnint(cfg, "level", 1, 3) == CFG_FAIL);
+	fail_unless(cfg_setint(cfg, "name", 1) == CFG_FAIL);
+	fail_unless(check(""));
+
+	/* Defaults are replaced, then values added, once per call */
+	fail_unless(cfg_addlist(cfg, "ports", 2, 3, 4) == CFG_SUCCESS);
+	fail_unless(cfg_addlist(cfg, "ports", 2, 5, 6) == CFG_SUCCESS);
+	fail_unless(cfg_setnint(cfg, "ports", 7, 9) == CFG_SUCCESS);
+	fail_unless(cfg_setnint(cfg, "ports", 8, 1) == CFG_SUCCESS);
+	fail_unless(cfg_size(cfg, "ports") == 5);
+	fail_unless(cfg_getnint(cfg, "ports", 4) == 7);
+	fail_unless(cfg_setlist(cfg, "ports", 1, 9) == CFG_SUCCESS);
+	fail_unless(cfg_setmulti(cfg, "ports", 2, multi) == CFG_SUCCESS);
+	fail_unless(cfg_size(cfg, "ports") == 2);
+	fail_unless(check("root root:ports changed 0\n"
+			  "root root:ports added 2\n"
+			  "root root:ports added 4\n"
+			  "root root:ports changed 1\n"
+			  "root root:ports changed 0\n"
+			  "root root:ports changed 0\n"));
+
+	/* Sections, and options in sections created after registering */
+	fail_unless(cfg_addtsec(cfg, "host", "c") != NULL);
+	fail_unless(cfg_setint(cfg, "host=c|port", 8) == CFG_SUCCESS);
+	fail_unless(cfg_setint(cfg, "host=a|port", 8) == CFG_SUCCESS);
+	fail_unless(cfg_rmtsec(cfg, "host", "a") == CFG_SUCCESS);
+	fail_unless(cfg_rmtsec(cfg, "host", "a") == CFG_FAIL);
+	fail_unless(check("opt root:host added 2\n"
+			  "root root:host added 2\n"
+			  "opt c:port changed 0\n"
+			  "root c:port changed 0\n"
+			  "opt a:port changed 0\n"
+			  "root a:port changed 0\n"
+			  "opt root:host removed 0\n"
+			  "root root:host removed 0\n"));
+
+	/* Section callbacks, innermost first */
+	b = cfg_gettsec(cfg, "host", "b");
+	fail_unless(b);
+	fail_unless(cfg_set_sec_change_func(b, host_changed) == NULL);
+	fail_unless(cfg_set_change_func(b, "alias", opt_changed) == NULL);
+	fail_unless(cfg_addlist(b, "alias", 1, "y") == CFG_SUCCESS);
+	fail_unless(cfg_setstr(cfg, "host=c|alias", "z") == CFG_SUCCESS);
+	fail_unless(check("opt b:alias added 1\n"
+			  "host b:alias added 1\n"
+			  "root b:alias added 1\n"
+			  "root c:alias added 0\n"));
+
+	/* Unregister */
+	fail_unless(cfg_set_sec_change_func(cfg, NULL) == root_changed);
+	fail_unless(cfg_set_sec_change_func(b, NULL) == host_changed);
+	fail_unless(cfg_set_change_func(b, "alias", NULL) == opt_changed);
+	fail_unless(cfg_setnstr(b, "alias", "w", 0) == CFG_SUCCESS);
+	fail_unless(check(""));
+
+	cfg_free(cfg);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -3,6 +3,7 @@
 
 #include "../src/confuse.h"
 #include <stdlib.h>
+#include <time.h>
 
 #define fail_unless(test) \
     do { if(!(test)) { \
@@ -14,5 +15,37 @@
         exit(1); \
     } } while(0)
 
+/* Heap allocations so far, in the tests linked with alloc_count.c */
+extern unsigned long allocs;
+
+/* Make strdup() of this string fail, in the same tests */
+extern const char *strdup_fail;
+
+/*
+ * The tests run on small inputs, enough to check the behaviour.  With
+ * CONFUSE_BENCH set in the environment, e.g. CONFUSE_BENCH=1 make check,
+ * the ones that double as benchmarks use large inputs instead and print
+ * their timings.
+ */
+static inline int bench_enabled(void)
+{
+	return getenv("CONFUSE_BENCH") != NULL;
+}
+
+/* Input size for a test, the large one only when benchmarking */
+static inline unsigned int test_size(unsigned int small, unsigned int large)
+{
+	return bench_enabled() ? large : small;
+}
+
+/* Monotonic time in seconds, for timing the benchmarks */
+static inline double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 #endif
 
@@ -0,0 +1,97 @@
+/* Default lists are parsed once per schema, not for every section
+ *
+ * Linked with -Wl,--wrap=malloc,... to count allocations, see Makefile.am
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+
+static int parsed;
+
+static int parse_weight(cfg_t *cfg, cfg_opt_t *opt, const char *value, void *result)
+{
+	parsed++;
+	*(long int *)result = strtol(value, NULL, 0);
+	return 0;
+}
+
+static cfg_opt_t node_opts[] = {
+	CFG_INT_LIST("ports", "{80, 443, 8080, 8443}", CFGF_NONE),
+	CFG_FLOAT_LIST("limits", "{0.5, 1.5, 2.5}", CFGF_NONE),
+	CFG_BOOL_LIST("flags", "{true, false, yes}", CFGF_NONE),
+	CFG_STR_LIST("tags", "{\"alpha\", beta, gamma, delta}", CFGF_NONE),
+	CFG_INT_LIST_CB("weights", "{1, 2}", CFGF_NONE, parse_weight),
+	CFG_END()
+};
+
+int main(void)
+{
+	cfg_opt_t opts[] = {
+		CFG_SEC("node", node_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_END()
+	};
+	int num_sections = test_size(100, 50000);
+	unsigned long before;
+	double start;
+	cfg_t *cfg, *a, *b, *c;
+	char title[16];
+	int i;
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+
+	before = allocs;
+	start = now();
+	for (i = 0; i < num_sections; i++) {
+		snprintf(title, sizeof(title), "n%d", i);
+		fail_unless(cfg_addtsec(cfg, "node", title));
+	}
+	if (bench_enabled())
+		printf("%lu allocs, %.0f ns per section\n", (allocs - before) / num_sections,
+		       (now() - start) * 1e9 / num_sections);
+
+	/* Options with a parse callback are still parsed for each section */
+	fail_unless(parsed == 2 * num_sections);
+
+	a = cfg_gettsec(cfg, "node", "n0");
+	b = cfg_gettsec(cfg, "node", "n1");
+	fail_unless(a && b);
+	fail_unless(cfg_size(a, "ports") == 4 && cfg_getnint(a, "ports", 3) == 8443);
+	fail_unless(cfg_size(a, "limits") == 3 && cfg_getnfloat(a, "limits", 2) == 2.5);
+	fail_unless(cfg_size(a, "flags") == 3 && cfg_getnbool(a, "flags", 1) == cfg_false);
+	fail_unless(cfg_size(a, "tags") == 4 && strcmp(cfg_getnstr(a, "tags", 0), "alpha") == 0);
+	fail_unless(cfg_getnint(a, "weights", 1) == 2);
+	fail_unless(!(cfg_getopt(a, "tags")->flags & CFGF_MODIFIED));
+
+	/* Each section has its own copy of the defaults */
+	fail_unless(cfg_getnstr(a, "tags", 1) != cfg_getnstr(b, "tags", 1));
+	fail_unless(cfg_parse_buf(a, "ports += {9000}\ntags = {omega}") == CFG_SUCCESS);
+	fail_unless(cfg_setnint(a, "ports", 0, 1) == CFG_SUCCESS);
+	fail_unless(cfg_parse_buf(b, "tags += {epsilon}\nlimits = {}") == CFG_SUCCESS);
+	fail_unless(cfg_size(b, "tags") == 5 && cfg_size(b, "limits") == 0);
+
+	c = cfg_addtsec(cfg, "node", "new");
+	fail_unless(c);
+	fail_unless(cfg_size(c, "ports") == 4 && cfg_getnint(c, "ports", 1) == 443);
+	fail_unless(cfg_size(c, "tags") == 4 && strcmp(cfg_getnstr(c, "tags", 3), "delta") == 0);
+	fail_unless(cfg_size(c, "limits") == 3);
+	fail_unless(cfg_size(a, "ports") == 5 && cfg_getnint(a, "ports", 1) == 0);
+	fail_unless(cfg_size(a, "tags") == 1 && strcmp(cfg_getstr(a, "tags"), "omega") == 0);
+
+	/* Parsing sections from a file uses the same defaults */
+	fail_unless(cfg_parse_buf(cfg, "node x { ports += {1} }\nnode y {}") == CFG_SUCCESS);
+	fail_unless(cfg_size(cfg, "node=x|ports") == 5);
+	fail_unless(cfg_size(cfg, "node=y|ports") == 4);
+	fail_unless(strcmp(cfg_getstr(cfg, "node=y|tags"), "alpha") == 0);
+
+	cfg_free(cfg);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,171 @@
+/* Test cfg_diff() between two parsed configurations */
+
+#include "check_confuse.h"
+#include <string.h>
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("port", 80, CFGF_NONE),
+	CFG_STR("address", NULL, CFGF_NONE),
+	CFG_STR_LIST("alias", "{www}", CFGF_NONE),
+	CFG_SEC("env", NULL, CFGF_KEYSTRVAL),
+	CFG_END()
+};
+
+static cfg_opt_t rule_opts[] = {
+	CFG_STR("match", "*", CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t log_opts[] = {
+	CFG_INT("level", 3, CFGF_NONE),
+	CFG_FLOAT("ratio", 0.5, CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t opts[] = {
+	CFG_STR("name", NULL, CFGF_NONE),
+	CFG_INT_LIST("ports", "{1, 2}", CFGF_NONE),
+	CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_SEC("rule", rule_opts, CFGF_MULTI),
+	CFG_SEC("log", log_opts, CFGF_NONE),
+	CFG_END()
+};
+
+static char events[1024];
+static cfg_t *oldcfg, *newcfg;
+
+static int record(cfg_diff_t what, const char *path, cfg_opt_t *oldopt, cfg_opt_t *newopt, void *arg)
+{
+	static const char *kind[] = { "added", "removed", "changed" };
+	size_t len = strlen(events);
+
+	snprintf(events + len, sizeof(events) - len, "%s %s\n", kind[what], path);
+
+	/* Paths can be looked up in the tree(s) they are in */
+	if (what != CFG_DIFF_ADDED) {
+		fail_unless(oldopt);
+		if (oldopt->type == CFGT_SEC)
+			fail_unless(cfg_getsec(oldcfg, path) != NULL);
+		else
+			fail_unless(cfg_getopt(oldcfg, path) == oldopt);
+	}
+	if (what != CFG_DIFF_REMOVED) {
+		fail_unless(newopt);
+		if (newopt->type == CFGT_SEC)
+			fail_unless(cfg_getsec(newcfg, path) != NULL);
+		else
+			fail_unless(cfg_getopt(newcfg, path) == newopt);
+	}
+	if (what == CFG_DIFF_ADDED && newopt->type != CFGT_SEC)
+		fail_unless(oldopt == NULL);
+
+	return 0;
+}
+
+static int stop(cfg_diff_t what, const char *path, cfg_opt_t *oldopt, cfg_opt_t *newopt, void *arg)
+{
+	(*(int *)arg)++;
+	return 42;
+}
+
+static int count(cfg_diff_t what, const char *path, cfg_opt_t *oldopt, cfg_opt_t *newopt, void *arg)
+{
+	fail_unless(what == CFG_DIFF_CHANGED);
+	fail_unless(strcmp(path, "host=host47|port") == 0);
+	(*(int *)arg)++;
+	return 0;
+}
+
+static cfg_t *parse(const char *buf)
+{
+	cfg_t *cfg;
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+
+	return cfg;
+}
+
+static void bench(void)
+{
+	unsigned int num_hosts = test_size(100, 20000);
+	unsigned int i;
+	double start;
+	char *buf;
+	size_t len;
+	int n = 0;
+
+	buf = malloc(num_hosts * 100);
+	fail_unless(buf);
+	for (i = 0, len = 0; i < num_hosts; i++)
+		len += sprintf(buf + len, "host host%u { port = %u address = \"10.0.%u.%u\" alias = {web%u} }\n",
+			       i, i, i / 256, i % 256, i);
+
+	oldcfg = parse(buf);
+	memcpy(strstr(buf, "port = 47 "), "port = 48 ", 10);
+	newcfg = parse(buf);
+
+	start = now();
+	fail_unless(cfg_diff(oldcfg, newcfg, count, &n) == 0);
+	if (bench_enabled())
+		printf("diff of %u hosts in %.3f ms\n", num_hosts, (now() - start) * 1e3);
+	fail_unless(n == 1);
+
+	cfg_free(oldcfg);
+	cfg_free(newcfg);
+	free(buf);
+}
+
+int main(void)
+{
+	int n = 0;
+
+	oldcfg = parse("name = one\n"
+		       "host a { port = 1 alias = {x} env { user = u } }\n"
+		       "host b { port = 2 }\n"
+		       "host 'q|x' {}\n"
+		       "rule { match = foo } rule { match = bar }\n"
+		       "log { level = 7 }\n");
+	newcfg = parse("name = two\n"
+		       "host b { port = 2 }\n"
+		       "host a { port = 1 alias = {x, y} env { user = v shell = sh } }\n"
+		       "host c {}\n"
+		       "rule { match = foo }\n"
+		       "log { ratio = 0.5 }\n");
+
+	fail_unless(cfg_diff(oldcfg, newcfg, record, NULL) == 0);
+	fail_unless(strcmp(events,
+			   "changed name\n"
+			   "changed host=a|alias\n"
+			   "changed host=a|env|user\n"
+			   "added host=a|env|shell\n"
+			   "removed host='q|x'\n"
+			   "added host=c\n"
+			   "removed rule=1\n"
+			   "changed log|level\n") == 0);
+
+	/* The other way around */
+	events[0] = 0;
+	fail_unless(cfg_diff(newcfg, oldcfg, stop, &n) == 42);
+	fail_unless(n == 1);
+
+	/* No differences with itself */
+	fail_unless(cfg_diff(oldcfg, oldcfg, stop, &n) == 0);
+	fail_unless(n == 1);
+
+	fail_unless(cfg_diff(oldcfg, NULL, stop, &n) == CFG_FAIL);
+	cfg_free(oldcfg);
+	cfg_free(newcfg);
+
+	bench();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
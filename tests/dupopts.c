@@ -0,0 +1,124 @@
+/* Duplicate option names are reported once, at cfg_init()
+ *
+ * Also instantiates a wide section many times, which used to compare
+ * every pair of option names for each new section, and times it with
+ * CONFUSE_BENCH.
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_OPTS     2000
+
+static int count(const char *buf, const char *str)
+{
+	int n = 0;
+
+	while ((buf = strstr(buf, str))) {
+		buf += strlen(str);
+		n++;
+	}
+
+	return n;
+}
+
+static void duplicates(void)
+{
+	cfg_opt_t sub_opts[] = {
+		CFG_INT("port", 0, CFGF_NONE),
+		CFG_STR("Port", 0, CFGF_NOCASE),
+		CFG_END()
+	};
+	cfg_opt_t opts[] = {
+		CFG_INT("a", 0, CFGF_NONE),
+		CFG_INT("b", 0, CFGF_NONE),
+		CFG_INT("A", 0, CFGF_NONE),
+		CFG_INT("b", 0, CFGF_NONE),
+		CFG_SEC("sub", sub_opts, CFGF_MULTI),
+		CFG_END()
+	};
+	char buf[512] = { 0 };
+	FILE *fp;
+	cfg_t *cfg;
+	int fd;
+
+	/* Reported on stderr, no error function can be set before cfg_init() */
+	fp = tmpfile();
+	fail_unless(fp);
+	fflush(stderr);
+	fd = dup(STDERR_FILENO);
+	fail_unless(fd >= 0);
+	fail_unless(dup2(fileno(fp), STDERR_FILENO) >= 0);
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, "sub {}\nsub {}") == CFG_SUCCESS);
+	cfg_free(cfg);
+
+	fflush(stderr);
+	fail_unless(dup2(fd, STDERR_FILENO) >= 0);
+	close(fd);
+	rewind(fp);
+	fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+
+	/* Case sensitive names only clash with the exact same name */
+	fail_unless(count(buf, "duplicate option 'b'") == 1);
+	fail_unless(count(buf, "duplicate option 'A'") == 0);
+	/* Once for the schema, not for each section */
+	fail_unless(count(buf, "duplicate option 'Port'") == 1);
+}
+
+int main(void)
+{
+	cfg_opt_t wide_opts[NUM_OPTS + 1];
+	cfg_opt_t opts[] = {
+		CFG_SEC("wide", wide_opts, CFGF_MULTI),
+		CFG_END()
+	};
+	cfg_opt_t end[] = { CFG_END() };
+	int num_sections = test_size(10, 500);
+	char name[NUM_OPTS][16];
+	double start;
+	cfg_t *cfg;
+	char *buf;
+	int i;
+
+	duplicates();
+
+	for (i = 0; i < NUM_OPTS; i++) {
+		cfg_opt_t opt[] = { CFG_INT(name[i], 0, CFGF_NONE) };
+
+		snprintf(name[i], sizeof(name[i]), "option%d", i);
+		wide_opts[i] = opt[0];
+	}
+	wide_opts[NUM_OPTS] = end[0];
+
+	buf = malloc(num_sections * 8 + 1);
+	fail_unless(buf);
+	for (i = 0; i < num_sections; i++)
+		strcpy(buf + i * 8, "wide {}\n");
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+
+	start = now();
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+	if (bench_enabled())
+		printf("%.1f us per section of %d options\n", (now() - start) * 1e6 / num_sections, NUM_OPTS);
+
+	fail_unless(cfg_size(cfg, "wide") == (unsigned int)num_sections);
+	fail_unless(cfg_getint(cfg_getnsec(cfg, "wide", 7), "option1999") == 0);
+	cfg_free(cfg);
+	free(buf);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
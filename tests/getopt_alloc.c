@@ -0,0 +1,85 @@
+/* Count heap allocations per option lookup, steady state must be zero
+ *
+ * Linked with -Wl,--wrap=malloc,... to intercept allocations done by
+ * the library, see Makefile.am
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+
+static void lookup(cfg_t *cfg, const char *path, long int expect)
+{
+	unsigned int i, lookups = test_size(100, 100000);
+	unsigned long before;
+	double start;
+
+	/* Warm up, e.g. lazily built title index */
+	fail_unless(cfg_getint(cfg, path) == expect);
+
+	before = allocs;
+	start = now();
+	for (i = 0; i < lookups; i++)
+		cfg_getint(cfg, path);
+
+	if (bench_enabled())
+		printf("%-32s %.2f allocs/lookup, %.1f ns/lookup\n", path,
+		       (double)(allocs - before) / lookups, (now() - start) * 1e9 / lookups);
+	fail_unless(allocs == before);
+}
+
+int main(void)
+{
+	cfg_opt_t sub_opts[] = {
+		CFG_INT("opt", 0, CFGF_NONE),
+		CFG_END()
+	};
+	cfg_opt_t sec_opts[] = {
+		CFG_SEC("sub", sub_opts, CFGF_NONE),
+		CFG_INT("opt", 0, CFGF_NONE),
+		CFG_END()
+	};
+	cfg_opt_t opts[] = {
+		CFG_SEC("sec", sec_opts, CFGF_NONE),
+		CFG_SEC("host", sec_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_SEC("list", sub_opts, CFGF_MULTI),
+		CFG_END()
+	};
+	const char *buf =
+		"sec { opt = 1 sub { opt = 2 } }\n"
+		"host web { opt = 3 }\n"
+		"host \"it's\" { opt = 4 sub { opt = 5 } }\n"
+		"list { opt = 6 }\n"
+		"list { opt = 7 }\n";
+	char title[400], path[512];
+	cfg_t *cfg;
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+
+	lookup(cfg, "sec|sub|opt", 2);
+	lookup(cfg, "host=web|opt", 3);
+	lookup(cfg, "host='web'|opt", 3);
+	lookup(cfg, "host='it\\'s'|sub|opt", 5);
+	lookup(cfg, "list=1|opt", 7);
+
+	/* Titles too long for the stack buffer still work */
+	title[0] = '\\';
+	memset(title + 1, 'x', sizeof(title) - 2);
+	title[sizeof(title) - 1] = 0;
+	snprintf(path, sizeof(path), "host='\\%s'|opt", title);
+	fail_unless(cfg_getopt(cfg, path) == NULL);
+	fail_unless(cfg_addtsec(cfg, "host", title) != NULL);
+	fail_unless(cfg_getopt(cfg, path) == cfg_getopt(cfg_gettsec(cfg, "host", title), "opt"));
+
+	cfg_free(cfg);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,104 @@
+/* Test option lookup in wide sections, and with CONFUSE_BENCH show that
+ * lookup cost stays flat
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+
+#define LOOKUPS 200000
+
+static void wide(int num, cfg_flag_t flags)
+{
+	cfg_opt_t *opts;
+	char name[32];
+	double start;
+	cfg_t *cfg;
+	int i;
+
+	opts = calloc(num + 1, sizeof(cfg_opt_t));
+	fail_unless(opts);
+	for (i = 0; i < num; i++) {
+		cfg_opt_t opt = CFG_INT(NULL, 0, CFGF_NONE);
+
+		snprintf(name, sizeof(name), "option%d", i);
+		opt.name = strdup(name);
+		opt.def.number = i;
+		opts[i] = opt;
+	}
+
+	cfg = cfg_init(opts, flags);
+	fail_unless(cfg);
+	fail_unless(cfg_num(cfg) == (unsigned int)num);
+
+	for (i = 0; i < num; i++) {
+		snprintf(name, sizeof(name), flags & CFGF_NOCASE ? "OPTION%d" : "option%d", i);
+		fail_unless(cfg_getint(cfg, name) == i);
+	}
+	fail_unless(cfg_getopt(cfg, "nosuchoption") == NULL);
+	if (!(flags & CFGF_NOCASE))
+		fail_unless(cfg_getopt(cfg, "OPTION0") == NULL);
+
+	if (bench_enabled()) {
+		start = now();
+		for (i = 0; i < LOOKUPS; i++) {
+			snprintf(name, sizeof(name), "option%d", i % num);
+			cfg_getopt(cfg, name);
+		}
+		printf("%5d options%s: %.1f ns/lookup\n", num, flags & CFGF_NOCASE ? " (nocase)" : "",
+		       (now() - start) * 1e9 / LOOKUPS);
+	}
+
+	cfg_free(cfg);
+	for (i = 0; i < num; i++)
+		free((void *)opts[i].name);
+	free(opts);
+}
+
+static void keystrval(void)
+{
+	cfg_opt_t opts[] = {
+		CFG_SEC("env", NULL, CFGF_KEYSTRVAL),
+		CFG_END()
+	};
+	char buf[64];
+	cfg_t *cfg, *env;
+	int i;
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	for (i = 0; i < 1000; i++) {
+		snprintf(buf, sizeof(buf), "env { key%d = value%d }", i, i);
+		fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+	}
+
+	env = cfg_getsec(cfg, "env");
+	fail_unless(cfg_num(env) == 1000);
+	for (i = 0; i < 1000; i++) {
+		snprintf(buf, sizeof(buf), "env|key%d", i);
+		fail_unless(cfg_getopt(cfg, buf) != NULL);
+		snprintf(buf, sizeof(buf), "value%d", i);
+		fail_unless(strcmp(cfg_opt_getstr(cfg_getnopt(env, i)), buf) == 0);
+	}
+
+	cfg_free(cfg);
+}
+
+int main(void)
+{
+	int num;
+
+	for (num = 16; num <= 4096; num *= 4) {
+		wide(num, CFGF_NONE);
+		wide(num, CFGF_NOCASE);
+	}
+	keystrval();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
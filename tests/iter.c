@@ -0,0 +1,161 @@
+/* Test option and section iterators, and cfg_walk() */
+
+#include "check_confuse.h"
+#include <errno.h>
+#include <string.h>
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("port", 80, CFGF_NONE),
+	CFG_SEC("env", NULL, CFGF_KEYSTRVAL),
+	CFG_END()
+};
+
+static cfg_opt_t log_opts[] = {
+	CFG_INT("level", 3, CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t opts[] = {
+	CFG_STR("name", NULL, CFGF_NONE),
+	CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_SEC("log", log_opts, CFGF_NONE),
+	CFG_END()
+};
+
+static char walked[1024];
+
+static int walk(cfg_t *cfg, cfg_opt_t *opt, unsigned int depth, void *arg)
+{
+	size_t len = strlen(walked);
+
+	snprintf(walked + len, sizeof(walked) - len, "%u %s:%s\n", depth,
+		 cfg_title(cfg) ? cfg_title(cfg) : cfg_name(cfg), cfg_opt_name(opt));
+
+	if (arg && strcmp(cfg_opt_name(opt), arg) == 0)
+		return 7;
+
+	return 0;
+}
+
+static void iterate(cfg_flag_t flags)
+{
+	cfg_opt_t *opt;
+	unsigned int i, n;
+	cfg_t *cfg, *sec;
+
+	cfg = cfg_init(opts, flags);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, "host a { env { x = 1 y = 2 } } host b { port = 8 }") == CFG_SUCCESS);
+
+	/* Options, the same as by index */
+	for (opt = cfg_firstopt(cfg), n = 0; opt; opt = cfg_nextopt(opt), n++)
+		fail_unless(opt == cfg_getnopt(cfg, n));
+	fail_unless(n == 3 && n == cfg_num(cfg));
+	fail_unless(cfg_getnopt(cfg, 3) == NULL);
+
+	/* Sections of a multi section and of a single one */
+	opt = cfg_getopt(cfg, "host");
+	for (i = 0, n = 0; (sec = cfg_opt_nextsec(opt, &i)) != NULL; n++)
+		fail_unless(sec == cfg_getnsec(cfg, "host", n));
+	fail_unless(n == 2 && i == 2);
+
+	i = 0;
+	sec = cfg_opt_nextsec(cfg_getopt(cfg, "log"), &i);
+	fail_unless(sec && cfg_getint(sec, "level") == 3);
+	fail_unless(cfg_opt_nextsec(cfg_getopt(cfg, "log"), &i) == NULL);
+
+	errno = 0;
+	i = 0;
+	fail_unless(cfg_opt_nextsec(cfg_getopt(cfg, "name"), &i) == NULL);
+	fail_unless(errno == EINVAL);
+
+	/* Keys added while parsing are counted */
+	sec = cfg_getsec(cfg, "host=a|env");
+	fail_unless(cfg_num(sec) == 2);
+	fail_unless(strcmp(cfg_opt_name(cfg_getnopt(sec, 1)), "y") == 0);
+	fail_unless(cfg_nextopt(cfg_getnopt(sec, 1)) == NULL);
+
+	/* Depth first */
+	walked[0] = 0;
+	fail_unless(cfg_walk(cfg, walk, NULL) == 0);
+	fail_unless(strcmp(walked,
+			   "0 root:name\n"
+			   "0 root:host\n"
+			   "1 a:port\n"
+			   "1 a:env\n"
+			   "2 env:x\n"
+			   "2 env:y\n"
+			   "1 b:port\n"
+			   "1 b:env\n"
+			   "0 root:log\n"
+			   "1 log:level\n") == 0);
+
+	walked[0] = 0;
+	fail_unless(cfg_walk(cfg, walk, "y") == 7);
+	fail_unless(strcmp(walked + strlen(walked) - 8, "2 env:y\n") == 0);
+	fail_unless(cfg_walk(cfg, NULL, NULL) == CFG_FAIL);
+	fail_unless(cfg_walk(NULL, walk, NULL) == CFG_FAIL);
+
+	cfg_free(cfg);
+}
+
+static void bench(void)
+{
+	cfg_opt_t kv_opts[] = {
+		CFG_SEC("env", NULL, CFGF_KEYSTRVAL),
+		CFG_END()
+	};
+	unsigned int i, n = 0, m = 0, num_keys = test_size(100, 20000);
+	double start, index_time, iter_time;
+	size_t len;
+	cfg_opt_t *opt;
+	cfg_t *cfg, *sec;
+	char *buf;
+
+	buf = malloc(num_keys * 20 + 20);
+	fail_unless(buf);
+	len = sprintf(buf, "env {");
+	for (i = 0; i < num_keys; i++)
+		len += sprintf(buf + len, " k%u = v", i);
+	sprintf(buf + len, " }");
+
+	cfg = cfg_init(kv_opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+	sec = cfg_getsec(cfg, "env");
+	fail_unless(cfg_num(sec) == num_keys);
+
+	start = now();
+	for (i = 0; i < cfg_num(sec); i++)
+		n += cfg_getnopt(sec, i)->nvalues;
+	index_time = now() - start;
+
+	start = now();
+	for (opt = cfg_firstopt(sec); opt; opt = cfg_nextopt(opt))
+		m += opt->nvalues;
+	iter_time = now() - start;
+
+	fail_unless(n == num_keys && m == num_keys);
+	if (bench_enabled())
+		printf("%u options: by index %.3f ms, iterator %.3f ms\n",
+		       num_keys, index_time * 1e3, iter_time * 1e3);
+
+	cfg_free(cfg);
+	free(buf);
+}
+
+int main(void)
+{
+	iterate(CFGF_NONE);
+	iterate(CFGF_LAZY);
+	bench();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
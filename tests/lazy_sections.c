@@ -0,0 +1,134 @@
+/* Single sections are created on first use with CFGF_LAZY
+ *
+ * Linked with -Wl,--wrap=malloc,... to count allocations, see Makefile.am
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+
+#define NUM_SUBSYS 200
+
+static cfg_opt_t tuning_opts[] = {
+	CFG_INT("threads", 4, CFGF_NONE),
+	CFG_FLOAT_LIST("weights", "{0.25, 0.5, 0.25}", CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t subsys_opts[] = {
+	CFG_BOOL("enabled", cfg_false, CFGF_NONE),
+	CFG_STR("name", "unnamed", CFGF_NONE),
+	CFG_STR_LIST("servers", "{a.example.com, b.example.com}", CFGF_NONE),
+	CFG_SEC("tuning", tuning_opts, CFGF_NONE),
+	CFG_SEC("backend", tuning_opts, CFGF_MULTI),
+	CFG_END()
+};
+
+static char names[NUM_SUBSYS][16];
+static cfg_opt_t opts[NUM_SUBSYS + 2];
+
+static cfg_t *init(cfg_flag_t flags)
+{
+	unsigned long before = allocs;
+	double start = now();
+	cfg_t *cfg;
+
+	cfg = cfg_init(opts, flags);
+	fail_unless(cfg);
+	if (bench_enabled())
+		printf("%-5s cfg_init() %6lu allocs, %.3f ms\n", flags & CFGF_LAZY ? "lazy" : "eager",
+		       allocs - before, (now() - start) * 1e3);
+
+	return cfg;
+}
+
+static char *print(cfg_t *cfg)
+{
+	char *buf = NULL;
+	size_t len;
+	FILE *fp;
+
+	fp = open_memstream(&buf, &len);
+	fail_unless(fp);
+	fail_unless(cfg_print(cfg, fp) == CFG_SUCCESS);
+	fclose(fp);
+
+	return buf;
+}
+
+int main(void)
+{
+	cfg_opt_t end[] = { CFG_END() };
+	const char *input = "subsys7 { enabled = true tuning { threads = 8 } }\n"
+			    "subsys9 { backend {} }\n";
+	unsigned long eager_allocs, lazy_allocs;
+	char *eager_out, *lazy_out;
+	cfg_t *eager, *lazy;
+	cfg_opt_t *opt;
+	int i;
+
+	for (i = 0; i < NUM_SUBSYS; i++) {
+		cfg_opt_t sec[] = { CFG_SEC(names[i], subsys_opts, CFGF_NONE) };
+
+		snprintf(names[i], sizeof(names[i]), "subsys%d", i);
+		opts[i] = sec[0];
+	}
+	opts[NUM_SUBSYS] = end[0];
+
+	eager_allocs = allocs;
+	eager = init(CFGF_NONE);
+	eager_allocs = allocs - eager_allocs;
+	lazy_allocs = allocs;
+	lazy = init(CFGF_LAZY);
+	lazy_allocs = allocs - lazy_allocs;
+	fail_unless(lazy_allocs * 2 < eager_allocs);
+
+	/* Nothing created yet, but lookups see the defaults */
+	opt = &lazy->opts[3];
+	fail_unless(opt->nvalues == 0);
+	fail_unless(cfg_getint(lazy, "subsys3|tuning|threads") == 4);
+	fail_unless(opt->nvalues == 1);
+	fail_unless(cfg_size(lazy, "subsys4") == 1);
+	fail_unless(cfg_getsec(lazy, "subsys5") != NULL);
+	fail_unless(strcmp(cfg_getstr(cfg_getsec(lazy, "subsys5"), "name"), "unnamed") == 0);
+	fail_unless(cfg_size(lazy, "subsys6|servers") == 2);
+
+	/* Sections mentioned in the input keep their defaults */
+	fail_unless(cfg_parse_buf(eager, input) == CFG_SUCCESS);
+	fail_unless(cfg_parse_buf(lazy, input) == CFG_SUCCESS);
+	fail_unless(cfg_getbool(lazy, "subsys7|enabled") == cfg_true);
+	fail_unless(cfg_getint(lazy, "subsys7|tuning|threads") == 8);
+	fail_unless(cfg_getnfloat(lazy, "subsys7|tuning|weights", 1) == 0.5);
+	fail_unless(strcmp(cfg_getnstr(lazy, "subsys7|servers", 1), "b.example.com") == 0);
+	fail_unless(cfg_size(lazy, "subsys9|backend") == 1);
+	fail_unless(cfg_getint(lazy, "subsys9|backend|threads") == 4);
+
+	/* A second mention updates the same section */
+	fail_unless(cfg_parse_buf(lazy, "subsys7 { name = seven }") == CFG_SUCCESS);
+	fail_unless(cfg_getbool(lazy, "subsys7|enabled") == cfg_true);
+	fail_unless(strcmp(cfg_getstr(lazy, "subsys7|name"), "seven") == 0);
+	fail_unless(cfg_parse_buf(eager, "subsys7 { name = seven }") == CFG_SUCCESS);
+
+	/* Removed sections stay removed */
+	fail_unless(cfg_rmsec(lazy, "subsys8") == CFG_SUCCESS);
+	fail_unless(cfg_size(lazy, "subsys8") == 0);
+	fail_unless(cfg_rmsec(eager, "subsys8") == CFG_SUCCESS);
+
+	/* Printing creates the remaining sections, same output */
+	eager_out = print(eager);
+	lazy_out = print(lazy);
+	fail_unless(strcmp(eager_out, lazy_out) == 0);
+	free(eager_out);
+	free(lazy_out);
+
+	cfg_free(eager);
+	cfg_free(lazy);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,99 @@
+/* Appending to a list must be amortized O(1), and reserving up front
+ * must avoid reallocation entirely
+ *
+ * Linked with -Wl,--wrap=malloc,... to count allocations, see Makefile.am
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+
+static int num_values;
+static int num_parsed;
+
+static void fill(cfg_t *cfg, const char *name, int expect_allocs)
+{
+	unsigned long before = allocs;
+	double start = now();
+	int i;
+
+	for (i = 0; i < num_values; i++)
+		fail_unless(cfg_addlist(cfg, name, 1, i) == CFG_SUCCESS);
+
+	if (bench_enabled())
+		printf("%-8s %d values, %lu allocs, %.1f ns/value\n", name, num_values,
+		       allocs - before, (now() - start) * 1e9 / num_values);
+	if (expect_allocs >= 0)
+		fail_unless(allocs - before == (unsigned long)expect_allocs);
+	else
+		fail_unless(allocs - before < 32);
+
+	fail_unless(cfg_size(cfg, name) == (unsigned int)num_values);
+	for (i = 0; i < num_values; i += 47)
+		fail_unless(cfg_getnint(cfg, name, i) == i);
+	fail_unless(cfg_getnint(cfg, name, num_values - 1) == num_values - 1);
+}
+
+int main(void)
+{
+	cfg_opt_t opts[] = {
+		CFG_INT_LIST("grown", NULL, CFGF_NONE),
+		CFG_INT_LIST("reserved", "{1, 2, 3}", CFGF_NONE),
+		CFG_STR_LIST("parsed", NULL, CFGF_NONE),
+		CFG_END()
+	};
+	unsigned long before;
+	char last[16];
+	cfg_opt_t *opt;
+	size_t len;
+	cfg_t *cfg;
+	char *buf;
+	int i;
+
+	num_values = test_size(1000, 1000000);
+	num_parsed = test_size(200, 200000);
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+
+	/* Geometric growth, a handful of reallocations for any number of values */
+	fill(cfg, "grown", -1);
+
+	/* Reserved room survives replacing the default values */
+	fail_unless(cfg_reserve(cfg, "reserved", num_values) == CFG_SUCCESS);
+	fill(cfg, "reserved", 0);
+
+	opt = cfg_getopt(cfg, "reserved");
+	fail_unless(cfg_opt_reserve(opt, 10) == CFG_SUCCESS);
+	fail_unless(cfg_opt_size(opt) == (unsigned int)num_values);
+	fail_unless(cfg_opt_reserve(NULL, 10) == CFG_FAIL);
+	fail_unless(cfg_reserve(cfg, "nonexistent", 10) == CFG_FAIL);
+
+	/* Same for lists read from a file */
+	buf = malloc(num_parsed * 16 + 32);
+	fail_unless(buf);
+	len = sprintf(buf, "parsed = {");
+	for (i = 0; i < num_parsed; i++)
+		len += sprintf(buf + len, "%sv%d", i ? "," : "", i);
+	strcpy(buf + len, "}");
+
+	before = allocs;
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+	fail_unless(cfg_size(cfg, "parsed") == (unsigned int)num_parsed);
+	sprintf(last, "v%d", num_parsed - 1);
+	fail_unless(strcmp(cfg_getnstr(cfg, "parsed", num_parsed - 1), last) == 0);
+	if (bench_enabled())
+		printf("parsed %d strings, %.2f allocs/value\n", num_parsed, (double)(allocs - before) / num_parsed);
+	fail_unless(allocs - before < (unsigned long)num_parsed * 3);
+
+	cfg_free(cfg);
+	free(buf);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
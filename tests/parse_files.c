@@ -0,0 +1,140 @@
+/* Parse a generated corpus of small files with cfg_parse_files(),
+ * serially and with one thread per CPU
+ */
+
+#include "check_confuse.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_HOSTS  20
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("port", 80, CFGF_NONE),
+	CFG_STR("address", NULL, CFGF_NONE),
+	CFG_STR_LIST("alias", "{}", CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t opts[] = {
+	CFG_INT("tenant", -1, CFGF_NONE),
+	CFG_STR("owner", NULL, CFGF_NONE),
+	CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_FUNC("include", cfg_include),
+	CFG_END()
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int num_files;
+static const char *enoent;
+static char missing[256];
+static char include[256];
+static int errors;
+
+static void count_errors(cfg_t *cfg, const char *fmt, va_list ap)
+{
+	char msg[256];
+
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	pthread_mutex_lock(&lock);
+	if (strstr(msg, "none.conf"))
+		strcpy(missing, msg);
+	if (strstr(msg, "gone.conf"))
+		strcpy(include, msg);
+	errors++;
+	pthread_mutex_unlock(&lock);
+}
+
+static double run(const char **files, unsigned int nthreads)
+{
+	double start = now();
+	cfg_t **cfgs;
+	unsigned int i;
+
+	errors = 0;
+	missing[0] = include[0] = 0;
+	cfgs = cfg_parse_files(opts, CFGF_NONE, count_errors, files, num_files + 3, nthreads);
+	fail_unless(cfgs);
+	start = now() - start;
+
+	for (i = 0; i < num_files; i++) {
+		fail_unless(cfgs[i]);
+		fail_unless(cfg_getint(cfgs[i], "tenant") == (long int)i);
+		fail_unless(cfg_size(cfgs[i], "host") == NUM_HOSTS);
+		fail_unless(cfg_getint(cfgs[i], "host=h7|port") == (long int)i + 7);
+		cfg_free(cfgs[i]);
+	}
+
+	/* Syntax error, missing file, and missing include in the home directory */
+	fail_unless(cfgs[num_files] == NULL);
+	fail_unless(cfgs[num_files + 1] == NULL);
+	fail_unless(cfgs[num_files + 2] == NULL);
+	fail_unless(errors == 3);
+	fail_unless(strstr(missing, enoent) != NULL);
+	fail_unless(strstr(include, enoent) != NULL);
+	fail_unless(include[0] != '~');
+	free(cfgs);
+
+	return start;
+}
+
+int main(void)
+{
+	char dir[] = "parse_files.XXXXXX";
+	double serial, parallel;
+	const char **files;
+	unsigned int i, j;
+	FILE *fp;
+
+	num_files = test_size(20, 2000);
+	files = calloc(num_files + 3, sizeof(*files));
+	fail_unless(files);
+
+	enoent = strerror(ENOENT);
+	fail_unless(mkdtemp(dir));
+	for (i = 0; i < num_files + 2; i++) {
+		char *fn = malloc(sizeof(dir) + 16);
+
+		fail_unless(fn);
+		sprintf(fn, "%s/%u.conf", dir, i);
+		files[i] = fn;
+
+		fp = fopen(fn, "w");
+		fail_unless(fp);
+		if (i == num_files) {
+			fprintf(fp, "tenant = broken\n");
+		} else if (i == num_files + 1) {
+			fprintf(fp, "include(\"~/parse_files.missing/gone.conf\")\n");
+		} else {
+			fprintf(fp, "# tenant %u\ntenant = %u\nowner = \"team-%u\"\n", i, i, i % 17);
+			for (j = 0; j < NUM_HOSTS; j++)
+				fprintf(fp, "host h%u {\n  port = %u\n  address = \"10.%u.%u.1\"\n"
+					"  alias = {\"web%u\", 'www%u'}\n}\n", j, i + j, i / 256, i % 256, j, j);
+		}
+		fclose(fp);
+	}
+	files[num_files + 2] = "parse_files.missing/none.conf";
+
+	serial = run(files, 1);
+	parallel = run(files, 0);
+	run(files, 8);		/* More threads than CPUs */
+	if (bench_enabled())
+		printf("%u files: serial %.3f s, parallel %.3f s, %.1fx\n", num_files, serial, parallel, serial / parallel);
+
+	for (i = 0; i < num_files + 2; i++) {
+		unlink(files[i]);
+		free((char *)files[i]);
+	}
+	free(files);
+	rmdir(dir);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
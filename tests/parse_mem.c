@@ -0,0 +1,88 @@
+/* Test cfg_parse_mem() on buffers that are not zero-terminated, and
+ * cfg_parse_mem_inplace() on buffers ending with two zero bytes
+ */
+
+#include "check_confuse.h"
+#include <errno.h>
+#include <string.h>
+
+int main(void)
+{
+	cfg_opt_t opts[] = {
+		CFG_INT("a", 0, CFGF_NONE),
+		CFG_STR("b", NULL, CFGF_NONE),
+		CFG_STR_LIST("list", "{x, y}", CFGF_NONE),
+		CFG_END()
+	};
+	const char *text = "a = 1\nb = \"two\"\nlist = {one, two}\nb = trailing";
+	size_t len;
+	char *buf;
+	cfg_t *cfg;
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+
+	/* Exactly sized heap copy, reading past the end is caught by valgrind/ASan */
+	len = strlen(text);
+	buf = malloc(len);
+	fail_unless(buf);
+	memcpy(buf, text, len);
+
+	/* Only the first three lines */
+	fail_unless(cfg_parse_mem(cfg, buf, strstr(text, "b = trailing") - text) == CFG_SUCCESS);
+	fail_unless(cfg_getint(cfg, "a") == 1);
+	fail_unless(strcmp(cfg_getstr(cfg, "b"), "two") == 0);
+	fail_unless(cfg_size(cfg, "list") == 2);
+	fail_unless(strcmp(cfg_getnstr(cfg, "list", 1), "two") == 0);
+
+	/* An unquoted value ending at the end of the buffer */
+	fail_unless(cfg_parse_mem(cfg, buf, len) == CFG_SUCCESS);
+	fail_unless(strcmp(cfg_getstr(cfg, "b"), "trailing") == 0);
+
+	/* Cut in the middle of a token */
+	fail_unless(cfg_parse_mem(cfg, buf, len - 4) == CFG_SUCCESS);
+	fail_unless(strcmp(cfg_getstr(cfg, "b"), "trai") == 0);
+
+	/* Empty input */
+	fail_unless(cfg_parse_mem(cfg, buf, 0) == CFG_SUCCESS);
+	fail_unless(cfg_parse_mem(cfg, NULL, 0) == CFG_SUCCESS);
+	fail_unless(cfg_parse_mem(cfg, NULL, 1) == CFG_PARSE_ERROR);
+
+	/* Errors report lines relative to the buffer */
+	memcpy(buf, "a = 1\na = x", 11);
+	fail_unless(cfg_parse_mem(cfg, buf, 11) == CFG_PARSE_ERROR);
+	fail_unless(cfg->line == 2);
+
+	free(buf);
+
+	/* In place, the two zero bytes at the end are not parsed */
+	len = strlen(text);
+	buf = malloc(len + 2);
+	fail_unless(buf);
+	memcpy(buf, text, len);
+	buf[len] = buf[len + 1] = 0;
+	fail_unless(cfg_parse_mem_inplace(cfg, buf, len + 2) == CFG_SUCCESS);
+	fail_unless(cfg_getint(cfg, "a") == 1);
+	fail_unless(strcmp(cfg_getstr(cfg, "b"), "trailing") == 0);
+	fail_unless(strcmp(cfg_getnstr(cfg, "list", 0), "one") == 0);
+	fail_unless(memcmp(buf, text, len) == 0);
+
+	errno = 0;
+	fail_unless(cfg_parse_mem_inplace(cfg, buf, len + 1) == CFG_PARSE_ERROR);
+	fail_unless(errno == EINVAL);
+	fail_unless(cfg_parse_mem_inplace(cfg, buf, 1) == CFG_PARSE_ERROR);
+	fail_unless(cfg_parse_mem_inplace(cfg, NULL, 2) == CFG_PARSE_ERROR);
+	fail_unless(cfg_parse_mem_inplace(cfg, buf + len, 2) == CFG_SUCCESS);
+
+	free(buf);
+	cfg_free(cfg);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,134 @@
+/* Compare cfg_parse(), which scans a file read into a buffer, or with
+ * CFGF_MMAP a memory mapped file in place, with cfg_parse_fp() reading
+ * through stdio, and check the corner cases of file sizes around a page
+ * boundary
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+#include <unistd.h>
+
+static unsigned int num_hosts;
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("port", 80, CFGF_NONE),
+	CFG_STR("address", NULL, CFGF_NONE),
+	CFG_STR_LIST("alias", NULL, CFGF_NONE),
+	CFG_STR("comment", NULL, CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t opts[] = {
+	CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_STR("pad", NULL, CFGF_NONE),
+	CFG_END()
+};
+
+static void check(cfg_t *cfg)
+{
+	fail_unless(cfg_size(cfg, "host") == num_hosts);
+	fail_unless(cfg_getint(cfg, "host=host47|port") == 47);
+	fail_unless(strcmp(cfg_getstr(cfg, "host=host47|address"), "10.0.0.47") == 0);
+	fail_unless(strcmp(cfg_getnstr(cfg, "host=host47|alias", 1), "www47") == 0);
+	fail_unless(strcmp(cfg_getstr(cfg, "host=host47|comment"), "multi\nline 47") == 0);
+}
+
+static double bench(const char *fn, int use_fp, cfg_flag_t flags)
+{
+	unsigned int i, rounds = test_size(1, 3);
+	double best = 1e9;
+
+	for (i = 0; i < rounds; i++) {
+		cfg_t *cfg = cfg_init(opts, flags);
+		double start;
+		FILE *fp = NULL;
+
+		fail_unless(cfg);
+		start = now();
+		if (use_fp) {
+			fp = fopen(fn, "r");
+			fail_unless(fp);
+			fail_unless(cfg_parse_fp(cfg, fp) == CFG_SUCCESS);
+			fclose(fp);
+		} else {
+			fail_unless(cfg_parse(cfg, fn) == CFG_SUCCESS);
+		}
+		start = now() - start;
+		if (start < best)
+			best = start;
+
+		check(cfg);
+		cfg_free(cfg);
+	}
+
+	return best;
+}
+
+/* A file of exactly size bytes, ending in an unquoted value */
+static void edge(const char *fn, long size, cfg_flag_t flags)
+{
+	cfg_t *cfg;
+	FILE *fp;
+	long i;
+
+	fp = fopen(fn, "w");
+	fail_unless(fp);
+	fputs("# padding\n", fp);
+	for (i = 10; i < size - 8; i++)
+		fputc(i % 64 ? ' ' : '\n', fp);
+	fputs("pad = xy", fp);
+	fclose(fp);
+
+	cfg = cfg_init(opts, flags);
+	fail_unless(cfg);
+	fail_unless(cfg_parse(cfg, fn) == CFG_SUCCESS);
+	fail_unless(strcmp(cfg_getstr(cfg, "pad"), "xy") == 0);
+	cfg_free(cfg);
+}
+
+int main(void)
+{
+	char fn[] = "parse_mmap.XXXXXX";
+	double mapped, stdio, buffered;
+	long pagesz, size;
+	unsigned int i;
+	FILE *fp;
+	int fd;
+
+	num_hosts = test_size(100, 50000);
+	fd = mkstemp(fn);
+	fail_unless(fd != -1);
+	fp = fdopen(fd, "w");
+	fail_unless(fp);
+	for (i = 0; i < num_hosts; i++)
+		fprintf(fp, "host host%u {\n  port = %u\n  address = \"10.0.%u.%u\"\n"
+			"  alias = {web%u, www%u}\n  /* a comment */\n  comment = 'multi\nline %u'\n}\n",
+			i, i, i / 256, i % 256, i, i, i);
+	size = ftell(fp);
+	fclose(fp);
+
+	stdio = bench(fn, 1, CFGF_NONE);
+	buffered = bench(fn, 0, CFGF_NONE);
+	mapped = bench(fn, 0, CFGF_MMAP);
+	if (bench_enabled())
+		printf("%.1f MB: stdio %.1f MB/s, read %.1f MB/s, mmap %.1f MB/s\n", size / 1e6,
+		       size / 1e6 / stdio, size / 1e6 / buffered, size / 1e6 / mapped);
+
+	/* Sizes that leave 0, 1 and 2 bytes for the NUL terminators */
+	pagesz = sysconf(_SC_PAGESIZE);
+	for (size = 2 * pagesz - 2; size <= 2 * pagesz + 1; size++) {
+		edge(fn, size, CFGF_NONE);
+		edge(fn, size, CFGF_MMAP);
+	}
+
+	unlink(fn);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,116 @@
+/* A reusable parser context allocates next to nothing on reload
+ *
+ * Linked with -Wl,--wrap=malloc,... to count allocations, see Makefile.am
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_OPTS 26
+#define RELOADS  100
+
+static void errfunc(cfg_t *cfg, const char *fmt, va_list ap)
+{
+}
+
+int main(void)
+{
+	cfg_opt_t opts[NUM_OPTS + 2];
+	cfg_opt_t end[] = {
+		CFG_FUNC("include", cfg_include),
+		CFG_END()
+	};
+	char names[NUM_OPTS][2];
+	char file[] = "parser_reuse.XXXXXX";
+	char bad[] = "parser_reuse.XXXXXX";
+	unsigned long before, plain, reuse;
+	cfg_parser_t *parser;
+	char buf[256];
+	cfg_t *cfg;
+	FILE *fp;
+	int i, fd;
+
+	for (i = 0; i < NUM_OPTS; i++) {
+		cfg_opt_t opt[] = { CFG_INT(names[i], 0, CFGF_NONE) };
+
+		names[i][0] = 'a' + i;
+		names[i][1] = 0;
+		opts[i] = opt[0];
+	}
+	opts[NUM_OPTS] = end[0];
+	opts[NUM_OPTS + 1] = end[1];
+
+	fd = mkstemp(file);
+	fail_unless(fd >= 0);
+	fp = fdopen(fd, "w");
+	fail_unless(fp);
+	for (i = 0; i < NUM_OPTS; i++)
+		fprintf(fp, "/* option %c, %s */\n%c = \"%d\" # %d\n", 'a' + i,
+			"a comment long enough to grow the string buffer of the scanner", 'a' + i, i, i);
+	fclose(fp);
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	cfg_set_error_function(cfg, errfunc);
+	fail_unless(cfg_parse(cfg, file) == CFG_SUCCESS);
+
+	before = allocs;
+	for (i = 0; i < RELOADS; i++)
+		fail_unless(cfg_parse(cfg, file) == CFG_SUCCESS);
+	plain = allocs - before;
+
+	parser = cfg_parser_new();
+	fail_unless(parser);
+	fail_unless(cfg_parser_parse(parser, cfg, file) == CFG_SUCCESS);
+
+	before = allocs;
+	for (i = 0; i < RELOADS; i++)
+		fail_unless(cfg_parser_parse(parser, cfg, file) == CFG_SUCCESS);
+	reuse = allocs - before;
+
+	if (bench_enabled())
+		printf("allocs per reload: cfg_parse() %.1f, cfg_parser_parse() %.1f\n",
+		       (double)plain / RELOADS, (double)reuse / RELOADS);
+	fail_unless(reuse <= 2 * RELOADS);
+	fail_unless(reuse < plain);
+	fail_unless(cfg_getint(cfg, "z") == 25);
+
+	/* Errors leave nothing behind for the next parse */
+	fail_unless(cfg_parser_parse_mem(parser, cfg, "a = \"unterminated", 17) == CFG_PARSE_ERROR);
+	fail_unless(cfg_parser_parse_mem(parser, cfg, "a = 'x", 6) == CFG_PARSE_ERROR);
+	fail_unless(cfg_parser_parse_mem(parser, cfg, "/* unterminated", 15) == CFG_SUCCESS);
+	fail_unless(cfg_parser_parse_mem(parser, cfg, "b = 42", 6) == CFG_SUCCESS);
+	fail_unless(cfg_getint(cfg, "b") == 42);
+
+	fd = mkstemp(bad);
+	fail_unless(fd >= 0);
+	fail_unless(write(fd, "c = foo\n", 8) == 8);
+	close(fd);
+	snprintf(buf, sizeof(buf), "d = 1\ninclude(\"%s\")\ne = 2\n", bad);
+	fail_unless(cfg_parser_parse_mem(parser, cfg, buf, strlen(buf)) == CFG_PARSE_ERROR);
+	fail_unless(cfg_parser_parse_mem(parser, cfg, "c = 3", 5) == CFG_SUCCESS);
+	fail_unless(cfg_getint(cfg, "c") == 3);
+
+	/* Larger input than before, and back to the file */
+	memset(buf, ' ', sizeof(buf));
+	memcpy(buf + sizeof(buf) - 6, "f = 6", 5);
+	fail_unless(cfg_parser_parse_mem(parser, cfg, buf, sizeof(buf) - 1) == CFG_SUCCESS);
+	fail_unless(cfg_getint(cfg, "f") == 6);
+	fail_unless(cfg_parser_parse(parser, cfg, file) == CFG_SUCCESS);
+	fail_unless(cfg_getint(cfg, "f") == 5);
+
+	cfg_parser_free(parser);
+	cfg_free(cfg);
+	unlink(file);
+	unlink(bad);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,117 @@
+/* Test compiled option paths, cfg_path_compile() and cfg_path_getopt() */
+
+#include "check_confuse.h"
+#include <errno.h>
+#include <string.h>
+
+int main(void)
+{
+	static cfg_opt_t sub_opts[] = {
+		CFG_INT("port", 0, CFGF_NONE),
+		CFG_STR_LIST("names", "{one, two}", CFGF_NONE),
+		CFG_END()
+	};
+	static cfg_opt_t nested_opts[] = {
+		CFG_SEC("sub", sub_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_END()
+	};
+	static cfg_opt_t c_opts[] = {
+		CFG_INT("v", 0, CFGF_NONE),
+		CFG_END()
+	};
+	static cfg_opt_t b_opts[] = {
+		CFG_SEC("c", c_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_END()
+	};
+	static cfg_opt_t a_opts[] = {
+		CFG_SEC("b", b_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_END()
+	};
+	cfg_opt_t opts[] = {
+		CFG_INT("level", 1, CFGF_NONE),
+		CFG_SEC("sub", sub_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_SEC("nested", nested_opts, CFGF_NONE),
+		CFG_SEC("a", a_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_END()
+	};
+	const char *buf =
+		"sub a { port = 1 }\n"
+		"sub b { port = 2 }\n"
+		"sub 'c|d' { port = 3 }\n"
+		"nested { sub x { port = 4 names = {three} } }\n"
+		"a x { b y { c z { v = 5 } } }\n";
+	cfg_path_t *level, *port, *names, *quoted, *nested, *deep;
+	cfg_t *cfg, *other;
+	cfg_opt_t *opt;
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+
+	level = cfg_path_compile(cfg, "level");
+	port = cfg_path_compile(cfg, "sub=b|port");
+	names = cfg_path_compile(cfg, "sub=a|names");
+	quoted = cfg_path_compile(cfg, "sub='c|d'|port");
+	nested = cfg_path_compile(cfg, "nested|sub=x|port");
+	/* Quoted titles need no '|' after them */
+	deep = cfg_path_compile(cfg, "a='x'b='y'c='z'v");
+	fail_unless(level && port && names && quoted && nested && deep);
+
+	fail_unless(cfg_path_compile(cfg, "sub=nosuch|port") == NULL);
+	fail_unless(cfg_path_compile(cfg, "nosuch") == NULL);
+
+	fail_unless(cfg_opt_getnint(cfg_path_getopt(cfg, level), 0) == 1);
+	fail_unless(cfg_opt_getnint(cfg_path_getopt(cfg, port), 0) == 2);
+	fail_unless(cfg_opt_getnint(cfg_path_getopt(cfg, quoted), 0) == 3);
+	fail_unless(cfg_opt_getnint(cfg_path_getopt(cfg, nested), 0) == 4);
+	fail_unless(cfg_opt_getnint(cfg_path_getopt(cfg, deep), 0) == 5);
+	fail_unless(cfg_path_getopt(cfg, deep) == cfg_getopt(cfg, "a='x'b='y'c='z'v"));
+	opt = cfg_path_getopt(cfg, names);
+	fail_unless(cfg_opt_size(opt) == 2);
+	fail_unless(strcmp(cfg_opt_getnstr(opt, 1), "two") == 0);
+
+	/* Same option as the regular lookup, and follows value changes */
+	fail_unless(cfg_path_getopt(cfg, port) == cfg_getopt(cfg, "sub=b|port"));
+	fail_unless(cfg_setint(cfg, "sub=b|port", 22) == 0);
+	fail_unless(cfg_opt_getnint(cfg_path_getopt(cfg, port), 0) == 22);
+
+	/* Only valid for the context it was compiled for */
+	other = cfg_init(opts, CFGF_NONE);
+	fail_unless(other);
+	errno = 0;
+	fail_unless(cfg_path_getopt(other, level) == NULL && errno == EINVAL);
+	cfg_free(other);
+
+	/* Removing a section makes paths through that option stale */
+	fail_unless(cfg_rmtsec(cfg, "sub", "a") == 0);
+	errno = 0;
+	fail_unless(cfg_path_getopt(cfg, port) == NULL && errno == ESTALE);
+	fail_unless(cfg_path_getopt(cfg, names) == NULL && errno == ESTALE);
+	fail_unless(cfg_opt_getnint(cfg_path_getopt(cfg, level), 0) == 1);
+	fail_unless(cfg_opt_getnint(cfg_path_getopt(cfg, nested), 0) == 4);
+
+	cfg_path_free(port);
+	port = cfg_path_compile(cfg, "sub=b|port");
+	fail_unless(port);
+	fail_unless(cfg_opt_getnint(cfg_path_getopt(cfg, port), 0) == 22);
+
+	fail_unless(cfg_rmtsec(cfg, "nested|sub", "x") == 0);
+	fail_unless(cfg_path_getopt(cfg, nested) == NULL && errno == ESTALE);
+
+	cfg_path_free(level);
+	cfg_path_free(port);
+	cfg_path_free(names);
+	cfg_path_free(quoted);
+	cfg_path_free(nested);
+	cfg_path_free(deep);
+	cfg_free(cfg);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
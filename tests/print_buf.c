@@ -0,0 +1,245 @@
+/* Print to memory with cfg_print_buf(), compared to the old printer
+ * that wrote every character with fprintf()
+ */
+
+#include "check_confuse.h"
+#include <errno.h>
+#include <string.h>
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("port", 80, CFGF_NONE),
+	CFG_STR("address", NULL, CFGF_NONE),
+	CFG_STR_LIST("alias", "{www}", CFGF_NONE),
+	CFG_FLOAT("weight", 1.0, CFGF_NONE),
+	CFG_BOOL("enabled", cfg_true, CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t opts[] = {
+	CFG_STR("name", NULL, CFGF_NONE),
+	CFG_INT("secret", 0, CFGF_NONE),
+	CFG_INT("custom", 7, CFGF_NONE),
+	CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_END()
+};
+
+static char *print(cfg_t *cfg, size_t *len)
+{
+	FILE *fp = tmpfile();
+	char *buf;
+	long n;
+
+	fail_unless(fp);
+	fail_unless(cfg_print(cfg, fp) == CFG_SUCCESS);
+	n = ftell(fp);
+	rewind(fp);
+	buf = malloc(n + 1);
+	fail_unless(buf);
+	fail_unless(fread(buf, 1, n, fp) == (size_t)n);
+	buf[n] = 0;
+	fclose(fp);
+	*len = n;
+
+	return buf;
+}
+
+/* cfg_print() before it was buffered, without comments or callbacks */
+static void old_print(cfg_t *cfg, FILE *fp, int indent)
+{
+	cfg_opt_t *opt;
+	unsigned int i, j;
+	const char *str;
+	cfg_t *sec;
+	int k, list;
+
+	for (opt = cfg_firstopt(cfg); opt; opt = cfg_nextopt(opt)) {
+		if (opt->type == CFGT_SEC) {
+			i = 0;
+			while ((sec = cfg_opt_nextsec(opt, &i)) != NULL) {
+				for (k = 0; k < indent; k++)
+					fprintf(fp, "  ");
+				fprintf(fp, "%s \"%s\" {\n", opt->name, cfg_title(sec));
+				old_print(sec, fp, indent + 1);
+				for (k = 0; k < indent; k++)
+					fprintf(fp, "  ");
+				fprintf(fp, "}\n");
+			}
+			continue;
+		}
+
+		list = (opt->flags & CFGF_LIST) != 0;
+		for (k = 0; k < indent; k++)
+			fprintf(fp, "  ");
+		if (list)
+			fprintf(fp, "%s = {", opt->name);
+		else if (cfg_opt_size(opt) == 0 || (opt->type == CFGT_STR && !cfg_opt_getnstr(opt, 0)))
+			fprintf(fp, "# %s=", opt->name);
+		else
+			fprintf(fp, "%s=", opt->name);
+
+		for (j = 0; j < (list ? cfg_opt_size(opt) : 1); j++) {
+			if (j)
+				fprintf(fp, ", ");
+			switch (opt->type) {
+			case CFGT_INT:
+				fprintf(fp, "%ld", cfg_opt_getnint(opt, j));
+				break;
+			case CFGT_FLOAT:
+				fprintf(fp, "%f", cfg_opt_getnfloat(opt, j));
+				break;
+			case CFGT_BOOL:
+				fprintf(fp, "%s", cfg_opt_getnbool(opt, j) ? "true" : "false");
+				break;
+			default:
+				str = cfg_opt_getnstr(opt, j);
+				fprintf(fp, "\"");
+				while (str && *str) {
+					if (*str == '"')
+						fprintf(fp, "\\\"");
+					else if (*str == '\\')
+						fprintf(fp, "\\\\");
+					else
+						fprintf(fp, "%c", *str);
+					str++;
+				}
+				fprintf(fp, "\"");
+				break;
+			}
+		}
+		fprintf(fp, list ? "}\n" : "\n");
+	}
+}
+
+static void custom_print(cfg_opt_t *opt, unsigned int index, FILE *fp)
+{
+	fprintf(fp, "<%ld>", cfg_opt_getnint(opt, index));
+}
+
+static int hide_secret(cfg_t *cfg, cfg_opt_t *opt)
+{
+	(void)cfg;
+	return strcmp(opt->name, "secret") == 0;
+}
+
+static void text(void)
+{
+	const char *expected =
+		"name=\"say \\\"hi\\\" C:\\\\dir\"\n"
+		"custom=<7>\n"
+		"host \"a\" {\n"
+		"  /* the port */\n"
+		"  port=8080\n"
+		"  # address=\"\"\n"
+		"  alias = {\"x\", \"\"}\n"
+		"  weight=0.500000\n"
+		"  enabled=false\n"
+		"}\n";
+	size_t len, flen;
+	char *buf, *file;
+	cfg_t *cfg;
+
+	cfg = cfg_init(opts, CFGF_COMMENTS);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, "name = 'say \"hi\" C:\\\\dir' secret = 42\n"
+				  "host a {\n/* the port */\nport = 8080 alias = {x, \"\"} weight = 0.5 enabled = false }") == CFG_SUCCESS);
+	cfg_set_print_func(cfg, "custom", custom_print);
+	cfg_set_print_filter_func(cfg, hide_secret);
+
+	buf = cfg_print_buf(cfg, &len);
+	fail_unless(buf);
+	fail_unless(strcmp(buf, expected) == 0);
+	fail_unless(len == strlen(expected));
+
+	/* The same through a stream */
+	file = print(cfg, &flen);
+	fail_unless(flen == len && strcmp(file, buf) == 0);
+	free(file);
+	free(buf);
+
+	/* Nothing to print */
+	cfg_set_print_filter_func(cfg, NULL);
+	cfg_set_print_filter_func(cfg_getnsec(cfg, "host", 0), NULL);
+	buf = cfg_print_buf(cfg_getnsec(cfg, "host", 0), NULL);
+	fail_unless(buf && strstr(buf, "port=8080\n") != NULL);
+	free(buf);
+
+	errno = 0;
+	len = 42;
+	fail_unless(cfg_print_buf(NULL, &len) == NULL);
+	fail_unless(errno == EINVAL);
+	fail_unless(len == 42);
+	fail_unless(cfg_print(NULL, stdout) == CFG_FAIL);
+
+	cfg_free(cfg);
+}
+
+static void bench(void)
+{
+	unsigned int i, num_hosts = test_size(100, 40000);
+	double start, old_time, file_time, buf_time;
+	size_t len, old_len;
+	char *input, *buf, *old_buf;
+	cfg_t *cfg;
+	FILE *fp;
+
+	input = malloc(num_hosts * 160);
+	fail_unless(input);
+	len = 0;
+	for (i = 0; i < num_hosts; i++)
+		len += sprintf(input + len, "host h%u { port = %u address = \"10.0.%u.%u\"\n"
+			       "alias = {\"web %u\", \"/srv/www/site-%u/public_html/index.html\", \"C:\\\\www\"} }\n",
+			       i, i, i / 256, i % 256, i, i);
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, input) == CFG_SUCCESS);
+
+	fp = tmpfile();
+	fail_unless(fp);
+	start = now();
+	old_print(cfg, fp, 0);
+	old_time = now() - start;
+	old_len = ftell(fp);
+	rewind(fp);
+	old_buf = malloc(old_len + 1);
+	fail_unless(old_buf);
+	fail_unless(fread(old_buf, 1, old_len, fp) == old_len);
+	old_buf[old_len] = 0;
+
+	rewind(fp);
+	start = now();
+	fail_unless(cfg_print(cfg, fp) == CFG_SUCCESS);
+	file_time = now() - start;
+	fail_unless((size_t)ftell(fp) == old_len);
+	fclose(fp);
+
+	start = now();
+	buf = cfg_print_buf(cfg, &len);
+	buf_time = now() - start;
+	fail_unless(buf);
+	fail_unless(len == old_len && strcmp(buf, old_buf) == 0);
+
+	if (bench_enabled())
+		printf("%u hosts, %zu bytes: fprintf %.1f ms, cfg_print %.1f ms, cfg_print_buf %.1f ms\n",
+		       num_hosts, len, old_time * 1e3, file_time * 1e3, buf_time * 1e3);
+
+	cfg_free(cfg);
+	free(old_buf);
+	free(input);
+	free(buf);
+}
+
+int main(void)
+{
+	text();
+	bench();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,97 @@
+/* Large quoted strings and comments, timed with CONFUSE_BENCH
+ *
+ * Certificates, scripts and the like are embedded as quoted strings,
+ * these must be accumulated in linear time.
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+
+/* 64 character lines, like a PEM certificate */
+static char *payload(char *p, size_t size, const char *nl)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (i % 65 == 64) {
+			p += sprintf(p, "%s", nl);
+			continue;
+		}
+		*p++ = 'A' + i % 26;
+	}
+	*p = 0;
+
+	return p;
+}
+
+static void check(const char *str, size_t size)
+{
+	size_t i;
+
+	fail_unless(str);
+	fail_unless(strlen(str) == size);
+	for (i = 0; i < size; i++) {
+		if (str[i] != (i % 65 == 64 ? '\n' : 'A' + i % 26)) {
+			printf("mismatch at %zu\n", i);
+			fail_unless(0);
+		}
+	}
+}
+
+int main(void)
+{
+	cfg_opt_t opts[] = {
+		CFG_STR("dq", NULL, CFGF_NONE),
+		CFG_STR("sq", NULL, CFGF_NONE),
+		CFG_INT("opt", 0, CFGF_NONE),
+		CFG_STR("mixed", NULL, CFGF_NONE),
+		CFG_END()
+	};
+	size_t size = test_size(64 * 1024, 1024 * 1024);
+	double start;
+	cfg_t *cfg;
+	char *buf, *p;
+
+	/* Escaped newlines in the double quoted string */
+	buf = malloc(4 * size);
+	fail_unless(buf);
+	p = buf + sprintf(buf, "dq = \"");
+	p = payload(p, size, "\\n");
+	p += sprintf(p, "\"\nsq = '");
+	p = payload(p, size, "\n");
+	p += sprintf(p, "'\n/*");
+	p = payload(p, size, "\n");
+	p += sprintf(p, "*/\nopt = 1\n");
+	sprintf(p, "mixed = \"$$ a${CONFUSE_QS_TEST}b $HOME ${CONFUSE_QS_UNSET:-c}\\tq\\\"\"\n");
+
+	fail_unless(setenv("CONFUSE_QS_TEST", "env", 1) == 0);
+	fail_unless(unsetenv("CONFUSE_QS_UNSET") == 0);
+
+	cfg = cfg_init(opts, CFGF_COMMENTS);
+	fail_unless(cfg);
+
+	start = now();
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+	if (bench_enabled())
+		printf("%.1f MB of quoted strings and comments in %.3f s\n",
+		       3.0 * size / (1024 * 1024), now() - start);
+
+	check(cfg_getstr(cfg, "dq"), size);
+	check(cfg_getstr(cfg, "sq"), size);
+	/* Comments are trimmed, the payload has no leading or trailing blanks */
+	check(cfg_getcomment(cfg, "opt"), size);
+	fail_unless(cfg_getint(cfg, "opt") == 1);
+	fail_unless(strcmp(cfg_getstr(cfg, "mixed"), "$$ aenvb $HOME c\tq\"") == 0);
+
+	cfg_free(cfg);
+	free(buf);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
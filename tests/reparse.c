@@ -0,0 +1,236 @@
+/* Incremental reparse with cfg_reparse_buf(), compared to a cold parse
+ *
+ * Linked with -Wl,--wrap=malloc,... to count allocations, see Makefile.am
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("port", 80, CFGF_NONE),
+	CFG_STR("address", NULL, CFGF_NONE),
+	CFG_STR_LIST("alias", "{www}", CFGF_NONE),
+	CFG_SEC("env", NULL, CFGF_KEYSTRVAL),
+	CFG_END()
+};
+
+static cfg_opt_t rule_opts[] = {
+	CFG_STR("match", "*", CFGF_NONE),
+	CFG_BOOL("deny", cfg_false, CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t log_opts[] = {
+	CFG_STR("file", "/dev/null", CFGF_NONE),
+	CFG_INT("level", 3, CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t opts[] = {
+	CFG_STR("name", "default", CFGF_NONE),
+	CFG_INT_LIST("ports", "{1, 2}", CFGF_NONE),
+	CFG_FLOAT("ratio", 0.5, CFGF_NONE),
+	CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_SEC("rule", rule_opts, CFGF_MULTI),
+	CFG_SEC("log", log_opts, CFGF_NONE),
+	CFG_END()
+};
+
+/* Each one is reparsed over the previous one */
+static const char *inputs[] = {
+	"",
+	"name = one ports = {10, 20, 30}\n"
+	"host a { port = 1 address = \"10.0.0.1\" env { user = x } }\n"
+	"host b { alias = {b1, b2} }\n"
+	"rule { match = foo } rule { deny = true }\n"
+	"log { level = 7 }\n",
+	/* same again */
+	"name = one ports = {10, 20, 30}\n"
+	"host a { port = 1 address = \"10.0.0.1\" env { user = x } }\n"
+	"host b { alias = {b1, b2} }\n"
+	"rule { match = foo } rule { deny = true }\n"
+	"log { level = 7 }\n",
+	/* reordered, edited, added and removed */
+	"ratio = 0.25 ports += {40}\n"
+	"host c { port = 3 }\n"
+	"host b { alias = {b1} env { home = /b } }\n"
+	"host a { address = \"10.0.0.2\" env { shell = sh } }\n"
+	"rule { match = bar }\n",
+	/* titles in another case, duplicates replace */
+	"host A { port = 5 } host c { port = 6 } host c { alias = {} }\n"
+	"rule { } rule { } rule { match = baz }\n"
+	"log { file = \"/var/log/x\" }\n",
+	"name = two",
+	"",
+	/* syntax error halfway, same partial result as a cold parse */
+	"host a { port = 7 }\n"
+	"host b { port = }\n",
+	"host a { port = 8 }\n",
+};
+
+static char *print(cfg_t *cfg)
+{
+	char *buf = NULL;
+	size_t len;
+	FILE *fp;
+
+	fp = open_memstream(&buf, &len);
+	fail_unless(fp);
+	fail_unless(cfg_print(cfg, fp) == CFG_SUCCESS);
+	fclose(fp);
+
+	return buf;
+}
+
+static void error_quiet(cfg_t *cfg, const char *fmt, va_list ap)
+{
+}
+
+static void compare(cfg_flag_t flags)
+{
+	cfg_t *cfg, *cold;
+	size_t i;
+
+	cfg = cfg_init(opts, flags);
+	fail_unless(cfg);
+	cfg_set_error_function(cfg, error_quiet);
+
+	for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+		char *a, *b;
+		int ret;
+
+		cold = cfg_init(opts, flags);
+		fail_unless(cold);
+		cfg_set_error_function(cold, error_quiet);
+
+		ret = cfg_parse_buf(cold, inputs[i]);
+		fail_unless(cfg_reparse_buf(cfg, inputs[i]) == ret);
+
+		a = print(cfg);
+		b = print(cold);
+		if (strcmp(a, b))
+			printf("input %zu differs:\n%s\n--- cold parse:\n%s\n", i, a, b);
+		fail_unless(strcmp(a, b) == 0);
+		free(a);
+		free(b);
+
+		fail_unless(cfg_size(cfg, "host") == cfg_size(cold, "host"));
+		fail_unless(!(cfg_getopt(cfg, "ratio")->flags & CFGF_MODIFIED) ==
+			    !(cfg_getopt(cold, "ratio")->flags & CFGF_MODIFIED));
+		cfg_free(cold);
+	}
+
+	cfg_free(cfg);
+}
+
+static void recycle(void)
+{
+	cfg_t *cfg, *a, *b;
+	char *addr;
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, inputs[1]) == CFG_SUCCESS);
+	a = cfg_gettsec(cfg, "host", "a");
+	b = cfg_gettsec(cfg, "host", "b");
+	addr = cfg_getstr(a, "address");
+
+	/* Moved and edited sections are the same objects */
+	fail_unless(cfg_reparse_buf(cfg, inputs[3]) == CFG_SUCCESS);
+	fail_unless(cfg_gettsec(cfg, "host", "a") == a);
+	fail_unless(cfg_gettsec(cfg, "host", "b") == b);
+	fail_unless(cfg_getnsec(cfg, "host", 2) == a);
+	fail_unless(cfg_getint(a, "port") == 80);
+	fail_unless(strcmp(cfg_getstr(a, "address"), "10.0.0.2") == 0);
+	fail_unless(cfg_getopt(a, "env|user") == NULL);
+	fail_unless(strcmp(cfg_getstr(a, "env|shell"), "sh") == 0);
+	fail_unless(cfg_getnint(cfg, "ports", 2) == 40);
+	fail_unless(strcmp(cfg_getstr(cfg, "name"), "default") == 0);
+
+	/* Unchanged strings are kept */
+	fail_unless(cfg_reparse_buf(cfg, "host a { address = \"10.0.0.2\" }") == CFG_SUCCESS);
+	fail_unless(cfg_gettsec(cfg, "host", "a") == a);
+	addr = cfg_getstr(a, "address");
+	fail_unless(cfg_reparse_buf(cfg, "host a { address = \"10.0.0.2\" port = 1 }") == CFG_SUCCESS);
+	fail_unless(cfg_getstr(a, "address") == addr);
+
+	/* A file that cannot be opened changes nothing */
+	fail_unless(cfg_reparse(cfg, "/nonexistent/reparse.conf") == CFG_FILE_ERROR);
+	fail_unless(cfg_getint(cfg, "host=a|port") == 1);
+
+	cfg_free(cfg);
+}
+
+static void bench(void)
+{
+	unsigned int i, num_hosts = test_size(100, 20000);
+	unsigned long before, cold_allocs, warm_allocs;
+	double start, cold_time, warm_time;
+	cfg_t *cfg, *sec;
+	char *buf, *edit;
+	size_t len;
+
+	buf = malloc(num_hosts * 200);
+	fail_unless(buf);
+	for (i = 0, len = 0; i < num_hosts; i++)
+		len += sprintf(buf + len, "host host%u {\n port = %u\n address = \"10.0.%u.%u\"\n"
+			       " alias = {web%u, www%u}\n env { user = user%u }\n}\n",
+			       i, i, i / 256, i % 256, i, i, i);
+
+	before = allocs;
+	start = now();
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+	cold_time = now() - start;
+	cold_allocs = allocs - before;
+	sec = cfg_gettsec(cfg, "host", "host47");
+
+	/* Change one value, same length */
+	edit = strstr(buf, "port = 47\n");
+	fail_unless(edit);
+	memcpy(edit, "port = 48", 9);
+	edit = strstr(buf, "10.0.0.47\"");
+	fail_unless(edit);
+	memcpy(edit, "10.0.0.48", 9);
+
+	before = allocs;
+	start = now();
+	fail_unless(cfg_reparse_buf(cfg, buf) == CFG_SUCCESS);
+	warm_time = now() - start;
+	warm_allocs = allocs - before;
+
+	if (bench_enabled())
+		printf("cold parse %8lu allocs, %.3f s\nreparse    %8lu allocs, %.3f s\n",
+		       cold_allocs, cold_time, warm_allocs, warm_time);
+	/* A handful for the changed value and the scanner, whatever the size */
+	fail_unless(warm_allocs < 16 && warm_allocs * 100 < cold_allocs);
+
+	fail_unless(cfg_size(cfg, "host") == num_hosts);
+	fail_unless(cfg_gettsec(cfg, "host", "host47") == sec);
+	fail_unless(cfg_getint(sec, "port") == 48);
+	fail_unless(strcmp(cfg_getstr(sec, "address"), "10.0.0.48") == 0);
+	fail_unless(strcmp(cfg_getstr(cfg, "host=host47|env|user"), "user47") == 0);
+
+	cfg_free(cfg);
+	free(buf);
+}
+
+int main(void)
+{
+	compare(CFGF_NONE);
+	compare(CFGF_NOCASE);
+	compare(CFGF_ARENA);
+	compare(CFGF_LAZY);
+	recycle();
+	bench();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
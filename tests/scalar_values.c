@@ -0,0 +1,94 @@
+/* Allocations and read time for a scalar-heavy config
+ *
+ * Scalar values are stored inline in the option, so parsing them must
+ * not allocate anything beyond the section itself.  Linked with
+ * -Wl,--wrap=malloc,... to count allocations, see Makefile.am
+ */
+
+#include "check_confuse.h"
+#include <string.h>
+
+#define NUM_SCALARS  8
+
+int main(void)
+{
+	cfg_opt_t sensor_opts[] = {
+		CFG_INT("id", 0, CFGF_NONE),
+		CFG_INT("min", 0, CFGF_NONE),
+		CFG_INT("max", 0, CFGF_NONE),
+		CFG_INT("interval", 0, CFGF_NONE),
+		CFG_FLOAT("scale", 1.0, CFGF_NONE),
+		CFG_FLOAT("offset", 0.0, CFGF_NONE),
+		CFG_BOOL("enabled", cfg_false, CFGF_NONE),
+		CFG_BOOL("inverted", cfg_false, CFGF_NONE),
+		CFG_END()
+	};
+	cfg_opt_t opts[] = {
+		CFG_SEC("sensor", sensor_opts, CFGF_MULTI),
+		CFG_END()
+	};
+	int num_sections = test_size(100, 10000);
+	int rounds = test_size(1, 20);
+	unsigned long before, per_section;
+	double start, sum = 0;
+	size_t len;
+	cfg_t *cfg;
+	char *buf;
+	int i, j;
+
+	buf = malloc(num_sections * 160);
+	fail_unless(buf);
+	for (i = 0, len = 0; i < num_sections; i++)
+		len += sprintf(buf + len, "sensor { id = %d min = -%d max = %d interval = 10 "
+			       "scale = 0.5 offset = 1.5 enabled = true inverted = false }\n", i, i, i);
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+
+	before = allocs;
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+	per_section = (allocs - before) / num_sections;
+	if (bench_enabled())
+		printf("%lu allocs per section of %d scalars\n", per_section, NUM_SCALARS);
+	fail_unless(per_section < NUM_SCALARS);
+
+	start = now();
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < num_sections; i++) {
+			cfg_t *sec = cfg_getnsec(cfg, "sensor", i);
+			unsigned int k;
+
+			for (k = 0; k < cfg_num(sec); k++) {
+				cfg_opt_t *opt = cfg_getnopt(sec, k);
+
+				switch (opt->type) {
+				case CFGT_INT:
+					sum += cfg_opt_getnint(opt, 0);
+					break;
+				case CFGT_FLOAT:
+					sum += cfg_opt_getnfloat(opt, 0);
+					break;
+				default:
+					sum += cfg_opt_getnbool(opt, 0);
+					break;
+				}
+			}
+		}
+	}
+	if (bench_enabled())
+		printf("read %d values in %.1f ns/value\n", rounds * num_sections * NUM_SCALARS,
+		       (now() - start) * 1e9 / (rounds * num_sections * NUM_SCALARS));
+	fail_unless(sum == rounds * (num_sections * (10 + 0.5 + 1.5 + 1) + (num_sections - 1.0) * num_sections / 2));
+
+	cfg_free(cfg);
+	free(buf);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,80 @@
+/* Test that section instances share option definitions, but not state */
+
+#include "check_confuse.h"
+#include <string.h>
+
+static int validated;
+
+static int validate_port(cfg_t *cfg, cfg_opt_t *opt)
+{
+	validated++;
+	return 0;
+}
+
+int main(void)
+{
+	cfg_opt_t host_opts[] = {
+		CFG_INT("port", 80, CFGF_NONE),
+		CFG_STR_LIST("alias", "{www}", CFGF_NONE),
+		CFG_SEC("env", NULL, CFGF_KEYSTRVAL),
+		CFG_END()
+	};
+	cfg_opt_t opts[] = {
+		CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_END()
+	};
+	const char *buf =
+		"host a { port = 1 env { foo = bar } }\n"
+		"/* b comment */\n"
+		"host b { env { baz = qux } }\n";
+	cfg_t *cfg, *a, *b;
+
+	cfg = cfg_init(opts, CFGF_COMMENTS);
+	fail_unless(cfg);
+
+	/* Applies to the shared definition, i.e. all new sections */
+	fail_unless(cfg_set_validate_func(cfg, "host|port", validate_port) == NULL);
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+	fail_unless(validated == 1);
+
+	a = cfg_gettsec(cfg, "host", "a");
+	b = cfg_gettsec(cfg, "host", "b");
+	fail_unless(a && b);
+
+	/* Same definition ... */
+	fail_unless(cfg_getopt(a, "port")->name == cfg_getopt(b, "port")->name);
+	fail_unless(cfg_getopt(a, "alias")->def.parsed == cfg_getopt(b, "alias")->def.parsed);
+
+	/* ... separate values, flags, and comments */
+	fail_unless(cfg_getint(a, "port") == 1);
+	fail_unless(cfg_getint(b, "port") == 80);
+	fail_unless(cfg_getopt(a, "port")->flags & CFGF_MODIFIED);
+	fail_unless(!(cfg_getopt(b, "port")->flags & CFGF_MODIFIED));
+	fail_unless(cfg_setcomment(a, "port", "a port") == CFG_SUCCESS);
+	fail_unless(cfg_getcomment(b, "port") == NULL);
+	fail_unless(cfg_setlist(a, "alias", 2, "web", "mail") == CFG_SUCCESS);
+	fail_unless(cfg_size(a, "alias") == 2);
+	fail_unless(cfg_size(b, "alias") == 1);
+
+	/* Free-form options are private to their section */
+	fail_unless(strcmp(cfg_getstr(a, "env|foo"), "bar") == 0);
+	fail_unless(cfg_getopt(b, "env|foo") == NULL);
+	fail_unless(strcmp(cfg_getstr(b, "env|baz"), "qux") == 0);
+
+	/* Removing and re-adding sections keep working */
+	fail_unless(cfg_rmtsec(cfg, "host", "a") == CFG_SUCCESS);
+	fail_unless(cfg_getint(b, "port") == 80);
+	a = cfg_addtsec(cfg, "host", "a");
+	fail_unless(a && cfg_getint(a, "port") == 80);
+
+	cfg_free(cfg);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,219 @@
+/* Publish snapshots with cfg_live_publish() to concurrent readers */
+
+#include "check_confuse.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#define NUM_READERS  4
+#define NUM_PUBLISH  200
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("port", 80, CFGF_NONE),
+	CFG_INT("generation", 0, CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t log_opts[] = {
+	CFG_INT("level", 3, CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t opts[] = {
+	CFG_INT("generation", 0, CFGF_NONE),
+	CFG_INT_LIST("ports", "{1, 2}", CFGF_NONE),
+	CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_SEC("log", log_opts, CFGF_NONE),
+	CFG_END()
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static cfg_live_t *live;
+static int done;
+
+static void print_ports(cfg_opt_t *opt, unsigned int index, FILE *fp)
+{
+}
+
+static int validate(cfg_t *cfg, cfg_opt_t *opt)
+{
+	return 0;
+}
+
+static int validate2(cfg_t *cfg, cfg_opt_t *opt, void *value)
+{
+	return 0;
+}
+
+static void changed(cfg_t *cfg, cfg_opt_t *opt, cfg_diff_t what, unsigned int index)
+{
+}
+
+static int filter(cfg_t *cfg, cfg_opt_t *opt)
+{
+	return 0;
+}
+
+static void error(cfg_t *cfg, const char *fmt, va_list ap)
+{
+}
+
+static cfg_t *parse(long int generation, cfg_flag_t flags)
+{
+	char buf[256];
+	cfg_t *cfg;
+
+	snprintf(buf, sizeof(buf), "generation = %ld host a { generation = %ld } host b { generation = %ld }",
+		 generation, generation, generation);
+	cfg = cfg_init(opts, flags);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+
+	return cfg;
+}
+
+static void frozen(cfg_flag_t flags)
+{
+	cfg_snapshot_t *snap, *old;
+	cfg_t *cfg;
+
+	fail_unless(cfg_live_new(NULL) == NULL);
+	fail_unless(cfg_live_acquire(NULL) == NULL);
+
+	live = cfg_live_new(parse(1, flags));
+	fail_unless(live);
+
+	/* Everything is there, nothing can be changed */
+	old = cfg_live_acquire(live);
+	cfg = cfg_snapshot_cfg(old);
+	fail_unless(cfg_getint(cfg, "generation") == 1);
+	fail_unless(cfg_getint(cfg, "log|level") == 3);
+	fail_unless(cfg_getint(cfg, "host=b|generation") == 1);
+	fail_unless(cfg_gettsec(cfg, "host", "c") == NULL);
+
+	errno = 0;
+	fail_unless(cfg_setint(cfg, "generation", 2) == CFG_FAIL);
+	fail_unless(errno == EPERM);
+	fail_unless(cfg_setint(cfg, "log|level", 2) == CFG_FAIL);
+	fail_unless(cfg_addlist(cfg, "ports", 1, 3) == CFG_FAIL);
+	fail_unless(cfg_setlist(cfg, "ports", 1, 3) == CFG_FAIL);
+	fail_unless(cfg_addtsec(cfg, "host", "c") == NULL);
+	fail_unless(cfg_rmtsec(cfg, "host", "a") == CFG_FAIL);
+	fail_unless(cfg_setcomment(cfg, "generation", "no") == CFG_FAIL);
+	fail_unless(cfg_parse_buf(cfg, "generation = 2") == CFG_PARSE_ERROR);
+	fail_unless(cfg_reparse_buf(cfg, "generation = 2") == CFG_PARSE_ERROR);
+	fail_unless(cfg_free_value(cfg_getopt(cfg, "ports")) == CFG_FAIL);
+	fail_unless(cfg_opt_reserve(cfg_getopt(cfg, "ports"), 10) == CFG_FAIL);
+	fail_unless(cfg_add_searchpath(cfg, "/tmp") == CFG_FAIL);
+
+	/* Nor any callbacks */
+	errno = 0;
+	fail_unless(cfg_set_print_func(cfg, "ports", print_ports) == NULL);
+	fail_unless(errno == EPERM);
+	fail_unless(cfg_set_validate_func(cfg, "ports", validate) == NULL);
+	fail_unless(cfg_set_validate_func2(cfg, "ports", validate2) == NULL);
+	fail_unless(cfg_set_change_func(cfg, "ports", changed) == NULL);
+	fail_unless(cfg_set_sec_change_func(cfg, changed) == NULL);
+	fail_unless(cfg_set_print_filter_func(cfg, filter) == NULL);
+	fail_unless(cfg_set_error_function(cfg, error) == NULL);
+	fail_unless(cfg_getopt(cfg, "ports")->pf == NULL);
+	fail_unless(cfg_getopt(cfg, "ports")->validcb == NULL && cfg_getopt(cfg, "ports")->validcb2 == NULL);
+	fail_unless(cfg_getopt(cfg, "ports")->changecb == NULL && cfg->changecb == NULL);
+	fail_unless(cfg->pff == NULL && cfg->errfunc == NULL && cfg->path == NULL);
+
+	fail_unless(cfg_getint(cfg, "generation") == 1);
+	fail_unless(cfg_size(cfg, "ports") == 2 && cfg_size(cfg, "host") == 2);
+
+	/* A held snapshot outlives its replacement */
+	fail_unless(cfg_live_publish(live, parse(2, flags)) == CFG_SUCCESS);
+	fail_unless(cfg_live_publish(live, NULL) == CFG_FAIL);
+	snap = cfg_live_acquire(live);
+	fail_unless(snap != old);
+	fail_unless(cfg_getint(cfg_snapshot_cfg(snap), "generation") == 2);
+	fail_unless(cfg_getint(cfg, "host=a|generation") == 1);
+	cfg_snapshot_release(snap);
+
+	cfg_live_free(live);
+	fail_unless(cfg_getint(cfg, "host=a|generation") == 1);
+	cfg_snapshot_release(old);
+}
+
+static int is_done(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&lock);
+	ret = done;
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+static void *reader(void *arg)
+{
+	unsigned long *count = arg;
+
+	while (!is_done()) {
+		cfg_snapshot_t *snap = cfg_live_acquire(live);
+		cfg_t *cfg = cfg_snapshot_cfg(snap);
+		long int generation = cfg_getint(cfg, "generation");
+
+		/* Never a mix of two configurations */
+		fail_unless(cfg_getint(cfg, "host=a|generation") == generation);
+		fail_unless(cfg_getint(cfg, "host=b|generation") == generation);
+		fail_unless(cfg_getint(cfg, "log|level") == 3);
+		cfg_snapshot_release(snap);
+		(*count)++;
+	}
+
+	return NULL;
+}
+
+static void stress(cfg_flag_t flags)
+{
+	pthread_t threads[NUM_READERS];
+	unsigned long counts[NUM_READERS] = { 0 }, total = 0;
+	double start, elapsed;
+	int i;
+
+	live = cfg_live_new(parse(0, flags));
+	fail_unless(live);
+
+	done = 0;
+	start = now();
+	for (i = 0; i < NUM_READERS; i++)
+		fail_unless(pthread_create(&threads[i], NULL, reader, &counts[i]) == 0);
+
+	for (i = 1; i <= NUM_PUBLISH; i++)
+		fail_unless(cfg_live_publish(live, parse(i, flags)) == CFG_SUCCESS);
+
+	pthread_mutex_lock(&lock);
+	done = 1;
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < NUM_READERS; i++) {
+		pthread_join(threads[i], NULL);
+		total += counts[i];
+	}
+	elapsed = now() - start;
+
+	if (bench_enabled())
+		printf("%d readers, %d publishes: %.0f acquires/s\n", NUM_READERS, NUM_PUBLISH, total / elapsed);
+	cfg_live_free(live);
+}
+
+int main(void)
+{
+	frozen(CFGF_NONE);
+	frozen(CFGF_LAZY);
+	stress(CFGF_NONE);
+	stress(CFGF_LAZY);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,105 @@
+/* Parse distinct configurations concurrently, each thread with its own
+ * cfg_t, and check that no lexer state leaks between them
+ */
+
+#include "check_confuse.h"
+#include <pthread.h>
+#include <string.h>
+
+#define NUM_THREADS 8
+#define ROUNDS      200
+
+static cfg_opt_t sec_opts[] = {
+	CFG_INT("a", 1, CFGF_NONE),
+	CFG_INT("b", 2, CFGF_NONE),
+	CFG_STR_LIST("list", "{}", CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("port", 80, CFGF_NONE),
+	CFG_STR_LIST("alias", "{'www', \"web\"}", CFGF_NONE),
+	CFG_END()
+};
+
+static cfg_opt_t opts[] = {
+	CFG_INT("id", 0, CFGF_NONE),
+	CFG_STR("name", NULL, CFGF_NONE),
+	CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_SEC("sec", sec_opts, CFGF_MULTI | CFGF_TITLE),
+	CFG_FUNC("include", &cfg_include),
+	CFG_END()
+};
+
+static void quiet(cfg_t *cfg, const char *fmt, va_list ap)
+{
+}
+
+static void *worker(void *arg)
+{
+	long id = (long)arg;
+	char buf[512], name[64];
+	int i;
+
+	snprintf(name, sizeof(name), "thread \"%ld\"", id);
+	snprintf(buf, sizeof(buf),
+		 "/* thread %ld */\n"
+		 "id = %ld\n"
+		 "name = \"thread \\\"%ld\\\"\"\n"
+		 "host h%ld { port = %ld alias = {'a%ld', \"b%ld\"} }\n"
+		 "host default {}\n"
+		 "include(\"" SRC_DIR "/a.conf\")\n",
+		 id, id, id, id, id, id, id);
+
+	for (i = 0; i < ROUNDS; i++) {
+		cfg_t *cfg = cfg_init(opts, CFGF_NONE);
+
+		fail_unless(cfg);
+		cfg_set_error_function(cfg, quiet);
+
+		/* Errors must not leave state behind for the next parse */
+		if (i % 10 == 0) {
+			fail_unless(cfg_parse_buf(cfg, "host x { port = 'unterminated") == CFG_PARSE_ERROR);
+			cfg_free(cfg);
+			continue;
+		}
+
+		fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+		fail_unless(cfg_getint(cfg, "id") == id);
+		fail_unless(strcmp(cfg_getstr(cfg, "name"), name) == 0);
+		fail_unless(cfg_size(cfg, "host") == 2);
+		fail_unless(cfg_getint(cfg, "host=default|port") == 80);
+		fail_unless(strcmp(cfg_getnstr(cfg, "host=default|alias", 1), "web") == 0);
+		snprintf(name, sizeof(name), "host=h%ld|port", id);
+		fail_unless(cfg_getint(cfg, name) == id);
+		snprintf(name, sizeof(name), "b%ld", id);
+		fail_unless(strcmp(cfg_getnstr(cfg_getnsec(cfg, "host", 0), "alias", 1), name) == 0);
+		fail_unless(cfg_getint(cfg, "sec=acfg|a") == 5);
+		snprintf(name, sizeof(name), "thread \"%ld\"", id);
+
+		cfg_free(cfg);
+	}
+
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[NUM_THREADS];
+	long i;
+
+	for (i = 0; i < NUM_THREADS; i++)
+		fail_unless(pthread_create(&threads[i], NULL, worker, (void *)i) == 0);
+
+	for (i = 0; i < NUM_THREADS; i++)
+		fail_unless(pthread_join(threads[i], NULL) == 0);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
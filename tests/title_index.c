@@ -0,0 +1,114 @@
+/* Test title lookup of many titled sections, with add and remove */
+
+#include "check_confuse.h"
+#include <string.h>
+
+static cfg_opt_t host_opts[] = {
+	CFG_INT("id", 0, CFGF_NONE),
+	CFG_END()
+};
+
+static void scaling(void)
+{
+	cfg_opt_t opts[] = {
+		CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE | CFGF_NO_TITLE_DUPES),
+		CFG_END()
+	};
+	int num_sections = test_size(1000, 100000);
+	char title[32];
+	double start;
+	size_t len;
+	cfg_t *cfg;
+	char *buf;
+	int i;
+
+	buf = malloc(num_sections * 40);
+	fail_unless(buf);
+	for (i = 0, len = 0; i < num_sections; i++)
+		len += sprintf(buf + len, "host \"tenant%d\" { id = %d }\n", i, i);
+
+	cfg = cfg_init(opts, CFGF_NONE);
+	fail_unless(cfg);
+
+	start = now();
+	fail_unless(cfg_parse_buf(cfg, buf) == CFG_SUCCESS);
+	if (bench_enabled())
+		printf("parsed %d titled sections in %.3f s\n", num_sections, now() - start);
+	fail_unless(cfg_size(cfg, "host") == (unsigned int)num_sections);
+
+	start = now();
+	for (i = 0; i < num_sections; i++) {
+		snprintf(title, sizeof(title), "tenant%d", i);
+		fail_unless(cfg_getint(cfg_gettsec(cfg, "host", title), "id") == i);
+	}
+	if (bench_enabled())
+		printf("looked up %d titles in %.3f s\n", num_sections, now() - start);
+
+	/* Remove every 100th section, the index must follow the renumbering */
+	for (i = 0; i < num_sections; i += 100) {
+		snprintf(title, sizeof(title), "tenant%d", i);
+		fail_unless(cfg_rmtsec(cfg, "host", title) == 0);
+	}
+	fail_unless(cfg_size(cfg, "host") == (unsigned int)(num_sections - num_sections / 100));
+
+	for (i = 0; i < num_sections; i++) {
+		cfg_t *sec;
+
+		snprintf(title, sizeof(title), "tenant%d", i);
+		sec = cfg_gettsec(cfg, "host", title);
+		if (i % 100)
+			fail_unless(sec && cfg_getint(sec, "id") == i);
+		else
+			fail_unless(sec == NULL);
+	}
+
+	/* Duplicates are still detected */
+	fail_unless(cfg_parse_buf(cfg, "host tenant1 {}") == CFG_PARSE_ERROR);
+	fail_unless(cfg_parse_buf(cfg, "host tenant0 { id = 4711 }") == CFG_SUCCESS);
+	fail_unless(cfg_getint(cfg, "host=tenant0|id") == 4711);
+	fail_unless(cfg_addtsec(cfg, "host", "tenant100") != NULL);
+	fail_unless(cfg_addtsec(cfg, "host", "tenant101") == NULL);
+	fail_unless(cfg_gettsec(cfg, "host", "tenant100") != NULL);
+
+	cfg_free(cfg);
+	free(buf);
+}
+
+static void nocase(void)
+{
+	cfg_opt_t opts[] = {
+		CFG_SEC("host", host_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_END()
+	};
+	cfg_t *cfg;
+
+	cfg = cfg_init(opts, CFGF_NOCASE);
+	fail_unless(cfg);
+	fail_unless(cfg_parse_buf(cfg, "host Foo { id = 1 }\nhost bar { id = 2 }\nhost FOO { id = 3 }") == CFG_SUCCESS);
+
+	/* Same section reused for the case-insensitive duplicate */
+	fail_unless(cfg_size(cfg, "host") == 2);
+	fail_unless(cfg_getint(cfg, "host=FOO|id") == 3);
+	fail_unless(cfg_getint(cfg, "host=bar|id") == 2);
+
+	fail_unless(cfg_rmtsec(cfg, "host", "bar") == 0);
+	fail_unless(cfg_size(cfg, "host") == 1);
+	fail_unless(cfg_gettsec(cfg, "host", "FOO") != NULL);
+
+	cfg_free(cfg);
+}
+
+int main(void)
+{
+	scaling();
+	nocase();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */